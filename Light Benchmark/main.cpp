@@ -0,0 +1,100 @@
+#include "../learnopengl/src/ClusteredLights.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <stdlib.h>
+#include <random>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+
+// Light Benchmark [light count] [frames] [--seed N] [--verify]
+// Bins light count point lights scattered through a 200 x 50 x 200 box for frames frames while the camera orbits
+// inside it (same projection as learnopengl), no GL context needed. Prints binning times and how full the clusters
+// got. --verify checks every frame by brute force: random points in view, every light that reaches a point has to be
+// on the list of the point's cluster.
+int main(int argc, char** argv) {
+	std::vector<std::string> args(argv + 1, argv + argc);
+	unsigned int seed = 1;
+	bool verify = false;
+	std::vector<std::string> positional;
+	for (size_t i = 0; i < args.size(); i++) {
+		if (args[i] == "--seed" && i + 1 < args.size())
+			seed = (unsigned int)std::strtoul(args[++i].c_str(), nullptr, 10);
+		else if (args[i] == "--verify")
+			verify = true;
+		else
+			positional.push_back(args[i]);
+	}
+	unsigned int lightCount = positional.size() > 0 ? (unsigned int)std::strtoul(positional[0].c_str(), nullptr, 10) : 4096;
+	unsigned int frames = positional.size() > 1 ? (unsigned int)std::strtoul(positional[1].c_str(), nullptr, 10) : 200;
+	if (positional.size() > 2 || frames == 0 || lightCount > MAX_CLUSTERED_LIGHTS) {
+		std::cout << "usage: \"Light Benchmark\" [light count] [frames] [--seed N] [--verify]\n";
+		return EXIT_FAILURE;
+	}
+
+	ClusteredLights lights;
+	lights.scatter(lightCount, glm::vec3(-100.0f, 0.0f, -100.0f), glm::vec3(100.0f, 50.0f, 100.0f), seed);
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.10f, 10000.0f);
+
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<double> times;
+	double visible = 0.0, indices = 0.0, occupied = 0.0;
+	unsigned int maxClusterLights = 0;
+	uint64_t points = 0, misses = 0;
+	for (unsigned int frame = 0; frame < frames; frame++) {
+		float angle = glm::radians(360.0f) * frame / frames;
+		glm::vec3 eye = glm::vec3(std::sin(angle) * 60.0f, 10.0f, std::cos(angle) * 60.0f);
+		glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f, 10.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+		auto start = std::chrono::steady_clock::now();
+		lights.bin(view, projection);
+		times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+		visible += lights.visibleLights;
+		indices += lights.indices.size();
+		maxClusterLights = std::max(maxClusterLights, lights.maxClusterLights);
+		for (const ClusterRange& range : lights.clusters) {
+			occupied += range.count > 0;
+		}
+
+		if (!verify)
+			continue;
+		for (unsigned int i = 0; i < 1000; i++) {
+			float x = unit(random) * 2.0f - 1.0f, y = unit(random) * 2.0f - 1.0f;
+			float depth = 0.1f * std::pow(3000.0f, unit(random)); // 0.1 to 300, evenly over the log slices
+			glm::vec3 position(x * depth / projection[0][0], y * depth / projection[1][1], -depth);
+			const ClusterRange& range = lights.clusters[lights.clusterOf(position)];
+			const uint32_t* list = lights.indices.data() + range.offset;
+			for (uint32_t light = 0; light < lights.viewLights.size(); light++) {
+				glm::vec4 sphere = lights.viewLights[light].positionRadius;
+				glm::vec3 offset = glm::vec3(sphere) - position;
+				if (glm::dot(offset, offset) >= sphere.w * sphere.w)
+					continue;
+				points++;
+				if (!std::binary_search(list, list + range.count, light))
+					misses++;
+			}
+		}
+	}
+
+	std::vector<double> sorted = times;
+	std::sort(sorted.begin(), sorted.end());
+	double total = 0.0;
+	for (double time : sorted)
+		total += time;
+	double n = (double)frames;
+	std::ostringstream line;
+	line << std::fixed << std::setprecision(3) << "LIGHTS: " << lightCount << " lights, " << frames << " frames, "
+		<< workerPool().size() + 1 << " threads, avg " << total / n << " ms, p50 " << sorted[sorted.size() / 2] << " ms, max "
+		<< sorted.back() << " ms, " << std::defaultfloat << std::setprecision(3) << visible / n << " visible, "
+		<< indices / n << " indices, " << (occupied > 0.0 ? indices / occupied : 0.0) << " per occupied cluster, "
+		<< maxClusterLights << " max per cluster";
+	std::cout << line.str() << std::endl;
+	if (verify) {
+		std::cout << "verify: " << misses << " missing of " << points << " light/point pairs" << std::endl;
+		if (misses > 0)
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,235 @@
+#include <stb_image.h>
+#include "../learnopengl/src/Model.h"
+#include "../learnopengl/src/Headless.h"
+#include "../learnopengl/src/Profiler.h"
+#include <stdlib.h>
+#include <new>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Every allocation in the process goes through here so loads can be charged for theirs
+std::atomic<uint64_t> allocationCount{ 0 };
+std::atomic<uint64_t> allocationBytes{ 0 };
+
+void* operator new(size_t size) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	allocationBytes.fetch_add(size, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	std::free(p);
+}
+
+// Profiler markers the loader already has, grouped into the stages we report
+const std::vector<std::pair<const char*, std::vector<std::string>>> STAGES = {
+	{ "file_read", { "read file", "read buffers" } },
+	{ "json_parse", { "parse JSON" } },
+	{ "accessor_decode", { "decode accessors" } },
+	{ "vertex_assembly", { "assemble vertices" } },
+	{ "tangent_space", { "generate tangent space" } },
+	{ "image_decode", { "decode image" } },
+	{ "gpu_upload", { "upload texture array", "upload mesh" } },
+	{ "total", { "load model" } },
+};
+
+// Peak resident set in KiB, since the last successful resetPeakRss() (or process start)
+uint64_t peakRssKiB() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize / 1024;
+#else
+	// VmHWM follows resets, ru_maxrss never goes down
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.compare(0, 6, "VmHWM:") == 0)
+			return std::strtoull(line.c_str() + 6, nullptr, 10);
+	}
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (uint64_t)usage.ru_maxrss; // already KiB on Linux
+#endif
+}
+
+// Restarts the peak at the current resident set, false where that isn't possible (Windows, or no /proc)
+bool resetPeakRss() {
+#ifdef _WIN32
+	return false;
+#else
+	std::ofstream clearRefs("/proc/self/clear_refs");
+	clearRefs << "5";
+	clearRefs.flush();
+	return (bool)clearRefs;
+#endif
+}
+
+struct StageStats
+{
+	std::vector<double> ms; // one per iteration
+};
+
+struct AssetResult
+{
+	std::string name;
+	std::map<std::string, StageStats> stages;
+	std::vector<uint64_t> allocations;
+	std::vector<uint64_t> allocatedBytes;
+	uint64_t peakRssKiB = 0; // while loading this asset, only if resetting the peak worked
+	bool hasPeakRss = false;
+};
+
+// Milliseconds per stage of the load that started at `since`
+std::map<std::string, double> stageTimes(uint64_t since) {
+	std::map<std::string, double> times;
+	for (const ProfileEvent& event : profiler().cpuEvents()) {
+		if (event.begin < since)
+			continue;
+		for (const auto& stage : STAGES) {
+			for (const std::string& marker : stage.second) {
+				if (marker == event.name)
+					times[stage.first] += (event.end - event.begin) / 1e6;
+			}
+		}
+	}
+	return times;
+}
+
+void writeSummary(std::ostream& out, const std::vector<double>& values) {
+	double sum = 0.0, min = values.empty() ? 0.0 : values[0], max = min;
+	for (double value : values) {
+		sum += value;
+		min = std::min(min, value);
+		max = std::max(max, value);
+	}
+	std::vector<double> sorted = values;
+	std::sort(sorted.begin(), sorted.end());
+	double median = sorted.empty() ? 0.0 : sorted[sorted.size() / 2];
+	out << "{\"mean\":" << (values.empty() ? 0.0 : sum / values.size()) << ",\"median\":" << median << ",\"min\":" << min << ",\"max\":" << max << "}";
+}
+
+// Loader Benchmark [assets directory/] [--iterations N] [--out file]
+// Loads every <assets directory>/*/scene.gltf N times under a headless GL context and writes per-stage timings,
+// allocations and peak RSS (per asset where the OS lets us reset the peak, for the whole run otherwise) as JSON. Run from learnopengl/ (assets are found relative to it, like the main program).
+int main(int argc, char** argv) {
+	std::string assets = "assets/gltf/";
+	std::string outPath = "loader_benchmark.json";
+	unsigned int iterations = 5;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--iterations" && i + 1 < argc)
+			iterations = std::max(1u, (unsigned int)std::strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--out" && i + 1 < argc)
+			outPath = argv[++i];
+		else if (arg[0] != '-')
+			assets = arg;
+		else {
+			std::cout << "usage: \"Loader Benchmark\" [assets directory/] [--iterations N] [--out file]\n";
+			return EXIT_FAILURE;
+		}
+	}
+	if (assets.back() != '/' && assets.back() != '\\')
+		assets += '/';
+
+	HeadlessContext context;
+	if (!context.create() || !gladLoadGLLoader(HeadlessContext::loader())) {
+		std::cout << "ERROR::LOADER_BENCHMARK::NO_GL_CONTEXT\n";
+		return EXIT_FAILURE;
+	}
+	// stage timings come from the loader's own profiler markers; streaming would keep every load's textures around
+	profiler().setEnabled(true);
+	textureStreamer().budget = 0;
+
+	std::vector<std::string> directories;
+	for (const auto& entry : std::filesystem::directory_iterator(assets)) {
+		if (entry.is_directory() && std::filesystem::exists(entry.path() / "scene.gltf"))
+			directories.push_back(entry.path().filename().string());
+	}
+	std::sort(directories.begin(), directories.end());
+
+	std::vector<AssetResult> results;
+	for (const std::string& name : directories) {
+		AssetResult result;
+		result.name = name;
+		std::string directory = assets + name + "/";
+		result.hasPeakRss = resetPeakRss();
+		for (unsigned int i = 0; i < iterations; i++) {
+			uint64_t since = profiler().now();
+			uint64_t allocationsBefore = allocationCount.load();
+			uint64_t bytesBefore = allocationBytes.load();
+			{
+				Model model(directory.c_str());
+				glFinish(); // uploads count as done once the GPU has them
+				model.Release();
+			}
+			result.allocations.push_back(allocationCount.load() - allocationsBefore);
+			result.allocatedBytes.push_back(allocationBytes.load() - bytesBefore);
+			for (const auto& stage : stageTimes(since)) {
+				result.stages[stage.first].ms.push_back(stage.second);
+			}
+		}
+		if (result.hasPeakRss)
+			result.peakRssKiB = peakRssKiB();
+		results.push_back(result);
+		const std::vector<double>& total = result.stages["total"].ms;
+		if (total.empty())
+			std::cout << name << ": no timings\n"; // no iterations, or the profiler didn't record the load
+		else
+			std::cout << name << ": " << total.back() << " ms (last of " << iterations << ")\n";
+	}
+
+	// per-asset resets started the peak over, this one's the highest of them all
+	uint64_t processPeakRssKiB = peakRssKiB();
+	for (const AssetResult& result : results) {
+		processPeakRssKiB = std::max(processPeakRssKiB, result.peakRssKiB);
+	}
+
+	// one JSON document, stages in ms, allocations per load
+	std::ofstream out(outPath, std::ios::trunc);
+	out << std::setprecision(6);
+	out << "{\"renderer\":\"" << glGetString(GL_RENDERER) << "\",\"iterations\":" << iterations << ",\"process_peak_rss_kib\":" << processPeakRssKiB << ",\"assets\":[";
+	for (unsigned int a = 0; a < results.size(); a++) {
+		const AssetResult& result = results[a];
+		out << (a ? "," : "") << "\n{\"name\":\"" << result.name << "\",\"stages_ms\":{";
+		for (unsigned int s = 0; s < STAGES.size(); s++) {
+			auto found = result.stages.find(STAGES[s].first);
+			out << (s ? "," : "") << "\"" << STAGES[s].first << "\":";
+			writeSummary(out, found == result.stages.end() ? std::vector<double>() : found->second.ms);
+		}
+		std::vector<double> allocations(result.allocations.begin(), result.allocations.end());
+		std::vector<double> bytes(result.allocatedBytes.begin(), result.allocatedBytes.end());
+		out << "},\"allocations\":";
+		writeSummary(out, allocations);
+		out << ",\"allocated_bytes\":";
+		writeSummary(out, bytes);
+		if (result.hasPeakRss)
+			out << ",\"peak_rss_kib\":" << result.peakRssKiB;
+		out << "}";
+	}
+	out << "\n]}\n";
+	if (!out) {
+		std::cout << "ERROR::LOADER_BENCHMARK::COULD_NOT_WRITE " << outPath << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "results written to " << outPath << std::endl;
+	return EXIT_SUCCESS;
+}
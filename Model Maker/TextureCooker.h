@@ -0,0 +1,489 @@
+#pragma once
+#include <stb_image.h>
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+#include "../learnopengl/src/KTX2.h"
+#include "../learnopengl/src/ThreadPool.h"
+
+/* Offline texture stage: decode an image, build its whole mip chain on the CPU and block-compress every level into a
+KTX2 file the runtime uploads as-is (see Model::loadTexture).
+
+Formats are picked from what the texture is used for:
+	base color  BC7 (BC1, or BC3 with alpha, when cooking --fast)
+	emissive    BC7 (BC1 when --fast)
+	normal      BC5, only X/Y are kept and the shader rebuilds Z
+	metal/rough BC1
+	occlusion   BC1
+Color textures are filtered in linear light and stored sRGB-encoded in UNORM formats, same as the uncompressed path,
+since the renderer doesn't output sRGB yet. */
+
+enum TextureRole {
+	ROLE_NORMAL = 0, // in priority order for images shared between roles
+	ROLE_BASE_COLOR,
+	ROLE_EMISSIVE,
+	ROLE_METALLIC_ROUGHNESS,
+	ROLE_OCCLUSION
+};
+
+// block rows per job
+const unsigned int COOK_GRAIN = 4;
+
+// RGBA float image, values in the space we filter in (linear color, or [-1, 1] for normals)
+struct CookImage
+{
+	unsigned int width = 0;
+	unsigned int height = 0;
+	std::vector<float> pixels;
+};
+
+inline float srgbToLinear(float c) {
+	return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float linearToSrgb(float c) {
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+inline bool isColorRole(TextureRole role) {
+	return role == ROLE_BASE_COLOR || role == ROLE_EMISSIVE;
+}
+
+inline float lanczos2(float x) {
+	const float PI = 3.14159265f;
+	x = std::fabs(x);
+	if (x < 1e-5f)
+		return 1.0f;
+	if (x >= 2.0f)
+		return 0.0f;
+	return 2.0f * std::sin(PI * x) * std::sin(PI * x / 2.0f) / (PI * PI * x * x);
+}
+
+class TextureCooker
+{
+public:
+	bool fast = false;
+
+	uint32_t formatFor(TextureRole role, bool hasAlpha) const {
+		switch (role) {
+		case ROLE_NORMAL: return VK_FORMAT_BC5_UNORM_BLOCK;
+		case ROLE_BASE_COLOR:
+			if (!fast) return VK_FORMAT_BC7_UNORM_BLOCK;
+			return hasAlpha ? VK_FORMAT_BC3_UNORM_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		case ROLE_EMISSIVE: return fast ? VK_FORMAT_BC1_RGB_UNORM_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+		default: return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		}
+	}
+
+	bool cook(const std::string& inPath, const std::string& outPath, TextureRole role) {
+		int width, height, nrChannels;
+		unsigned char* data = stbi_load(inPath.c_str(), &width, &height, &nrChannels, 4);
+		if (!data) {
+			std::cout << "Failed to load texture at path " << inPath << std::endl;
+			return false;
+		}
+
+		bool hasAlpha = false;
+		CookImage image = decode(data, width, height, role, hasAlpha);
+		stbi_image_free(data);
+		uint32_t format = formatFor(role, hasAlpha && nrChannels == 4);
+
+		// full chain down to 1x1, each level filtered from the level above
+		std::vector<std::vector<unsigned char>> levels;
+		levels.push_back(encode(image, role, format));
+		while (image.width > 1 || image.height > 1) {
+			image = downsample(image, role);
+			levels.push_back(encode(image, role, format));
+		}
+
+		if (!writeKtx2(outPath, format, width, height, levels)) {
+			std::cout << "ERROR::COOKER::COULD_NOT_WRITE " << outPath << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+private:
+	CookImage decode(const unsigned char* data, unsigned int width, unsigned int height, TextureRole role, bool& hasAlpha) {
+		CookImage image;
+		image.width = width;
+		image.height = height;
+		image.pixels.resize((size_t)width * height * 4);
+		for (size_t i = 0; i < (size_t)width * height; i++) {
+			for (int c = 0; c < 4; c++) {
+				float v = data[i * 4 + c] / 255.0f;
+				if (c < 3 && isColorRole(role))
+					v = srgbToLinear(v);
+				else if (c < 3 && role == ROLE_NORMAL)
+					v = v * 2.0f - 1.0f;
+				image.pixels[i * 4 + c] = v;
+			}
+			hasAlpha |= data[i * 4 + 3] != 255;
+		}
+		return image;
+	}
+
+	// Half size (rounded down, at least 1) with a separable Lanczos-2 filter
+	CookImage downsample(const CookImage& src, TextureRole role) {
+		unsigned int dstWidth = std::max(1u, src.width / 2);
+		unsigned int dstHeight = std::max(1u, src.height / 2);
+
+		// horizontal pass (dstWidth x src.height), then vertical
+		CookImage tmp;
+		tmp.width = dstWidth;
+		tmp.height = src.height;
+		tmp.pixels.resize((size_t)tmp.width * tmp.height * 4);
+		workerPool().parallelFor(src.height, 16, [&](unsigned int begin, unsigned int end) {
+			for (unsigned int y = begin; y < end; y++) {
+				resampleLine(&src.pixels[(size_t)y * src.width * 4], 4, src.width, &tmp.pixels[(size_t)y * dstWidth * 4], 4, dstWidth);
+			}
+		});
+
+		CookImage dst;
+		dst.width = dstWidth;
+		dst.height = dstHeight;
+		dst.pixels.resize((size_t)dstWidth * dstHeight * 4);
+		workerPool().parallelFor(dstWidth, 16, [&](unsigned int begin, unsigned int end) {
+			for (unsigned int x = begin; x < end; x++) {
+				resampleLine(&tmp.pixels[x * 4], (size_t)dstWidth * 4, src.height, &dst.pixels[x * 4], (size_t)dstWidth * 4, dstHeight);
+			}
+		});
+
+		// keep normals unit length, and clamp the filter's overshoot for everything else
+		for (size_t i = 0; i < dst.pixels.size(); i += 4) {
+			float* p = &dst.pixels[i];
+			if (role == ROLE_NORMAL) {
+				float length = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+				if (length > 1e-6f) {
+					p[0] /= length;
+					p[1] /= length;
+					p[2] /= length;
+				}
+			}
+			else {
+				for (int c = 0; c < 3; c++) {
+					p[c] = std::min(std::max(p[c], 0.0f), 1.0f);
+				}
+			}
+			p[3] = std::min(std::max(p[3], 0.0f), 1.0f);
+		}
+		return dst;
+	}
+
+	// Resample one row/column of RGBA pixels (stride in floats between pixels), clamping at the edges
+	static void resampleLine(const float* src, size_t srcStride, unsigned int srcCount, float* dst, size_t dstStride, unsigned int dstCount) {
+		float ratio = (float)srcCount / dstCount;
+		float support = 2.0f * ratio;
+		for (unsigned int d = 0; d < dstCount; d++) {
+			float center = (d + 0.5f) * ratio;
+			int first = (int)std::floor(center - support);
+			int last = (int)std::ceil(center + support);
+			float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			float weightSum = 0.0f;
+			for (int s = first; s <= last; s++) {
+				float w = lanczos2((s + 0.5f - center) / ratio);
+				if (w == 0.0f)
+					continue;
+				int clamped = std::min(std::max(s, 0), (int)srcCount - 1);
+				const float* p = src + clamped * srcStride;
+				for (int c = 0; c < 4; c++) {
+					sum[c] += p[c] * w;
+				}
+				weightSum += w;
+			}
+			for (int c = 0; c < 4; c++) {
+				dst[d * dstStride + c] = sum[c] / weightSum;
+			}
+		}
+	}
+
+	// Back to 8 bits in storage encoding, then compress block rows in parallel
+	std::vector<unsigned char> encode(CookImage& image, TextureRole role, uint32_t format) {
+		std::vector<unsigned char> bytes(image.pixels.size());
+		for (size_t i = 0; i < image.pixels.size(); i++) {
+			float v = image.pixels[i];
+			bool rgb = (i % 4) < 3;
+			if (rgb && isColorRole(role))
+				v = linearToSrgb(v);
+			else if (rgb && role == ROLE_NORMAL)
+				v = v * 0.5f + 0.5f;
+			bytes[i] = (unsigned char)std::min(std::max(v * 255.0f + 0.5f, 0.0f), 255.0f);
+		}
+
+		unsigned int blocksX = (image.width + 3) / 4;
+		unsigned int blocksY = (image.height + 3) / 4;
+		unsigned int blockBytes = ktx2BlockBytes(format);
+		std::vector<unsigned char> out((size_t)blocksX * blocksY * blockBytes);
+		workerPool().parallelFor(blocksY, COOK_GRAIN, [&](unsigned int begin, unsigned int end) {
+			unsigned char block[16][4];
+			for (unsigned int by = begin; by < end; by++) {
+				for (unsigned int bx = 0; bx < blocksX; bx++) {
+					// gather 4x4 texels, repeating the edge for images smaller than a block
+					for (unsigned int i = 0; i < 16; i++) {
+						unsigned int x = std::min(bx * 4 + i % 4, image.width - 1);
+						unsigned int y = std::min(by * 4 + i / 4, image.height - 1);
+						std::memcpy(block[i], &bytes[((size_t)y * image.width + x) * 4], 4);
+					}
+					unsigned char* dst = &out[((size_t)by * blocksX + bx) * blockBytes];
+					encodeBlock(block, format, dst);
+				}
+			}
+		});
+		return out;
+	}
+
+	static void encodeBlock(const unsigned char block[16][4], uint32_t format, unsigned char* out) {
+		unsigned char channel[16];
+		switch (format) {
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+			encodeColorBlock(block, out);
+			break;
+		case VK_FORMAT_BC3_UNORM_BLOCK:
+			for (int i = 0; i < 16; i++) channel[i] = block[i][3];
+			encodeSingleChannelBlock(channel, out);
+			encodeColorBlock(block, out + 8);
+			break;
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+			for (int i = 0; i < 16; i++) channel[i] = block[i][0];
+			encodeSingleChannelBlock(channel, out);
+			for (int i = 0; i < 16; i++) channel[i] = block[i][1];
+			encodeSingleChannelBlock(channel, out + 8);
+			break;
+		default:
+			encodeBC7Block(block, out);
+			break;
+		}
+	}
+
+	// Principal axis of the block's colors (first `dims` channels) by power iteration on the covariance matrix
+	static void principalAxis(const unsigned char block[16][4], int dims, float mean[4], float axis[4]) {
+		for (int c = 0; c < 4; c++) {
+			mean[c] = 0.0f;
+			axis[c] = c < dims ? 1.0f : 0.0f;
+		}
+		for (int i = 0; i < 16; i++) {
+			for (int c = 0; c < dims; c++) {
+				mean[c] += block[i][c] / 16.0f;
+			}
+		}
+		float cov[4][4] = {};
+		for (int i = 0; i < 16; i++) {
+			float d[4];
+			for (int c = 0; c < dims; c++) d[c] = block[i][c] - mean[c];
+			for (int a = 0; a < dims; a++) {
+				for (int b = 0; b < dims; b++) {
+					cov[a][b] += d[a] * d[b];
+				}
+			}
+		}
+		for (int iteration = 0; iteration < 8; iteration++) {
+			float next[4] = {};
+			for (int a = 0; a < dims; a++) {
+				for (int b = 0; b < dims; b++) {
+					next[a] += cov[a][b] * axis[b];
+				}
+			}
+			float length = 0.0f;
+			for (int c = 0; c < dims; c++) length += next[c] * next[c];
+			length = std::sqrt(length);
+			if (length < 1e-6f)
+				break; // flat block, any axis works
+			for (int c = 0; c < dims; c++) axis[c] = next[c] / length;
+		}
+	}
+
+	// Endpoints along the principal axis at the extreme projections
+	static void fitEndpoints(const unsigned char block[16][4], int dims, float e0[4], float e1[4]) {
+		float mean[4], axis[4];
+		principalAxis(block, dims, mean, axis);
+		float minT = 0.0f, maxT = 0.0f;
+		for (int i = 0; i < 16; i++) {
+			float t = 0.0f;
+			for (int c = 0; c < dims; c++) t += (block[i][c] - mean[c]) * axis[c];
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+		for (int c = 0; c < 4; c++) {
+			e0[c] = std::min(std::max(mean[c] + axis[c] * maxT, 0.0f), 255.0f);
+			e1[c] = std::min(std::max(mean[c] + axis[c] * minT, 0.0f), 255.0f);
+		}
+	}
+
+	static uint16_t pack565(const float c[4]) {
+		unsigned int r = (unsigned int)(c[0] * 31.0f / 255.0f + 0.5f);
+		unsigned int g = (unsigned int)(c[1] * 63.0f / 255.0f + 0.5f);
+		unsigned int b = (unsigned int)(c[2] * 31.0f / 255.0f + 0.5f);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	static void unpack565(uint16_t v, int out[3]) {
+		out[0] = ((v >> 11) & 31) * 255 / 31;
+		out[1] = ((v >> 5) & 63) * 255 / 63;
+		out[2] = (v & 31) * 255 / 31;
+	}
+
+	// BC1 color block (also the color half of BC3), always in 4-color mode
+	static void encodeColorBlock(const unsigned char block[16][4], unsigned char out[8]) {
+		float e0[4], e1[4];
+		fitEndpoints(block, 3, e0, e1);
+		uint16_t c0 = pack565(e0);
+		uint16_t c1 = pack565(e1);
+		if (c0 < c1)
+			std::swap(c0, c1); // c0 > c1 selects 4-color mode
+
+		int palette[4][3];
+		unpack565(c0, palette[0]);
+		unpack565(c1, palette[1]);
+		for (int c = 0; c < 3; c++) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		uint32_t indices = 0;
+		if (c0 != c1) {
+			for (int i = 0; i < 16; i++) {
+				indices |= (uint32_t)nearest(block[i], palette, 4, 3) << (2 * i);
+			}
+		}
+		out[0] = c0 & 0xFF;
+		out[1] = c0 >> 8;
+		out[2] = c1 & 0xFF;
+		out[3] = c1 >> 8;
+		for (int i = 0; i < 4; i++) {
+			out[4 + i] = (indices >> (8 * i)) & 0xFF;
+		}
+	}
+
+	// BC4 block (BC3 alpha, each half of BC5), 8-value mode
+	static void encodeSingleChannelBlock(const unsigned char values[16], unsigned char out[8]) {
+		int a0 = *std::max_element(values, values + 16);
+		int a1 = *std::min_element(values, values + 16);
+		int palette[8];
+		palette[0] = a0;
+		palette[1] = a1;
+		for (int i = 2; i < 8; i++) {
+			palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+		}
+
+		uint64_t indices = 0;
+		if (a0 != a1) {
+			for (int i = 0; i < 16; i++) {
+				int best = 0, bestError = 256;
+				for (int p = 0; p < 8; p++) {
+					int error = std::abs(values[i] - palette[p]);
+					if (error < bestError) {
+						bestError = error;
+						best = p;
+					}
+				}
+				indices |= (uint64_t)best << (3 * i);
+			}
+		}
+		out[0] = (unsigned char)a0;
+		out[1] = (unsigned char)a1;
+		for (int i = 0; i < 6; i++) {
+			out[2 + i] = (indices >> (8 * i)) & 0xFF;
+		}
+	}
+
+	// BC7 mode 6: one subset, RGBA 7.7.7.7 endpoints with a p-bit each, 4-bit indices
+	static void encodeBC7Block(const unsigned char block[16][4], unsigned char out[16]) {
+		static const int WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+		float e[2][4];
+		fitEndpoints(block, 4, e[0], e[1]);
+
+		// quantize each endpoint to 7 bits + shared p-bit, keeping whichever p-bit lands closer
+		int q[2][4], pbit[2];
+		for (int n = 0; n < 2; n++) {
+			float bestError = 1e30f;
+			for (int p = 0; p < 2; p++) {
+				int candidate[4];
+				float error = 0.0f;
+				for (int c = 0; c < 4; c++) {
+					candidate[c] = std::min(std::max((int)std::lround((e[n][c] - p) / 2.0f), 0), 127);
+					float d = ((candidate[c] << 1) | p) - e[n][c];
+					error += d * d;
+				}
+				if (error < bestError) {
+					bestError = error;
+					pbit[n] = p;
+					std::copy(candidate, candidate + 4, q[n]);
+				}
+			}
+		}
+
+		int palette[16][4];
+		for (int i = 0; i < 16; i++) {
+			for (int c = 0; c < 4; c++) {
+				int v0 = (q[0][c] << 1) | pbit[0];
+				int v1 = (q[1][c] << 1) | pbit[1];
+				palette[i][c] = ((64 - WEIGHTS[i]) * v0 + WEIGHTS[i] * v1 + 32) >> 6;
+			}
+		}
+		int indices[16];
+		for (int i = 0; i < 16; i++) {
+			indices[i] = nearest(block[i], palette, 16, 4);
+		}
+
+		// the first index is stored with its top bit implied zero, so swap the endpoints if it's set
+		if (indices[0] & 8) {
+			for (int c = 0; c < 4; c++) std::swap(q[0][c], q[1][c]);
+			std::swap(pbit[0], pbit[1]);
+			for (int i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+		}
+
+		BitWriter bits;
+		bits.write(1 << 6, 7); // mode 6
+		for (int c = 0; c < 4; c++) {
+			bits.write(q[0][c], 7);
+			bits.write(q[1][c], 7);
+		}
+		bits.write(pbit[0], 1);
+		bits.write(pbit[1], 1);
+		bits.write(indices[0], 3);
+		for (int i = 1; i < 16; i++) {
+			bits.write(indices[i], 4);
+		}
+		bits.store(out);
+	}
+
+	template<int N>
+	static int nearest(const unsigned char pixel[4], const int (*palette)[N], int count, int dims) {
+		int best = 0, bestError = INT32_MAX;
+		for (int p = 0; p < count; p++) {
+			int error = 0;
+			for (int c = 0; c < dims; c++) {
+				int d = pixel[c] - palette[p][c];
+				error += d * d;
+			}
+			if (error < bestError) {
+				bestError = error;
+				best = p;
+			}
+		}
+		return best;
+	}
+
+	// 128-bit little-endian bit packer for BC7 blocks
+	struct BitWriter
+	{
+		unsigned char bytes[16] = {};
+		unsigned int position = 0;
+
+		void write(uint32_t value, unsigned int count) {
+			for (unsigned int i = 0; i < count; i++, position++) {
+				if (value & (1u << i))
+					bytes[position / 8] |= 1 << (position % 8);
+			}
+		}
+
+		void store(unsigned char out[16]) const {
+			std::memcpy(out, bytes, 16);
+		}
+	};
+};
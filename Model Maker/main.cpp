@@ -1,7 +1,71 @@
+#include <stb_image.h>
 #include "../learnopengl/src/Mesh.h"
 #include "../learnopengl/src/Model.h"
+#include "TextureCooker.h"
 #include <stdlib.h>
+#include <map>
+#include <chrono>
 
-int main() {
-	return 0;
-}
\ No newline at end of file
+// Role of every image in a glTF file, from the material slots that reference it
+std::map<unsigned int, TextureRole> imageRoles(json& JSON) {
+	std::map<unsigned int, TextureRole> roles;
+	auto use = [&](json& textureInfo, TextureRole role) {
+		unsigned int image = JSON["textures"][(unsigned int)textureInfo["index"]]["source"];
+		auto found = roles.find(image);
+		if (found == roles.end() || role < found->second)
+			roles[image] = role;
+	};
+
+	if (JSON.find("materials") == JSON.end())
+		return roles;
+	for (json& mat : JSON["materials"]) {
+		if (mat.find("pbrMetallicRoughness") != mat.end()) {
+			json& pbr = mat["pbrMetallicRoughness"];
+			if (pbr.find("baseColorTexture") != pbr.end()) use(pbr["baseColorTexture"], ROLE_BASE_COLOR);
+			if (pbr.find("metallicRoughnessTexture") != pbr.end()) use(pbr["metallicRoughnessTexture"], ROLE_METALLIC_ROUGHNESS);
+		}
+		if (mat.find("normalTexture") != mat.end()) use(mat["normalTexture"], ROLE_NORMAL);
+		if (mat.find("occlusionTexture") != mat.end()) use(mat["occlusionTexture"], ROLE_OCCLUSION);
+		if (mat.find("emissiveTexture") != mat.end()) use(mat["emissiveTexture"], ROLE_EMISSIVE);
+	}
+	return roles;
+}
+
+// Model Maker <model directory/> [--fast]
+// Cooks every texture of <model directory/>scene.gltf into <image>.ktx2 next to the image
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cout << "usage: \"Model Maker\" <model directory/> [--fast]\n";
+		return EXIT_FAILURE;
+	}
+	std::string directory = argv[1];
+	if (directory.back() != '/' && directory.back() != '\\')
+		directory += '/';
+
+	TextureCooker cooker;
+	for (int i = 2; i < argc; i++) {
+		if (std::string(argv[i]) == "--fast")
+			cooker.fast = true;
+	}
+
+	std::ifstream file(directory + "scene.gltf");
+	if (!file) {
+		std::cout << "ERROR::MODEL_MAKER::FILE_NOT_SUCCESSFULLY_READ\n" << directory << "scene.gltf" << std::endl;
+		return EXIT_FAILURE;
+	}
+	json JSON = json::parse(file);
+
+	int failed = 0;
+	for (auto& [image, role] : imageRoles(JSON)) {
+		std::string uri = JSON["images"][image].value("uri", "");
+		if (uri.empty())
+			continue; // embedded in a buffer view, nothing to cook from
+
+		auto start = std::chrono::steady_clock::now();
+		bool ok = cooker.cook(directory + uri, directory + uri + ".ktx2", role);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << (ok ? "cooked " : "FAILED ") << uri << " (" << ms << " ms)\n";
+		failed += !ok;
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+#include <stb_image.h>
+#include "../learnopengl/src/Scene.h"
+#include <stdlib.h>
+#include <random>
+#include <chrono>
+
+// Scene Maker <out.scene> <instance count> <model directory/>... [--spacing S] [--cell S] [--seed N] [--octree]
+// Scatters instances of the given models over a square grid on the XZ plane (random model, yaw and scale per
+// instance) and writes them as a scene file. Model directories are stored relative to the scene file. --octree makes
+// the scene index its instances with a loose octree instead of the hashed grid.
+int main(int argc, char** argv) {
+	std::vector<std::string> args(argv + 1, argv + argc);
+	float spacing = 4.0f;
+	float cellSize = 64.0f;
+	unsigned int seed = 1;
+	SpatialPartition partition = PARTITION_GRID;
+	std::vector<std::string> positional;
+	for (size_t i = 0; i < args.size(); i++) {
+		bool hasValue = i + 1 < args.size();
+		if (args[i] == "--spacing" && hasValue)
+			spacing = std::strtof(args[++i].c_str(), nullptr);
+		else if (args[i] == "--cell" && hasValue)
+			cellSize = std::strtof(args[++i].c_str(), nullptr);
+		else if (args[i] == "--seed" && hasValue)
+			seed = (unsigned int)std::strtoul(args[++i].c_str(), nullptr, 10);
+		else if (args[i] == "--octree")
+			partition = PARTITION_OCTREE;
+		else
+			positional.push_back(args[i]);
+	}
+	if (positional.size() < 3 || !(spacing > 0.0f) || !(cellSize > 0.0f)) {
+		std::cout << "usage: \"Scene Maker\" <out.scene> <instance count> <model directory/>... [--spacing S] [--cell S] [--seed N] [--octree]\n";
+		return EXIT_FAILURE;
+	}
+	std::string out = positional[0];
+	unsigned int count = (unsigned int)std::strtoul(positional[1].c_str(), nullptr, 10);
+
+	SceneData scene;
+	scene.cellSize = cellSize;
+	scene.partition = partition;
+	std::filesystem::path base = std::filesystem::absolute(out).parent_path();
+	for (size_t i = 2; i < positional.size(); i++) {
+		std::string model = std::filesystem::relative(std::filesystem::absolute(positional[i]), base).generic_string();
+		if (model.empty() || model.back() != '/')
+			model += '/';
+		scene.models.push_back(model);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::mt19937 random(seed);
+	std::uniform_int_distribution<unsigned int> pickModel(0, (unsigned int)scene.models.size() - 1);
+	std::uniform_real_distribution<float> pickAngle(0.0f, 6.2831853f);
+	std::uniform_real_distribution<float> pickScale(0.75f, 1.25f);
+	unsigned int side = (unsigned int)std::ceil(std::sqrt((double)count));
+	for (unsigned int i = 0; i < count; i++) {
+		SceneInstance instance;
+		instance.model = pickModel(random);
+		instance.position[0] = ((float)(i % side) - side * 0.5f) * spacing;
+		instance.position[1] = 0.0f;
+		instance.position[2] = ((float)(i / side) - side * 0.5f) * spacing;
+		float angle = pickAngle(random);
+		instance.rotation[0] = 0.0f;
+		instance.rotation[1] = std::sin(angle * 0.5f);
+		instance.rotation[2] = 0.0f;
+		instance.rotation[3] = std::cos(angle * 0.5f);
+		instance.scale = pickScale(random);
+		scene.instances.push_back(instance);
+	}
+
+	if (!writeScene(out, scene))
+		return EXIT_FAILURE;
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "wrote " << out << ": " << scene.models.size() << " models, " << scene.instances.size() << " instances in "
+		<< scene.cells.size() << " cells (" << ms << " ms)\n";
+	return EXIT_SUCCESS;
+}
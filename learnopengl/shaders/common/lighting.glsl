@@ -0,0 +1,99 @@
+// Clustered lights, filled by ClusteredLights.h (keep in sync with LightingParams and GpuPointLight there)
+layout (std140, binding = 0) uniform Lighting
+{
+    vec4 projectionScale; // projection[0][0], projection[1][1], depth slice scale and bias
+    vec4 sunDirection;    // view space, towards the sun
+    vec4 sunColor;
+    vec4 ambientColor;
+    uvec4 clusterGrid;    // tiles across, tiles up, depth slices, light count
+};
+
+struct PointLight
+{
+    vec4 positionRadius; // view space
+    vec4 color;          // premultiplied by intensity
+};
+
+layout (std430, binding = 4) readonly buffer Lights
+{
+    PointLight lights[];
+};
+// per cluster: where its list starts in lightIndices and how long it is
+layout (std430, binding = 5) readonly buffer Clusters
+{
+    uvec2 clusters[];
+};
+layout (std430, binding = 6) readonly buffer LightIndices
+{
+    uint lightIndices[];
+};
+
+const float PI = 3.14159265;
+
+// Cluster a view-space position falls in, the same grid ClusteredLights::bin fills
+uint clusterIndex(vec3 viewPosition)
+{
+    float depth = -viewPosition.z;
+    vec2 ndc = projectionScale.xy * viewPosition.xy / depth;
+    vec2 tile = clamp(floor((ndc * 0.5 + 0.5) * vec2(clusterGrid.xy)), vec2(0.0), vec2(clusterGrid.xy) - 1.0);
+    float slice = clamp(floor(log(depth) * projectionScale.z + projectionScale.w), 0.0, float(clusterGrid.z) - 1.0);
+    return uint(tile.x) + clusterGrid.x * (uint(tile.y) + clusterGrid.y * uint(slice));
+}
+
+struct Surface
+{
+    vec3 N; // view space
+    vec3 V; // towards the eye
+    vec3 albedo;
+    float metallic;
+    float roughness;
+};
+
+// Metallic-roughness Cook-Torrance (GGX, Schlick-GGX geometry, Schlick Fresnel) plus Lambert, for light arriving
+// from L with the given radiance
+vec3 brdf(Surface surface, vec3 L, vec3 radiance)
+{
+    vec3 H = normalize(surface.V + L);
+    float NdotL = max(dot(surface.N, L), 0.0);
+    float NdotV = max(dot(surface.N, surface.V), 1e-4);
+    float NdotH = max(dot(surface.N, H), 0.0);
+    float VdotH = max(dot(surface.V, H), 0.0);
+
+    float alpha = surface.roughness * surface.roughness;
+    float alpha2 = alpha * alpha;
+    float d = NdotH * NdotH * (alpha2 - 1.0) + 1.0;
+    float D = alpha2 / (PI * d * d);
+    float k = (surface.roughness + 1.0) * (surface.roughness + 1.0) / 8.0;
+    float G = NdotV / (NdotV * (1.0 - k) + k) * NdotL / (NdotL * (1.0 - k) + k);
+    vec3 F0 = mix(vec3(0.04), surface.albedo, surface.metallic);
+    vec3 F = F0 + (1.0 - F0) * pow(1.0 - VdotH, 5.0);
+
+    vec3 specular = D * G * F / max(4.0 * NdotV * NdotL, 1e-4);
+    vec3 diffuse = (1.0 - F) * (1.0 - surface.metallic) * surface.albedo / PI;
+    return (diffuse + specular) * radiance * NdotL;
+}
+
+// Inverse square, windowed to reach zero at the radius so nothing pops where a light's clusters end
+float falloff(float distance2, float radius)
+{
+    float s = distance2 / (radius * radius);
+    float window = clamp(1.0 - s * s, 0.0, 1.0);
+    return window * window / max(distance2, 1e-4);
+}
+
+// The sun (sunVisibility of it gets through, see shadows.glsl) plus the point lights of the position's cluster
+vec3 shade(Surface surface, vec3 viewPosition, float sunVisibility)
+{
+    vec3 color = brdf(surface, sunDirection.xyz, sunColor.rgb * sunVisibility);
+    uvec2 range = clusters[clusterIndex(viewPosition)];
+    for (uint i = 0u; i < range.y; i++) {
+        PointLight light = lights[lightIndices[range.x + i]];
+        vec3 toLight = light.positionRadius.xyz - viewPosition;
+        float distance2 = dot(toLight, toLight);
+        float radius = light.positionRadius.w;
+        if (distance2 >= radius * radius)
+            continue;
+        color += brdf(surface, toLight * inversesqrt(distance2), light.color.rgb * falloff(distance2, radius));
+    }
+    return color;
+}
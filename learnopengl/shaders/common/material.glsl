@@ -0,0 +1,58 @@
+// keep in sync with MaterialParams in Material.h
+struct Material
+{
+    vec4 baseColorFactor;
+    vec4 emissiveFactor;
+    float metallicFactor;
+    float roughnessFactor;
+    float normalScale;
+    float alphaCutoff;
+    uint textureMask;
+    uint arrayMask;
+    uint atlasMask;
+    uint pad0;
+    vec4 atlasRect[5];
+    uint layer[5];
+};
+
+layout (std430, binding = 0) readonly buffer Materials
+{
+    Material materials[];
+};
+
+// comes with each draw, see mesh.vert
+flat in uint materialIndex;
+
+// bindings match TextureSlot in Material.h
+layout (binding = 0) uniform sampler2D baseColorMap;
+layout (binding = 1) uniform sampler2D metallicRoughnessMap;
+layout (binding = 2) uniform sampler2D normalMap;
+layout (binding = 3) uniform sampler2D occlusionMap;
+layout (binding = 4) uniform sampler2D emissiveMap;
+
+// the same slots for textures packed into arrays (SLOT_COUNT + slot)
+layout (binding = 5) uniform sampler2DArray baseColorArray;
+layout (binding = 6) uniform sampler2DArray metallicRoughnessArray;
+layout (binding = 7) uniform sampler2DArray normalArray;
+layout (binding = 8) uniform sampler2DArray occlusionArray;
+layout (binding = 9) uniform sampler2DArray emissiveArray;
+
+const uint SLOT_BASE_COLOR = 0u;
+const uint SLOT_METALLIC_ROUGHNESS = 1u;
+const uint SLOT_NORMAL = 2u;
+const uint SLOT_OCCLUSION = 3u;
+const uint SLOT_EMISSIVE = 4u;
+
+// Sample a slot wherever its texture lives. The branches only depend on the material, so they're uniform per draw
+vec4 sampleSlot(Material material, sampler2D map, sampler2DArray arrayMap, uint slot, vec2 uv)
+{
+    if ((material.arrayMask & (1u << slot)) == 0u)
+        return texture(map, uv);
+    if ((material.atlasMask & (1u << slot)) == 0u)
+        return texture(arrayMap, vec3(uv, float(material.layer[slot])));
+
+    // atlas entry: repeat by hand inside its rect, with derivatives of the unwrapped uv so the wrap doesn't show as a seam
+    vec4 rect = material.atlasRect[slot];
+    vec3 coord = vec3(fract(uv) * rect.xy + rect.zw, float(material.layer[slot]));
+    return textureGrad(arrayMap, coord, dFdx(uv) * rect.xy, dFdy(uv) * rect.xy);
+}
\ No newline at end of file
@@ -0,0 +1,7 @@
+// Normal from a tangent-space normal map sample and the interpolated vertex frame, the way MikkTSpace bakes them: the
+// bitangent is rebuilt per pixel and none of the interpolated vectors are normalized first
+vec3 perturbNormal(vec3 vertexNormal, vec4 vertexTangent, vec3 tangentNormal)
+{
+    vec3 bitangent = vertexTangent.w * cross(vertexNormal, vertexTangent.xyz);
+    return normalize(tangentNormal.x * vertexTangent.xyz + tangentNormal.y * bitangent + tangentNormal.z * vertexNormal);
+}
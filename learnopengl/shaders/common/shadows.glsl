@@ -0,0 +1,37 @@
+// Cascaded sun shadows, filled by ShadowCascades.h (keep in sync with ShadowParams there). Include after lighting.glsl.
+layout (std140, binding = 1) uniform Shadows
+{
+    mat4 shadowCascades[4]; // view space to shadow map space
+    vec4 cascadeSplits;     // far view depth of every cascade
+    vec4 cascadeTexelSize;  // world size of a shadow map texel
+    vec4 shadowSettings;    // x: 1 when there are shadows, y: 1 / map size
+};
+layout (binding = 10) uniform sampler2DArrayShadow shadowMap;
+
+// How much of the sun reaches a view-space position, normal is the geometric (view space) one
+float sunShadow(vec3 viewPosition, vec3 normal)
+{
+    if (shadowSettings.x == 0.0)
+        return 1.0;
+    float depth = -viewPosition.z;
+    int cascade = 0;
+    while (cascade < 4 && depth > cascadeSplits[cascade])
+        cascade++;
+    if (cascade == 4)
+        return 1.0;
+
+    // look up a bit off the surface, further where the sun grazes it, instead of a big depth bias
+    float grazing = 1.0 - clamp(dot(normal, sunDirection.xyz), 0.0, 1.0);
+    vec3 offsetPosition = viewPosition + normal * cascadeTexelSize[cascade] * (0.5 + 1.5 * grazing);
+    vec4 coord = shadowCascades[cascade] * vec4(offsetPosition, 1.0);
+
+    // 2x2 bilinear comparisons, 3x3 texels
+    float visibility = 0.0;
+    for (int y = 0; y < 2; y++) {
+        for (int x = 0; x < 2; x++) {
+            vec2 offset = (vec2(x, y) - 0.5) * shadowSettings.y;
+            visibility += texture(shadowMap, vec4(coord.xy + offset, float(cascade), coord.z));
+        }
+    }
+    return visibility * 0.25;
+}
@@ -0,0 +1,69 @@
+#version 460 core
+// Feature defines (HAS_BASE_COLOR_MAP, ...) are inserted above by ShaderPermutations
+#include "common/material.glsl"
+#include "common/normals.glsl"
+#include "common/lighting.glsl"
+#include "common/shadows.glsl"
+
+out vec4 FragColor;
+
+in vec3 position; // view space
+in vec2 uv;
+in vec3 normal;
+in vec4 tangent;
+
+void main()
+{
+    Material material = materials[materialIndex];
+
+    vec4 color = material.baseColorFactor;
+#ifdef HAS_BASE_COLOR_MAP
+    color *= sampleSlot(material, baseColorMap, baseColorArray, SLOT_BASE_COLOR, uv);
+#endif
+
+#ifdef ALPHA_TEST
+    if (color.a < material.alphaCutoff)
+        discard;
+#endif
+
+    vec3 N = normalize(normal);
+#ifdef HAS_NORMAL_MAP
+    // only X/Y are used so BC5 (two channel) normal maps work too
+    vec3 tangentNormal;
+    tangentNormal.xy = sampleSlot(material, normalMap, normalArray, SLOT_NORMAL, uv).xy * 2.0 - 1.0;
+    tangentNormal.z = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
+    tangentNormal.xy *= material.normalScale;
+    N = perturbNormal(normal, tangent, tangentNormal);
+#endif
+    // back faces (no culling) get lit from their own side
+    N = gl_FrontFacing ? N : -N;
+    vec3 geometricNormal = normalize(gl_FrontFacing ? normal : -normal);
+
+    float metallic = material.metallicFactor;
+    float roughness = material.roughnessFactor;
+#ifdef HAS_METALLIC_ROUGHNESS_MAP
+    // glTF: roughness in green, metallic in blue
+    vec4 metallicRoughness = sampleSlot(material, metallicRoughnessMap, metallicRoughnessArray, SLOT_METALLIC_ROUGHNESS, uv);
+    roughness *= metallicRoughness.g;
+    metallic *= metallicRoughness.b;
+#endif
+    float occlusion = 1.0;
+#ifdef HAS_OCCLUSION_MAP
+    occlusion = sampleSlot(material, occlusionMap, occlusionArray, SLOT_OCCLUSION, uv).r;
+#endif
+
+    Surface surface = Surface(N, normalize(-position), color.rgb, metallic, clamp(roughness, 0.045, 1.0));
+    color.rgb = ambientColor.rgb * color.rgb * occlusion + shade(surface, position, sunShadow(position, geometricNormal));
+
+#ifdef HAS_EMISSIVE_MAP
+    color.rgb += sampleSlot(material, emissiveMap, emissiveArray, SLOT_EMISSIVE, uv).rgb * material.emissiveFactor.rgb;
+#else
+    color.rgb += material.emissiveFactor.rgb;
+#endif
+
+#ifdef DEBUG_NORMALS
+    color = vec4(N * 0.5 + 0.5, 1.0);
+#endif
+
+    FragColor = color;
+}
\ No newline at end of file
@@ -0,0 +1,69 @@
+#version 460 core
+#include "common/lighting.glsl"
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoord;
+layout (location = 2) in vec3 aNormal;
+layout (location = 3) in vec4 aTangent;
+
+// view space, for lighting
+out vec3 position;
+out vec2 uv;
+out vec3 normal;
+out vec4 tangent;
+flat out uint materialIndex;
+
+// Per-draw data. Draws are multi-draw indirect commands whose baseInstance is the draw's index within its model,
+// firstDraw is where that model's MVPs start in this frame's transform buffer
+layout (std430, binding = 1) readonly buffer Transforms
+{
+    mat4 mvps[];
+};
+// view * world in the same slots, see FrameTransforms
+layout (std430, binding = 7) readonly buffer ModelViews
+{
+    mat4 modelViews[];
+};
+layout (std430, binding = 2) readonly buffer DrawMaterials
+{
+    uint drawMaterials[];
+};
+layout (location = 0) uniform uint firstDraw;
+
+#ifdef INSTANCED
+// Instanced draws: firstDraw is where the instances' MVPs (and model-view matrices) start instead, and the draw's own
+// node transform comes from here (still indexed by baseInstance)
+layout (std430, binding = 3) readonly buffer DrawWorlds
+{
+    mat4 drawWorlds[];
+};
+#endif
+
+// Unit length, or zero for a degenerate vector (instead of NaNs)
+vec3 safeNormalize(vec3 v)
+{
+    return v * inversesqrt(max(dot(v, v), 1e-30));
+}
+
+void main()
+{
+#ifdef INSTANCED
+    mat4 mvp = mvps[firstDraw + gl_InstanceID] * drawWorlds[gl_BaseInstance];
+    mat4 modelView = modelViews[firstDraw + gl_InstanceID] * drawWorlds[gl_BaseInstance];
+#else
+    mat4 mvp = mvps[firstDraw + gl_BaseInstance];
+    mat4 modelView = modelViews[firstDraw + gl_BaseInstance];
+#endif
+    gl_Position = mvp * vec4(aPos, 1.0);
+    position = vec3(modelView * vec4(aPos, 1.0));
+    uv = aTexCoord;
+
+    // Normals take the inverse transpose, so they stay perpendicular under non-uniform scale. Up to a scale that's the
+    // cofactor matrix (three cross products instead of an inverse), flipped back for mirroring transforms. Both vectors
+    // are normalized per vertex and then interpolated as they are, like MikkTSpace bakes normal maps.
+    mat3 linear = mat3(modelView);
+    mat3 cofactor = mat3(cross(linear[1], linear[2]), cross(linear[2], linear[0]), cross(linear[0], linear[1]));
+    float handedness = dot(linear[0], cofactor[0]) < 0.0 ? -1.0 : 1.0;
+    normal = safeNormalize(cofactor * aNormal) * handedness;
+    tangent = vec4(safeNormalize(linear * aTangent.xyz), aTangent.w);
+    materialIndex = drawMaterials[gl_BaseInstance];
+}
\ No newline at end of file
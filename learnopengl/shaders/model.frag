@@ -1,10 +0,0 @@
-#version 460 core
-out vec4 FragColor;
-
-in vec2 uv;
-in vec3 normal;
-
-void main()
-{
-    FragColor = vec4(normal, 1);
-}
\ No newline at end of file
@@ -1,16 +0,0 @@
-#version 460 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec2 aTexCoord;
-layout (location = 2) in vec3 aNormal;
-
-out vec2 uv;
-out vec3 normal;
-
-uniform mat4 MVP;
-
-void main()
-{
-    gl_Position = MVP * vec4(aPos, 1.0);
-    uv = aTexCoord;
-    normal = aNormal;
-}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#version 460 core
+// Feature defines are inserted above by ShaderPermutations, only alpha testing matters for depth
+#include "common/material.glsl"
+
+in vec2 uv;
+
+void main()
+{
+#ifdef ALPHA_TEST
+    float alpha = materials[materialIndex].baseColorFactor.a;
+#ifdef HAS_BASE_COLOR_MAP
+    alpha *= sampleSlot(materials[materialIndex], baseColorMap, baseColorArray, SLOT_BASE_COLOR, uv).a;
+#endif
+    if (alpha < materials[materialIndex].alphaCutoff)
+        discard;
+#endif
+}
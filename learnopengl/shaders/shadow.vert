@@ -0,0 +1,36 @@
+#version 460 core
+// Depth-only caster pass for ShadowCascades, the same per-draw data as mesh.vert
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoord;
+
+out vec2 uv;
+flat out uint materialIndex;
+
+layout (std430, binding = 1) readonly buffer Transforms
+{
+    mat4 mvps[];
+};
+layout (std430, binding = 2) readonly buffer DrawMaterials
+{
+    uint drawMaterials[];
+};
+layout (location = 0) uniform uint firstDraw;
+
+#ifdef INSTANCED
+layout (std430, binding = 3) readonly buffer DrawWorlds
+{
+    mat4 drawWorlds[];
+};
+#endif
+
+void main()
+{
+#ifdef INSTANCED
+    mat4 mvp = mvps[firstDraw + gl_InstanceID] * drawWorlds[gl_BaseInstance];
+#else
+    mat4 mvp = mvps[firstDraw + gl_BaseInstance];
+#endif
+    gl_Position = mvp * vec4(aPos, 1.0);
+    uv = aTexCoord;
+    materialIndex = drawMaterials[gl_BaseInstance];
+}
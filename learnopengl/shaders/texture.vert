@@ -1,13 +0,0 @@
-#version 460 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec2 aTexCoord;
-
-out vec2 uv;
-
-uniform mat4 MVP;
-
-void main()
-{
-    gl_Position = MVP * vec4(aPos, 1.0);
-    uv = aTexCoord;
-}
\ No newline at end of file
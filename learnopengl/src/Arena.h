@@ -0,0 +1,150 @@
+#pragma once
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+
+// bytes per arena block, a load that needs more chains another block (or a bigger one for a single large request)
+const size_t ARENA_BLOCK_SIZE = 16 * 1024 * 1024;
+
+// Non-owning view of count elements, what the loader passes around instead of vectors
+template <typename T>
+struct Span
+{
+	T* data = nullptr;
+	size_t size = 0;
+
+	T* begin() const { return data; }
+	T* end() const { return data + size; }
+	T& operator[](size_t i) const { return data[i]; }
+	bool empty() const { return size == 0; }
+
+	operator Span<const T>() const { return { data, size }; }
+};
+
+/* Linear (bump) allocator for load-time temporaries. Allocating is a pointer bump, nothing is freed one by one: rewind()
+drops everything allocated after a mark() and reset() drops everything, both O(1). Blocks are kept between loads,
+so once the arena has grown to fit the largest model, loading allocates nothing from the heap. Only for trivially
+destructible types, memory is handed out uninitialized. Not thread safe, see loadArena() for one per thread and
+ArenaPool for one per load. */
+class LinearArena
+{
+public:
+	struct Marker
+	{
+		size_t block;
+		size_t offset;
+	};
+
+	unsigned int blockAllocations = 0; // heap allocations the arena made so far
+
+	explicit LinearArena(size_t blockSize = ARENA_BLOCK_SIZE) : blockSize(blockSize) {}
+
+	LinearArena(const LinearArena&) = delete;
+	LinearArena& operator=(const LinearArena&) = delete;
+
+	template <typename T>
+	Span<T> allocate(size_t count) {
+		static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destructed");
+		return { (T*)allocateBytes(count * sizeof(T), alignof(T)), count };
+	}
+
+	Marker mark() const {
+		return { current, offset };
+	}
+
+	void rewind(Marker marker) {
+		current = marker.block;
+		offset = marker.offset;
+	}
+
+	void reset() {
+		current = 0;
+		offset = 0;
+	}
+
+	// bytes held across all blocks
+	size_t capacity() const {
+		size_t total = 0;
+		for (const Block& block : blocks) {
+			total += block.size;
+		}
+		return total;
+	}
+
+private:
+	struct Block
+	{
+		std::unique_ptr<unsigned char[]> memory;
+		size_t size;
+	};
+
+	size_t blockSize;
+	std::vector<Block> blocks;
+	size_t current = 0;
+	size_t offset = 0;
+
+	void* allocateBytes(size_t bytes, size_t alignment) {
+		if (bytes == 0)
+			return nullptr;
+		while (current < blocks.size()) {
+			size_t aligned = (offset + alignment - 1) & ~(alignment - 1);
+			if (aligned + bytes <= blocks[current].size) {
+				offset = aligned + bytes;
+				return blocks[current].memory.get() + aligned;
+			}
+			// doesn't fit, the rest of this block stays unused until the next rewind
+			current++;
+			offset = 0;
+		}
+		// out of blocks: add one right here, at least as big as the request
+		size_t size = std::max(blockSize, bytes + alignment);
+		blocks.push_back({ std::unique_ptr<unsigned char[]>(new unsigned char[size]), size });
+		blockAllocations++;
+		current = blocks.size() - 1;
+		offset = 0;
+		return allocateBytes(bytes, alignment);
+	}
+};
+
+// Arena for the calling thread, so loads on different threads never share one
+inline LinearArena& loadArena() {
+	thread_local LinearArena arena;
+	return arena;
+}
+
+/* Arenas a load holds on to from start to finish, whatever threads its steps run on (a model is decoded on a worker
+and uploaded on the GL thread). Released ones are reset and handed out again, so they keep their blocks like
+loadArena() does, and concurrent loads never share one. */
+class ArenaPool
+{
+public:
+	LinearArena* acquire() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (free.empty()) {
+			arenas.push_back(std::unique_ptr<LinearArena>(new LinearArena()));
+			return arenas.back().get();
+		}
+		LinearArena* arena = free.back();
+		free.pop_back();
+		return arena;
+	}
+
+	void release(LinearArena* arena) {
+		arena->reset();
+		std::lock_guard<std::mutex> lock(mutex);
+		free.push_back(arena);
+	}
+
+private:
+	std::mutex mutex;
+	std::vector<std::unique_ptr<LinearArena>> arenas;
+	std::vector<LinearArena*> free;
+};
+
+inline ArenaPool& arenaPool() {
+	static ArenaPool pool;
+	return pool;
+}
@@ -0,0 +1,403 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <unordered_map>
+#include <cstdint>
+#include <cstdlib>
+#include "Model.h"
+#include "LoadScheduler.h"
+#include "ThreadPool.h"
+#include "Hash.h"
+#include "Profiler.h"
+
+// memory unreferenced models may keep using before they're evicted, LEARNOPENGL_ASSET_BUDGET_MB overrides it
+const uint64_t DEFAULT_ASSET_BUDGET_MB = 512;
+
+/* Shared, reference-counted models. acquire() hands out a shared_ptr per glTF directory and loads each asset once:
+- keyed by content hash (scene.gltf plus the names and sizes of the files next to it), so the same asset under two
+  paths (symlinks, "a/../a/", copies) is still one model; canonical paths are remembered so repeat lookups don't
+  hash again
+- concurrent requests for an asset that is still loading wait for that load instead of starting their own
+- models nobody holds a handle to any more stay cached (a scene reloading them gets them back for free) until
+  collect() finds the cache over budget, then the least recently acquired ones are released
+
+Loading uploads to the GPU, so acquire() is for threads with a current context and collect() for the GL thread.
+acquireAsync() returns right away with a model that fills in over the next frames, see LoadScheduler. acquireAll()
+takes many at once and decodes them on the workers in parallel. */
+class AssetManager
+{
+public:
+	uint64_t budget;
+	unsigned int loads = 0;     // models actually loaded
+	unsigned int hits = 0;      // acquires served from the cache or an in-flight load
+	unsigned int evictions = 0;
+
+	AssetManager() {
+		const char* env = std::getenv("LEARNOPENGL_ASSET_BUDGET_MB");
+		uint64_t mb = env ? std::strtoull(env, nullptr, 10) : DEFAULT_ASSET_BUDGET_MB;
+		budget = mb * 1024 * 1024;
+	}
+
+	// The model in directory (with trailing slash, like Model takes it), loaded on first use. Throws what the load
+	// throws, a failed load isn't cached (incremental ones that fail midway are dropped from the cache too).
+	std::shared_ptr<Model> acquire(const std::string& directory) {
+		return acquireModel(directory, false);
+	}
+
+	// Like acquire(), but a model that isn't cached yet is handed to loadScheduler() and returned still empty.
+	// GL thread only (that's where the scheduler runs the load).
+	std::shared_ptr<Model> acquireAsync(const std::string& directory) {
+		return acquireModel(directory, true);
+	}
+
+	/* Like acquire() (or acquireAsync() with incremental) for every directory, in order. The models that aren't cached
+	yet are read, parsed and decoded on the workers all at the same time (Model::Prepare), only creating their GL
+	objects is left for this thread: right here, or over the next frames for incremental ones. GL thread only. Throws
+	the first error of a regular load once the rest are done; incremental ones that fail are dropped like in the
+	scheduler. */
+	std::vector<std::shared_ptr<Model>> acquireAll(const std::vector<std::string>& directories, bool incremental) {
+		PROFILE_SCOPE("acquire assets");
+		// hashing a directory reads its files, so that goes on the workers too
+		std::vector<std::string> paths(directories.size());
+		std::vector<uint64_t> hashes(directories.size());
+		{
+			PROFILE_SCOPE("resolve assets");
+			workerPool().parallelFor((unsigned int)directories.size(), 1, [&](unsigned int begin, unsigned int end) {
+				for (unsigned int i = begin; i < end; i++) {
+					paths[i] = canonicalDirectory(directories[i]);
+					hashes[i] = resolve(paths[i]);
+				}
+			});
+		}
+
+		struct PendingLoad
+		{
+			uint64_t hash;
+			std::shared_ptr<Model> model;
+			std::promise<std::shared_ptr<Model>> promise;
+			std::exception_ptr error;
+		};
+		std::deque<PendingLoad> pending;
+		std::vector<std::shared_future<std::shared_ptr<Model>>> models(directories.size());
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (unsigned int i = 0; i < directories.size(); i++) {
+				std::promise<std::shared_ptr<Model>> promise;
+				if (findOrAdd(paths[i], hashes[i], promise, models[i]))
+					continue; // cached, loading somewhere else or earlier in the list
+				pending.push_back({ hashes[i], std::make_shared<Model>(paths[i].c_str(), incremental, true), std::move(promise), nullptr });
+			}
+		}
+
+		{
+			PROFILE_SCOPE("prepare models");
+			workerPool().parallelFor((unsigned int)pending.size(), 1, [&](unsigned int begin, unsigned int end) {
+				for (unsigned int i = begin; i < end; i++) {
+					try {
+						pending[i].model->Prepare();
+					}
+					catch (...) {
+						pending[i].error = std::current_exception();
+					}
+				}
+			});
+		}
+
+		std::exception_ptr firstError;
+		for (PendingLoad& load : pending) {
+			if (incremental) {
+				if (load.error)
+					failIncremental(*load.model, load.error);
+				load.promise.set_value(load.model);
+				loadScheduler().add(load.model); // collect() picks up its size once it's done
+				continue;
+			}
+			if (!load.error) {
+				try {
+					while (load.model->LoadStep());
+				}
+				catch (...) {
+					load.error = std::current_exception();
+				}
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			if (load.error) {
+				load.model->AbandonLoad();
+				load.model->Release();
+				load.promise.set_exception(load.error);
+				assets.erase(load.hash);
+				if (!firstError)
+					firstError = load.error;
+			}
+			else {
+				load.promise.set_value(load.model);
+				assets[load.hash].bytes = load.model->MemoryUsage();
+			}
+		}
+		if (firstError)
+			std::rethrow_exception(firstError);
+
+		std::vector<std::shared_ptr<Model>> result;
+		for (std::shared_future<std::shared_ptr<Model>>& model : models) {
+			result.push_back(model.get());
+		}
+		return result;
+	}
+
+	// Content hash of the asset in directory, remembered per path. Reads files but doesn't touch GL, so any thread can
+	// do it ahead of acquire() (acquireAll resolves all of its directories in parallel that way).
+	uint64_t resolve(const std::string& directory) {
+		std::string path = canonicalDirectory(directory);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto known = pathHashes.find(path);
+			if (known != pathHashes.end())
+				return known->second;
+		}
+		uint64_t hash = contentHash(path);
+		std::lock_guard<std::mutex> lock(mutex);
+		pathHashes[path] = hash;
+		return hash;
+	}
+
+	// GL thread, e.g. once per frame: releases unreferenced models, least recently acquired first, while over budget
+	void collect() {
+		std::vector<std::shared_ptr<Model>> evicted;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			uint64_t total = 0;
+			std::vector<std::pair<uint64_t, uint64_t>> unused; // (lastUsed, hash)
+			for (auto it = assets.begin(); it != assets.end();) {
+				if (loadFailed(it->second)) {
+					failed.push_back(it->second.model.get());
+					it = assets.erase(it);
+				}
+				else {
+					++it;
+				}
+			}
+			for (auto& entry : assets) {
+				refreshSize(entry.second);
+				total += entry.second.bytes;
+				if (isUnreferenced(entry.second))
+					unused.push_back({ entry.second.lastUsed, entry.first });
+			}
+			std::sort(unused.begin(), unused.end());
+			for (const auto& candidate : unused) {
+				if (total <= budget)
+					break;
+				Asset& asset = assets[candidate.second];
+				total -= asset.bytes;
+				evicted.push_back(asset.model.get());
+				assets.erase(candidate.second);
+				evictions++;
+			}
+			// failed loads are released once whoever acquired them lets go
+			for (size_t i = 0; i < failed.size();) {
+				if (failed[i].use_count() == 1) {
+					evicted.push_back(failed[i]);
+					failed[i] = failed.back();
+					failed.pop_back();
+				}
+				else {
+					i++;
+				}
+			}
+		}
+		// outside the lock, Release() does GL work
+		for (std::shared_ptr<Model>& model : evicted) {
+			model->Release();
+		}
+	}
+
+	// Memory of every cached model, referenced or not
+	uint64_t residentBytes() {
+		std::lock_guard<std::mutex> lock(mutex);
+		uint64_t total = 0;
+		for (auto& entry : assets) {
+			total += entry.second.bytes;
+		}
+		return total;
+	}
+
+	// At shutdown on the GL thread, once nothing draws any more: frees every model's GL objects
+	void release() {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto& entry : assets) {
+			std::shared_future<std::shared_ptr<Model>>& model = entry.second.model;
+			if (model.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+				model.get()->Release();
+		}
+		for (std::shared_ptr<Model>& model : failed) {
+			model->Release();
+		}
+		assets.clear();
+		failed.clear();
+		pathHashes.clear();
+	}
+
+	void printStats() {
+		size_t count;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			count = assets.size();
+		}
+		std::cout << "ASSETS: " << count << " cached (" << residentBytes() / (1024 * 1024) << " MB of " << budget / (1024 * 1024)
+			<< " MB budget), " << loads << " loads, " << hits << " hits, " << evictions << " evictions" << std::endl;
+	}
+
+private:
+	struct Asset
+	{
+		std::string directory;
+		std::shared_future<std::shared_ptr<Model>> model;
+		uint64_t bytes = 0; // 0 while loading
+		uint64_t lastUsed = 0;
+	};
+
+	std::mutex mutex;
+	std::unordered_map<std::string, uint64_t> pathHashes; // canonical directory -> content hash
+	std::unordered_map<uint64_t, Asset> assets;          // by content hash
+	std::vector<std::shared_ptr<Model>> failed;          // out of the cache, still to be released
+	uint64_t useCounter = 0;
+
+	std::shared_ptr<Model> acquireModel(const std::string& directory, bool incremental) {
+		PROFILE_SCOPE("acquire asset");
+		std::string path = canonicalDirectory(directory);
+		uint64_t hash = resolve(path);
+
+		std::promise<std::shared_ptr<Model>> promise;
+		std::shared_future<std::shared_ptr<Model>> model;
+		bool found;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			found = findOrAdd(path, hash, promise, model);
+		}
+		if (found)
+			return model.get(); // cached, or wait for whoever is loading it
+
+		try {
+			std::shared_ptr<Model> loaded = std::make_shared<Model>(path.c_str(), incremental);
+			promise.set_value(loaded);
+			if (incremental) {
+				loadScheduler().add(loaded); // collect() picks up its size once it's done
+				return loaded;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			assets[hash].bytes = loaded->MemoryUsage();
+			return loaded;
+		}
+		catch (...) {
+			promise.set_exception(std::current_exception());
+			std::lock_guard<std::mutex> lock(mutex);
+			assets.erase(hash);
+			throw;
+		}
+	}
+
+	// true (and model set) if hash is cached or being loaded, otherwise it gets an entry that waits for promise and
+	// model is that entry's future. Caller holds the mutex.
+	bool findOrAdd(const std::string& path, uint64_t hash, std::promise<std::shared_ptr<Model>>& promise, std::shared_future<std::shared_ptr<Model>>& model) {
+		auto found = assets.find(hash);
+		if (found != assets.end() && loadFailed(found->second)) {
+			failed.push_back(found->second.model.get());
+			assets.erase(found);
+			found = assets.end();
+		}
+		if (found != assets.end()) {
+			hits++;
+			found->second.lastUsed = ++useCounter;
+			model = found->second.model;
+			return true;
+		}
+		Asset& asset = assets[hash];
+		asset.directory = path;
+		asset.model = promise.get_future().share();
+		asset.lastUsed = ++useCounter;
+		loads++;
+		model = asset.model;
+		return false;
+	}
+
+	// same as a work item throwing in the scheduler
+	static void failIncremental(Model& model, const std::exception_ptr& error) {
+		try {
+			std::rethrow_exception(error);
+		}
+		catch (const std::exception& e) {
+			std::cout << "ERROR::MODEL_LOADING::" << e.what() << std::endl;
+		}
+		catch (...) {
+		}
+		model.FailLoad();
+		loadScheduler().failures++;
+	}
+
+	// incremental loads get their size once they're done, and it's refreshed on every collect() since streamed
+	// textures grow and shrink the model's footprint
+	static void refreshSize(Asset& asset) {
+		if (asset.model.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return;
+		std::shared_ptr<Model> model = asset.model.get();
+		if (model->IsLoaded())
+			asset.bytes = std::max<uint64_t>(model->MemoryUsage(), 1);
+	}
+
+	// an incremental load whose work item threw (see LoadScheduler), what's in it is partial
+	static bool loadFailed(const Asset& asset) {
+		return asset.model.wait_for(std::chrono::seconds(0)) == std::future_status::ready && asset.model.get()->LoadFailed();
+	}
+
+	// loaded, and the only reference left is the cache's own
+	static bool isUnreferenced(const Asset& asset) {
+		if (asset.bytes == 0 || asset.model.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return false;
+		return asset.model.get().use_count() == 1;
+	}
+
+	static std::string canonicalDirectory(const std::string& directory) {
+		std::error_code error;
+		std::filesystem::path path = std::filesystem::weakly_canonical(directory, error);
+		std::string canonical = error ? directory : path.generic_string();
+		if (canonical.empty() || canonical.back() != '/')
+			canonical += '/';
+		return canonical;
+	}
+
+	// scene.gltf itself, plus every other file's relative name and size (buffers and images are too big to read
+	// just to hash them, and a changed one practically always changes size or name too)
+	static uint64_t contentHash(const std::string& directory) {
+		std::ifstream file(directory + "scene.gltf", std::ios::binary);
+		std::stringstream text;
+		text << file.rdbuf();
+		uint64_t hash = hashString(text.str());
+
+		std::vector<std::pair<std::string, uint64_t>> files;
+		std::error_code error;
+		for (const auto& entry : std::filesystem::recursive_directory_iterator(directory, error)) {
+			if (entry.is_regular_file(error))
+				files.push_back({ std::filesystem::relative(entry.path(), directory, error).generic_string(), (uint64_t)entry.file_size(error) });
+		}
+		std::sort(files.begin(), files.end()); // directory order isn't stable across systems
+		for (const auto& entry : files) {
+			hash = hashString(entry.first, hash);
+			hash = hashBytes(&entry.second, sizeof(entry.second), hash);
+		}
+		return hash != 0 ? hash : 1; // 0 means "not hashed yet"
+	}
+};
+
+inline AssetManager& assetManager() {
+	static AssetManager manager;
+	return manager;
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include "Camera.h"
+#include "Profiler.h"
+
+/* Camera paths: the camera of every rendered frame, recorded with --record and replayed frame by frame with --replay.
+Replay doesn't depend on timing or input, frame i always looks through key i, so the same path over the same scene
+is the same workload before and after a change.
+
+File layout (little endian):
+	CameraPathHeader
+	CameraKey[frameCount] */
+const uint32_t CAMERA_PATH_MAGIC = 0x50434C47; // "GLCP"
+const uint32_t CAMERA_PATH_VERSION = 1;
+// frames a replay draws through its first key before timing starts, so shader linking and the first uploads don't
+// end up in the percentiles
+const unsigned int BENCHMARK_WARMUP_FRAMES = 3;
+
+#pragma pack(push, 1)
+struct CameraPathHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t frameCount;
+};
+
+// Camera state a frame was rendered with (already interpolated between simulation steps)
+struct CameraKey
+{
+	float position[3];
+	float yaw;
+	float pitch;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(CameraPathHeader) == 12, "camera path header layout changed");
+static_assert(sizeof(CameraKey) == 20, "camera key layout changed");
+
+// Camera state partway between the previous simulation step (alpha 0) and the current one (alpha 1): position and
+// angles are blended separately, cameraKeyView turns the result into the view. Live frames and replays both draw with
+// it, so a recorded path replays exactly.
+inline CameraKey cameraKey(const Camera& previous, const Camera& current, float alpha) {
+	glm::vec3 position = glm::mix(previous.Position, current.Position, alpha);
+	CameraKey key;
+	key.position[0] = position.x;
+	key.position[1] = position.y;
+	key.position[2] = position.z;
+	key.yaw = previous.Yaw + (current.Yaw - previous.Yaw) * alpha;
+	key.pitch = previous.Pitch + (current.Pitch - previous.Pitch) * alpha;
+	return key;
+}
+
+inline glm::mat4 cameraKeyView(const CameraKey& key) {
+	return Camera(glm::vec3(key.position[0], key.position[1], key.position[2]), glm::vec3(0.0f, 1.0f, 0.0f), key.yaw, key.pitch).GetViewMatrix();
+}
+
+// Key to draw replay frame frame (warm-up frames included) with, paths shorter than the run start over
+inline const CameraKey& replayKey(const std::vector<CameraKey>& path, unsigned int frame) {
+	unsigned int timed = frame < BENCHMARK_WARMUP_FRAMES ? 0 : frame - BENCHMARK_WARMUP_FRAMES;
+	return path[timed % path.size()];
+}
+
+// false if the file can't be written
+inline bool writeCameraPath(const std::string& path, const std::vector<CameraKey>& keys) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		std::cout << "ERROR::CAMERA_PATH::FILE_NOT_SUCCESSFULLY_WRITTEN " << path << std::endl;
+		return false;
+	}
+	CameraPathHeader header = { CAMERA_PATH_MAGIC, CAMERA_PATH_VERSION, (uint32_t)keys.size() };
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)keys.data(), keys.size() * sizeof(CameraKey));
+	return (bool)file;
+}
+
+// Throws std::invalid_argument if the file is missing, truncated, empty or not a camera path
+inline std::vector<CameraKey> readCameraPath(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		throw std::invalid_argument("ERROR::CAMERA_PATH::FILE_NOT_SUCCESSFULLY_READ " + path);
+	std::stringstream contents;
+	contents << file.rdbuf();
+	std::string bytes = contents.str();
+
+	CameraPathHeader header;
+	if (bytes.size() < sizeof(header))
+		throw std::invalid_argument("ERROR::CAMERA_PATH::TRUNCATED " + path);
+	std::memcpy(&header, bytes.data(), sizeof(header));
+	if (header.magic != CAMERA_PATH_MAGIC || header.version == 0 || header.version > CAMERA_PATH_VERSION)
+		throw std::invalid_argument("ERROR::CAMERA_PATH::NOT_A_CAMERA_PATH " + path);
+	if (header.frameCount == 0)
+		throw std::invalid_argument("ERROR::CAMERA_PATH::EMPTY " + path);
+	if (bytes.size() - sizeof(header) < (uint64_t)header.frameCount * sizeof(CameraKey))
+		throw std::invalid_argument("ERROR::CAMERA_PATH::TRUNCATED " + path);
+
+	std::vector<CameraKey> keys(header.frameCount);
+	std::memcpy(keys.data(), bytes.data() + sizeof(header), keys.size() * sizeof(CameraKey));
+	return keys;
+}
+
+/* Frame times and draw counts of a benchmark run. begin() and end() bracket the GL thread's work for one frame (from
+picking up the frame to swap or readback), end() also takes the frame's renderCounters(); the first
+BENCHMARK_WARMUP_FRAMES frames aren't kept. report() prints one line that's meant to be diffed between runs:
+
+	BENCHMARK: 600 frames, avg 4.21 ms, p50 4.10 ms, p95 5.02 ms, p99 6.30 ms, max 9.80 ms, 12 calls, 340 draws, 1.2e+06 triangles, 0 shadow passes per frame */
+class FrameStats
+{
+public:
+	void begin() {
+		renderCounters().reset();
+		start = std::chrono::steady_clock::now();
+	}
+
+	void end() {
+		if (warmup < BENCHMARK_WARMUP_FRAMES) {
+			warmup++;
+			return;
+		}
+		times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		const RenderCounters& counters = renderCounters();
+		calls += counters.calls;
+		draws += counters.draws;
+		triangles += counters.triangles;
+		shadowPasses += counters.shadowPasses;
+	}
+
+	size_t frames() const {
+		return times.size();
+	}
+
+	void report() const {
+		if (times.empty()) {
+			std::cout << "BENCHMARK: no frames" << std::endl;
+			return;
+		}
+		std::vector<double> sorted = times;
+		std::sort(sorted.begin(), sorted.end());
+		double total = 0.0;
+		for (double time : sorted)
+			total += time;
+		double n = (double)sorted.size();
+		// nearest rank
+		auto percentile = [&](double p) {
+			size_t rank = (size_t)std::ceil(p * n);
+			return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+		};
+		std::ostringstream line; // keeps the formatting off std::cout
+		line << std::fixed << std::setprecision(2) << "BENCHMARK: " << sorted.size() << " frames, avg " << total / n
+			<< " ms, p50 " << percentile(0.50) << " ms, p95 " << percentile(0.95) << " ms, p99 " << percentile(0.99)
+			<< " ms, max " << sorted.back() << " ms, " << std::defaultfloat << std::setprecision(3) << calls / n << " calls, "
+			<< draws / n << " draws, " << triangles / n << " triangles, " << shadowPasses / n << " shadow passes per frame";
+		std::cout << line.str() << std::endl;
+	}
+
+private:
+	std::chrono::steady_clock::time_point start;
+	unsigned int warmup = 0;
+	std::vector<double> times; // ms
+	uint64_t calls = 0, draws = 0, triangles = 0, shadowPasses = 0;
+};
@@ -0,0 +1,395 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "SimdMath.h"
+#include "ThreadPool.h"
+#include "StreamingBuffer.h"
+#include "Profiler.h"
+
+// Froxel grid: screen tiles times exponential depth slices between the projection's near and far planes. Columns are
+// tested four at a time and a slice's clusters are packed into 8 bits while binning.
+const unsigned int CLUSTER_X = 16;
+const unsigned int CLUSTER_Y = 9;
+const unsigned int CLUSTER_Z = 24;
+const unsigned int CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+static_assert(CLUSTER_X % 4 == 0, "columns are binned four at a time");
+static_assert(CLUSTER_X * CLUSTER_Y <= 256, "a slice's clusters have to fit in 8 bits");
+// the other 24 bits of a packed hit
+const unsigned int MAX_CLUSTERED_LIGHTS = 1u << 24;
+// lights per job when they're moved into view space
+const unsigned int LIGHT_GRAIN = 1024;
+
+// Uniform block binding of LightingParams, SSBO bindings of the rest (see common/lighting.glsl)
+const unsigned int LIGHTING_BINDING = 0;
+const unsigned int LIGHT_BINDING = 4;
+const unsigned int CLUSTER_BINDING = 5;
+const unsigned int LIGHT_INDEX_BINDING = 6;
+
+// Point lights main scatters through what it draws, LEARNOPENGL_LIGHTS (64 if unset, 0 for only the sun)
+inline unsigned int clusteredLightCount() {
+	static unsigned int count = [] {
+		const char* env = std::getenv("LEARNOPENGL_LIGHTS");
+		return env ? (unsigned int)std::strtoul(env, nullptr, 10) : 64u;
+	}();
+	return count;
+}
+
+// World space
+struct PointLight
+{
+	glm::vec3 position;
+	float radius; // nothing is lit past this
+	glm::vec3 color;
+	float intensity; // falls off with the inverse square of the distance
+};
+
+// What upload() writes, keep in sync with common/lighting.glsl
+struct GpuPointLight
+{
+	glm::vec4 positionRadius; // view space
+	glm::vec4 color;          // rgb * intensity
+};
+
+struct ClusterRange
+{
+	uint32_t offset; // into the light index list
+	uint32_t count;
+};
+
+struct LightingParams // std140
+{
+	glm::vec4 projectionScale; // projection[0][0], projection[1][1], depth slice scale and bias (slice = log(depth) * z + w)
+	glm::vec4 sunDirection;    // view space, towards the sun
+	glm::vec4 sunColor;        // rgb * intensity
+	glm::vec4 ambient;
+	glm::uvec4 grid;           // CLUSTER_X, CLUSTER_Y, CLUSTER_Z, light count
+};
+
+/* Clustered forward lighting. bin() splits the view frustum into froxels and lists, per froxel, the point lights whose
+sphere touches it. The fragment shader only walks its own froxel's list, so shading cost follows the lights per cluster
+and not how many there are in total.
+
+Binning runs on the CPU without touching GL ("Light Benchmark" times it without a context):
+	1. per light, in parallel: the view-space sphere and the slices, rows and columns its bounding box projects to
+	2. per slice, in parallel: exact sphere-vs-froxel box tests of the lights whose depth range reaches the slice, four
+	   columns at a time, hits packed as light << 8 | cluster
+	3. prefix sum over the slices, then each slice counting-sorts its hits into the shared index list
+upload() copies the lights, the per-cluster ranges and the index list into the streaming ring. The grid assumes a
+symmetric perspective projection (glm::perspective). */
+class ClusteredLights
+{
+public:
+	// edit freely, every frame is binned from scratch
+	std::vector<PointLight> lights;
+	glm::vec3 sunDirection = glm::normalize(glm::vec3(-0.4f, -1.0f, -0.3f)); // world space, the way the light travels
+	glm::vec3 sunColor = glm::vec3(3.0f, 2.9f, 2.7f);
+	glm::vec3 ambient = glm::vec3(0.12f, 0.13f, 0.15f);
+	bool placed = false; // scatter() ran
+
+	// results of the last bin()
+	std::vector<GpuPointLight> viewLights;
+	std::vector<ClusterRange> clusters; // CLUSTER_COUNT, columns first, then rows, then slices
+	std::vector<uint32_t> indices;
+	unsigned int visibleLights = 0; // inside the frustum
+	unsigned int maxClusterLights = 0;
+	LightingParams params;
+
+	ClusteredLights() : slices(CLUSTER_Z) {}
+
+	// count lights at random spots in the box, sized so that neighbours overlap a little
+	void scatter(unsigned int count, const glm::vec3& min, const glm::vec3& max, unsigned int seed = 1) {
+		placed = true;
+		lights.clear();
+		if (count == 0)
+			return;
+		// flat boxes (a scene on the ground) still get some height
+		glm::vec3 size = max - min;
+		float largest = std::max({ size.x, size.y, size.z, 1e-3f });
+		glm::vec3 extent = glm::max(size, glm::vec3(largest * 0.1f));
+		glm::vec3 center = (min + max) * 0.5f;
+		float radius = 1.5f * std::cbrt(extent.x * extent.y * extent.z / count);
+
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		for (unsigned int i = 0; i < count; i++) {
+			PointLight light;
+			float x = unit(random), y = unit(random), z = unit(random);
+			light.position = center + (glm::vec3(x, y, z) - 0.5f) * extent;
+			light.radius = radius;
+			float r = unit(random), g = unit(random), b = unit(random);
+			light.color = glm::vec3(r, g, b) / std::max({ r, g, b, 1e-3f });
+			light.intensity = radius * radius * 0.25f;
+			lights.push_back(light);
+		}
+	}
+
+	// CPU only, any thread (uses the worker pool)
+	void bin(const glm::mat4& view, const glm::mat4& projection) {
+		PROFILE_SCOPE("bin lights");
+		updateGrid(projection);
+		unsigned int count = (unsigned int)std::min<size_t>(lights.size(), MAX_CLUSTERED_LIGHTS);
+		viewLights.resize(count);
+		bounds.resize(count);
+		workerPool().parallelFor(count, LIGHT_GRAIN, [&](unsigned int begin, unsigned int end) {
+			for (unsigned int i = begin; i < end; i++) {
+				placeLight(view, i);
+			}
+		});
+		// candidates of every slice, so a slice's pass doesn't have to look at every light
+		visibleLights = 0;
+		for (SliceBins& slice : slices) {
+			slice.lights.clear();
+		}
+		for (uint32_t i = 0; i < count; i++) {
+			const LightBounds& b = bounds[i];
+			if (!b.visible)
+				continue;
+			visibleLights++;
+			for (unsigned int k = b.slice0; k <= b.slice1; k++) {
+				slices[k].lights.push_back(i);
+			}
+		}
+
+		workerPool().parallelFor(CLUSTER_Z, 1, [&](unsigned int begin, unsigned int end) {
+			for (unsigned int slice = begin; slice < end; slice++) {
+				testSlice(slice);
+			}
+		});
+		size_t total = 0;
+		maxClusterLights = 0;
+		for (SliceBins& slice : slices) {
+			slice.first = total;
+			total += slice.hits.size();
+			maxClusterLights = std::max(maxClusterLights, slice.maxLights);
+		}
+		indices.resize(total);
+		clusters.resize(CLUSTER_COUNT);
+		workerPool().parallelFor(CLUSTER_Z, 1, [&](unsigned int begin, unsigned int end) {
+			for (unsigned int slice = begin; slice < end; slice++) {
+				sortSlice(slice);
+			}
+		});
+
+		glm::vec3 sun = glm::normalize(glm::mat3(view) * -sunDirection);
+		params.projectionScale = glm::vec4(scaleX, scaleY, sliceScale, sliceBias);
+		params.sunDirection = glm::vec4(sun, 0.0f);
+		params.sunColor = glm::vec4(sunColor, 0.0f);
+		params.ambient = glm::vec4(ambient, 0.0f);
+		params.grid = glm::uvec4(CLUSTER_X, CLUSTER_Y, CLUSTER_Z, count);
+	}
+
+	// GL thread: this frame's results into the streaming ring, bound where the shaders read them
+	void upload() {
+		StreamAllocation<LightingParams> frame = streamingBuffer().allocate<LightingParams>(1);
+		frame.data[0] = params;
+		glBindBufferRange(GL_UNIFORM_BUFFER, LIGHTING_BINDING, frame.buffer, frame.offset, sizeof(LightingParams));
+		uploadStorage(LIGHT_BINDING, viewLights);
+		uploadStorage(CLUSTER_BINDING, clusters);
+		uploadStorage(LIGHT_INDEX_BINDING, indices);
+	}
+
+	// Depth slice a view-space depth (-z) falls in, the shaders compute the same
+	unsigned int sliceOf(float depth) const {
+		if (!(depth > zNear))
+			return 0;
+		float slice = std::log(depth) * sliceScale + sliceBias;
+		return (unsigned int)std::min(std::max(slice, 0.0f), (float)(CLUSTER_Z - 1));
+	}
+
+	// Cluster of a view-space position, what clusterIndex() in common/lighting.glsl picks
+	unsigned int clusterOf(const glm::vec3& viewPosition) const {
+		float depth = -viewPosition.z;
+		unsigned int column = tileOf(scaleX * viewPosition.x / depth, CLUSTER_X);
+		unsigned int row = tileOf(scaleY * viewPosition.y / depth, CLUSTER_Y);
+		return column + CLUSTER_X * (row + CLUSTER_Y * sliceOf(depth));
+	}
+
+private:
+	// a light's view-space sphere and the part of the grid its bounding box covers
+	struct LightBounds
+	{
+		float x, y, depth, radius;
+		uint8_t slice0, slice1, row0, row1, column0, column1;
+		bool visible;
+	};
+
+	struct SliceBins
+	{
+		std::vector<uint32_t> lights; // whose depth range covers the slice, in light order
+		std::vector<uint32_t> hits;   // light << 8 | cluster within the slice
+		uint32_t count[CLUSTER_X * CLUSTER_Y];
+		unsigned int maxLights = 0;
+		size_t first = 0; // of the slice's lists in indices
+	};
+
+	std::vector<LightBounds> bounds;
+	std::vector<SliceBins> slices;
+
+	// grid of the last projection, rebuilt when it changes
+	float scaleX = 0.0f, scaleY = 0.0f, zNear = 0.0f, zFar = 0.0f;
+	float sliceScale = 0.0f, sliceBias = 0.0f;
+	float sliceDepth[CLUSTER_Z + 1];
+	// view-space x of every column and y of every row, per slice (froxels widen with depth)
+	float columnMin[CLUSTER_Z * CLUSTER_X], columnMax[CLUSTER_Z * CLUSTER_X];
+	float rowMin[CLUSTER_Z * CLUSTER_Y], rowMax[CLUSTER_Z * CLUSTER_Y];
+
+	void updateGrid(const glm::mat4& projection) {
+		float x = projection[0][0], y = projection[1][1];
+		float n = projection[3][2] / (projection[2][2] - 1.0f);
+		float f = projection[3][2] / (projection[2][2] + 1.0f);
+		if (x == scaleX && y == scaleY && n == zNear && f == zFar)
+			return;
+		scaleX = x;
+		scaleY = y;
+		zNear = n;
+		zFar = f;
+		float logRatio = std::log(zFar / zNear);
+		sliceScale = CLUSTER_Z / logRatio;
+		sliceBias = -(float)CLUSTER_Z * std::log(zNear) / logRatio;
+		for (unsigned int k = 0; k <= CLUSTER_Z; k++) {
+			sliceDepth[k] = zNear * std::pow(zFar / zNear, (float)k / CLUSTER_Z);
+		}
+		sliceDepth[CLUSTER_Z] = zFar;
+
+		// a tile spans [edge, next edge] in NDC, which is edge * depth / scale in view space
+		for (unsigned int k = 0; k < CLUSTER_Z; k++) {
+			float dn = sliceDepth[k], df = sliceDepth[k + 1];
+			for (unsigned int i = 0; i < CLUSTER_X; i++) {
+				float left = -1.0f + 2.0f * i / CLUSTER_X, right = -1.0f + 2.0f * (i + 1) / CLUSTER_X;
+				columnMin[k * CLUSTER_X + i] = std::min(left * dn, left * df) / scaleX;
+				columnMax[k * CLUSTER_X + i] = std::max(right * dn, right * df) / scaleX;
+			}
+			for (unsigned int j = 0; j < CLUSTER_Y; j++) {
+				float bottom = -1.0f + 2.0f * j / CLUSTER_Y, top = -1.0f + 2.0f * (j + 1) / CLUSTER_Y;
+				rowMin[k * CLUSTER_Y + j] = std::min(bottom * dn, bottom * df) / scaleY;
+				rowMax[k * CLUSTER_Y + j] = std::max(top * dn, top * df) / scaleY;
+			}
+		}
+	}
+
+	static uint8_t tileOf(float ndc, unsigned int tiles) {
+		float tile = std::floor((ndc * 0.5f + 0.5f) * tiles);
+		return (uint8_t)std::min(std::max(tile, 0.0f), (float)(tiles - 1));
+	}
+
+	void placeLight(const glm::mat4& view, unsigned int i) {
+		const PointLight& light = lights[i];
+		glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+		viewLights[i] = { glm::vec4(center, light.radius), glm::vec4(light.color * light.intensity, 0.0f) };
+
+		LightBounds& b = bounds[i];
+		b.x = center.x;
+		b.y = center.y;
+		b.depth = -center.z;
+		b.radius = light.radius;
+		float nearest = b.depth - b.radius, farthest = b.depth + b.radius;
+		b.visible = b.radius > 0.0f && farthest > zNear && nearest < zFar;
+		if (!b.visible)
+			return;
+		// x / depth over the sphere's bounding box is largest and smallest at its corners, and nothing nearer than
+		// the near plane is drawn
+		nearest = std::max(nearest, zNear);
+		float left = scaleX * std::min((b.x - b.radius) / nearest, (b.x - b.radius) / farthest);
+		float right = scaleX * std::max((b.x + b.radius) / nearest, (b.x + b.radius) / farthest);
+		float bottom = scaleY * std::min((b.y - b.radius) / nearest, (b.y - b.radius) / farthest);
+		float top = scaleY * std::max((b.y + b.radius) / nearest, (b.y + b.radius) / farthest);
+		if (right < -1.0f || left > 1.0f || top < -1.0f || bottom > 1.0f) {
+			b.visible = false;
+			return;
+		}
+		b.column0 = tileOf(left, CLUSTER_X);
+		b.column1 = tileOf(right, CLUSTER_X);
+		b.row0 = tileOf(bottom, CLUSTER_Y);
+		b.row1 = tileOf(top, CLUSTER_Y);
+		b.slice0 = (uint8_t)sliceOf(nearest);
+		b.slice1 = (uint8_t)sliceOf(farthest);
+	}
+
+	// Every light against the froxels of one slice: distance from the sphere's center to each froxel's box, rows one
+	// at a time and four columns per SIMD test
+	void testSlice(unsigned int k) {
+		SliceBins& slice = slices[k];
+		slice.hits.clear();
+		std::memset(slice.count, 0, sizeof(slice.count));
+		float dn = sliceDepth[k], df = sliceDepth[k + 1];
+		const float* minX = columnMin + k * CLUSTER_X;
+		const float* maxX = columnMax + k * CLUSTER_X;
+		for (uint32_t i : slice.lights) {
+			const LightBounds& b = bounds[i];
+			float radius2 = b.radius * b.radius;
+			float dz = std::max({ dn - b.depth, b.depth - df, 0.0f });
+			if (dz * dz > radius2)
+				continue;
+			for (unsigned int row = b.row0; row <= b.row1; row++) {
+				float dy = std::max({ rowMin[k * CLUSTER_Y + row] - b.y, b.y - rowMax[k * CLUSTER_Y + row], 0.0f });
+				float partial = dz * dz + dy * dy;
+				if (partial > radius2)
+					continue;
+				for (unsigned int column = b.column0 & ~3u; column <= b.column1; column += 4) {
+					unsigned int mask = testColumns(minX + column, maxX + column, b.x, partial, radius2);
+					for (unsigned int lane = 0; lane < 4; lane++) {
+						unsigned int c = column + lane;
+						if ((mask & (1u << lane)) && c >= b.column0 && c <= b.column1) {
+							unsigned int cluster = row * CLUSTER_X + c;
+							slice.hits.push_back(i << 8 | cluster);
+							slice.count[cluster]++;
+						}
+					}
+				}
+			}
+		}
+		slice.maxLights = *std::max_element(slice.count, slice.count + CLUSTER_X * CLUSTER_Y);
+	}
+
+	// Bit per column of four whose box is within the radius (partial: the squared y and z distance)
+	static unsigned int testColumns(const float* minX, const float* maxX, float x, float partial, float radius2) {
+#ifdef SIMD_SSE
+		__m128 center = _mm_set1_ps(x);
+		__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(minX), center), _mm_sub_ps(center, _mm_loadu_ps(maxX))), _mm_setzero_ps());
+		__m128 distance2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_set1_ps(partial));
+		return (unsigned int)_mm_movemask_ps(_mm_cmple_ps(distance2, _mm_set1_ps(radius2)));
+#else
+		unsigned int mask = 0;
+		for (unsigned int lane = 0; lane < 4; lane++) {
+			float dx = std::max({ minX[lane] - x, x - maxX[lane], 0.0f });
+			if (dx * dx + partial <= radius2)
+				mask |= 1u << lane;
+		}
+		return mask;
+#endif
+	}
+
+	// Counting sort of a slice's hits into its part of indices. Hits were made in light order, so each cluster's
+	// list comes out sorted.
+	void sortSlice(unsigned int k) {
+		SliceBins& slice = slices[k];
+		uint32_t cursor[CLUSTER_X * CLUSTER_Y];
+		uint32_t offset = (uint32_t)slice.first;
+		for (unsigned int c = 0; c < CLUSTER_X * CLUSTER_Y; c++) {
+			clusters[k * CLUSTER_X * CLUSTER_Y + c] = { offset, slice.count[c] };
+			cursor[c] = offset;
+			offset += slice.count[c];
+		}
+		for (uint32_t hit : slice.hits) {
+			indices[cursor[hit & 0xFF]++] = hit >> 8;
+		}
+	}
+
+	// Empty ranges can't be bound, so there's always at least one element (nothing reads it then)
+	template <typename T>
+	static void uploadStorage(unsigned int binding, const std::vector<T>& items) {
+		size_t count = std::max<size_t>(items.size(), 1);
+		StreamAllocation<T> range = streamingBuffer().allocate<T>(count);
+		if (!items.empty())
+			std::memcpy(range.data.data, items.data(), items.size() * sizeof(T));
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, range.buffer, range.offset, count * sizeof(T));
+	}
+};
@@ -0,0 +1,88 @@
+#pragma once
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+
+// Default rates, LEARNOPENGL_UPDATE_HZ and LEARNOPENGL_RENDER_HZ override them (render 0 = uncapped)
+const double DEFAULT_UPDATE_HZ = 120.0;
+const double DEFAULT_RENDER_HZ = 0.0;
+// a frame never runs more steps than this, the rest of the backlog is dropped so a stall can't snowball
+const unsigned int MAX_STEPS_PER_FRAME = 8;
+
+/* Fixed-timestep simulation decoupled from rendering. Time is kept as integer nanoseconds of a steady clock, so it
+doesn't lose precision with uptime. Every frame advance() says how many fixed steps to simulate to catch up with the
+clock, and alpha() how far the clock is into the next step; rendering interpolates between the state before the last
+step and after it, so motion is smooth at any render rate while simulation cost per second stays the same.
+
+	FrameLoop loop;
+	while (running) {
+		for (unsigned int steps = loop.advance(); steps > 0; steps--) { previous = current; simulate(current, loop.stepSeconds()); }
+		render(interpolate(previous, current, loop.alpha()));
+		loop.waitForNextFrame();
+	} */
+class FrameLoop
+{
+public:
+	int64_t updateStep;     // ns per simulation step
+	int64_t renderInterval; // ns between rendered frames, 0 renders as fast as swapping allows
+	uint64_t steps = 0;     // simulated so far
+	uint64_t droppedSteps = 0;
+
+	FrameLoop() {
+		double updateHz = rateFromEnv("LEARNOPENGL_UPDATE_HZ", DEFAULT_UPDATE_HZ);
+		double renderHz = rateFromEnv("LEARNOPENGL_RENDER_HZ", DEFAULT_RENDER_HZ);
+		updateStep = (int64_t)(1e9 / (updateHz > 0.0 ? updateHz : DEFAULT_UPDATE_HZ));
+		renderInterval = renderHz > 0.0 ? (int64_t)(1e9 / renderHz) : 0;
+		last = frameStart = Clock::now();
+	}
+
+	double stepSeconds() const {
+		return updateStep / 1e9;
+	}
+
+	// Steps to simulate this frame, call once per frame before updating
+	unsigned int advance() {
+		Clock::time_point now = Clock::now();
+		accumulator += std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+		last = now;
+
+		unsigned int count = (unsigned int)std::min<int64_t>(accumulator / updateStep, MAX_STEPS_PER_FRAME);
+		accumulator -= (int64_t)count * updateStep;
+		if (accumulator >= updateStep) {
+			droppedSteps += accumulator / updateStep;
+			accumulator %= updateStep;
+		}
+		steps += count;
+		return count;
+	}
+
+	// How far into the next step the clock is, 0 = exactly the latest simulated state
+	float alpha() const {
+		return (float)((double)accumulator / (double)updateStep);
+	}
+
+	// Sleeps off whatever is left of the render interval, call after presenting
+	void waitForNextFrame() {
+		if (renderInterval > 0) {
+			frameStart += std::chrono::nanoseconds(renderInterval);
+			Clock::time_point now = Clock::now();
+			if (frameStart > now)
+				std::this_thread::sleep_until(frameStart);
+			else
+				frameStart = now; // running behind, don't try to catch up with extra frames
+		}
+	}
+
+private:
+	using Clock = std::chrono::steady_clock;
+	Clock::time_point last;
+	Clock::time_point frameStart;
+	int64_t accumulator = 0; // ns of real time not simulated yet
+
+	static double rateFromEnv(const char* name, double fallback) {
+		const char* env = std::getenv(name);
+		return env ? std::strtod(env, nullptr) : fallback;
+	}
+};
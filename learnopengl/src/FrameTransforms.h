@@ -0,0 +1,90 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstring>
+#include "SimdMath.h"
+#include "ThreadPool.h"
+#include "StreamingBuffer.h"
+
+// matrices per job when a batch is split across the worker pool
+const unsigned int MVP_GRAIN = 4096;
+// SSBO binding point the shaders read MVPs from
+const unsigned int TRANSFORM_BINDING = 1;
+// and the matching model-view matrices, for lighting in view space
+const unsigned int MODEL_VIEW_BINDING = 7;
+
+// What a PrepareFrame/Draw pair covers. Shadow passes cache static geometry and draw the dynamic part on top every
+// frame (see ShadowCascades.h); what counts as dynamic is up to the drawable.
+enum DrawSubset {
+	DRAW_ALL,
+	DRAW_STATIC,
+	DRAW_DYNAMIC
+};
+
+/* Per-frame transform buffer. Every model appends its world matrices once per frame, they get multiplied by the
+view-projection matrix in one tight loop, and the whole batch is uploaded once for the shaders to index with the slot
+each draw was given. Passes that light their draws also get view * world per slot: the shaders need view space
+positions and normals, and those can't come back out of an MVP once a world matrix has non-uniform scale. */
+class FrameTransforms
+{
+public:
+	glm::mat4 view = glm::mat4(1.0f);
+	glm::mat4 projection = glm::mat4(1.0f);
+	glm::mat4 viewProjection = glm::mat4(1.0f);
+	std::vector<glm::mat4> mvp;
+	std::vector<glm::mat4> modelView; // same slots as mvp, empty unless begin() asked for them
+
+	// withModelView: the pass shades in view space (depth-only passes like the shadow casters don't)
+	void begin(const glm::mat4& view, const glm::mat4& projection, bool withModelView = true) {
+		this->view = view;
+		this->projection = projection;
+		this->withModelView = withModelView;
+		simd::mulMat4(projection, view, viewProjection);
+		mvp.clear(); // keeps capacity, so no allocations after the first few frames
+		modelView.clear();
+	}
+
+	// Appends viewProjection * worlds[index[i]] (and view * worlds[index[i]]) for count draws and returns the slot of
+	// the first one
+	unsigned int append(const glm::mat4* worlds, const unsigned int* index, unsigned int count) {
+		unsigned int first = (unsigned int)mvp.size();
+		mvp.resize(mvp.size() + count);
+		if (withModelView)
+			modelView.resize(mvp.size());
+		glm::mat4* out = mvp.data() + first;
+		glm::mat4* outModelView = withModelView ? modelView.data() + first : nullptr;
+		workerPool().parallelFor(count, MVP_GRAIN, [&](unsigned int begin, unsigned int end) {
+			const glm::mat4* source = index ? worlds : worlds + begin;
+			const unsigned int* sourceIndex = index ? index + begin : nullptr;
+			simd::mulMat4Batch(viewProjection, source, sourceIndex, out + begin, end - begin);
+			if (outModelView)
+				simd::mulMat4Batch(view, source, sourceIndex, outModelView + begin, end - begin);
+		});
+		return first;
+	}
+
+	// After every model has appended: copy the MVPs (and model-view matrices) into this frame's part of the streaming
+	// ring and bind those ranges at TRANSFORM_BINDING and MODEL_VIEW_BINDING (written through the persistent mapping,
+	// nothing waits on last frame's draws)
+	void upload() {
+		uploadRange(mvp, TRANSFORM_BINDING);
+		uploadRange(modelView, MODEL_VIEW_BINDING);
+	}
+
+	const glm::mat4& operator[](unsigned int slot) const {
+		return mvp[slot];
+	}
+
+private:
+	bool withModelView = true;
+
+	static void uploadRange(const std::vector<glm::mat4>& matrices, unsigned int binding) {
+		if (matrices.empty())
+			return;
+		StreamAllocation<glm::mat4> range = streamingBuffer().allocate<glm::mat4>(matrices.size());
+		std::memcpy(range.data.data, matrices.data(), matrices.size() * sizeof(glm::mat4));
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, range.buffer, range.offset, matrices.size() * sizeof(glm::mat4));
+	}
+};
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// 64-bit FNV-1a. Not cryptographic, just a cheap way to key caches on content. Pass a previous result as seed to
+// hash several pieces as one.
+const uint64_t FNV_OFFSET = 14695981039346656037ull;
+const uint64_t FNV_PRIME = 1099511628211ull;
+
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = FNV_OFFSET) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+inline uint64_t hashString(const std::string& str, uint64_t seed = FNV_OFFSET) {
+	// include the length so ("ab", "c") and ("a", "bc") don't collide when chained
+	uint64_t size = str.size();
+	return hashBytes(str.data(), str.size(), hashBytes(&size, sizeof(size), seed));
+}
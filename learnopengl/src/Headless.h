@@ -0,0 +1,317 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "ThreadPool.h"
+#include "Profiler.h"
+
+#ifndef _WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// frames read back asynchronously before the oldest one has to be waited on
+const unsigned int READBACK_DEPTH = 3;
+
+// Command line: --headless [--frames N] [--size WxH] [--out dir] [--format ppm|raw] for a headless run, --record path
+// to save the camera of every frame of a windowed run, --replay path [--frames N] to benchmark along a saved camera
+// path (windowed or headless)
+struct HeadlessOptions
+{
+	bool enabled = false;
+	unsigned int frames = 120;
+	bool framesGiven = false; // a replay runs the whole path unless --frames says otherwise
+	unsigned int width = 1280;
+	unsigned int height = 720;
+	std::string outDir; // empty: render and read back, but don't write anything
+	bool raw = false; // raw RGBA rows bottom-up instead of PPM
+	std::string recordPath;
+	std::string replayPath;
+
+	// false on anything it doesn't understand
+	bool parse(int argc, char** argv) {
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+			if (arg == "--headless") {
+				enabled = true;
+			}
+			else if (arg == "--frames" && hasValue) {
+				frames = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+				framesGiven = true;
+			}
+			else if (arg == "--size" && hasValue) {
+				if (std::sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0)
+					return false;
+			}
+			else if (arg == "--out" && hasValue) {
+				outDir = argv[++i];
+			}
+			else if (arg == "--format" && hasValue) {
+				std::string format = argv[++i];
+				if (format != "ppm" && format != "raw")
+					return false;
+				raw = format == "raw";
+			}
+			else if (arg == "--record" && hasValue) {
+				recordPath = argv[++i];
+			}
+			else if (arg == "--replay" && hasValue) {
+				replayPath = argv[++i];
+			}
+			else {
+				return false;
+			}
+		}
+		// nothing to record without input, and a replay has nothing new to record
+		if (!recordPath.empty() && (enabled || !replayPath.empty()))
+			return false;
+		return true;
+	}
+};
+
+/* OpenGL core context without a window or display server: EGL on Mesa's surfaceless platform (falls back to the
+default display), so it runs on llvmpipe in CI as well as on GPU render nodes. Rendering goes to a RenderTarget. */
+class HeadlessContext
+{
+public:
+	~HeadlessContext() {
+#ifndef _WIN32
+		if (display != EGL_NO_DISPLAY) {
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			if (context != EGL_NO_CONTEXT)
+				eglDestroyContext(display, context);
+			eglTerminate(display);
+		}
+#endif
+	}
+
+	bool create() {
+#ifdef _WIN32
+		std::cout << "ERROR::HEADLESS::NEEDS_EGL (not available on Windows)" << std::endl;
+		return false;
+#else
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+			if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+				std::cout << "ERROR::HEADLESS::NO_EGL_DISPLAY" << std::endl;
+				display = EGL_NO_DISPLAY;
+				return false;
+			}
+		}
+
+		// surfaceless displays usually have no configs at all, EGL_KHR_no_config_context covers that
+		const EGLint configAttribs[] = {
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_SURFACE_TYPE, 0, // no surface at all, everything goes through FBOs
+			EGL_NONE
+		};
+		EGLConfig config = EGL_NO_CONFIG_KHR;
+		EGLint configCount = 0;
+		if (!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(display, configAttribs, &config, 1, &configCount)) {
+			std::cout << "ERROR::HEADLESS::NO_OPENGL_API" << std::endl;
+			return false;
+		}
+		if (configCount == 0)
+			config = EGL_NO_CONFIG_KHR;
+
+		// 4.6 if we can get it, llvmpipe stops at 4.5 (see detectShaderVersion in Shader.h)
+		for (EGLint minor = 6; minor >= 5 && context == EGL_NO_CONTEXT; minor--) {
+			const EGLint contextAttribs[] = {
+				EGL_CONTEXT_MAJOR_VERSION, 4,
+				EGL_CONTEXT_MINOR_VERSION, minor,
+				EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+				EGL_NONE
+			};
+			context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+		}
+		if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+			std::cout << "ERROR::HEADLESS::COULD_NOT_CREATE_4.5_CORE_CONTEXT (EGL error 0x" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+			return false;
+		}
+		return true;
+#endif
+	}
+
+	// for gladLoadGLLoader and enableParallelShaderCompile
+	static GLADloadproc loader() {
+#ifdef _WIN32
+		return nullptr;
+#else
+		return (GLADloadproc)eglGetProcAddress;
+#endif
+	}
+
+private:
+#ifndef _WIN32
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
+
+// RGBA8 color + depth framebuffer to render into when there's no window
+class RenderTarget
+{
+public:
+	unsigned int FBO = 0;
+	unsigned int width = 0;
+	unsigned int height = 0;
+
+	bool create(unsigned int width, unsigned int height) {
+		this->width = width;
+		this->height = height;
+		glGenFramebuffers(1, &FBO);
+		glGenRenderbuffers(2, renderbuffers);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			std::cout << "ERROR::HEADLESS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+			return false;
+		}
+		glViewport(0, 0, width, height);
+		return true;
+	}
+
+private:
+	unsigned int renderbuffers[2] = { 0, 0 };
+};
+
+/* Reads frames back without stalling: read() only queues a glReadPixels into one of READBACK_DEPTH pixel pack
+buffers and fences it, the copy happens by the time that buffer comes around again (usually READBACK_DEPTH frames
+later, so the GPU is long done). Mapped pixels are copied out and written to disk on the worker pool. */
+class FrameReader
+{
+public:
+	unsigned int framesRead = 0;
+	std::atomic<unsigned int> framesWritten{ 0 };
+
+	FrameReader(unsigned int width, unsigned int height, const std::string& outDir, bool raw) : width(width), height(height), outDir(outDir), raw(raw) {
+		glGenBuffers(READBACK_DEPTH, PBO);
+		for (unsigned int i = 0; i < READBACK_DEPTH; i++) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)width * height * 4, nullptr, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	~FrameReader() {
+		finish();
+		glDeleteBuffers(READBACK_DEPTH, PBO);
+	}
+
+	// Queue a copy of the bound read framebuffer, collecting the frame that used this slot before
+	void read(unsigned int frame) {
+		unsigned int slot = next % READBACK_DEPTH;
+		if (fence[slot])
+			collect(slot);
+
+		PROFILE_GPU_SCOPE("readback");
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO[slot]);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		frameOf[slot] = frame;
+		next++;
+	}
+
+	// Collect everything still queued and wait for the writes
+	void finish() {
+		for (unsigned int i = 0; i < READBACK_DEPTH; i++) {
+			unsigned int slot = (next + i) % READBACK_DEPTH;
+			if (fence[slot])
+				collect(slot);
+		}
+		while (writing.load() > 0) {
+			if (!workerPool().runPendingJob())
+				std::this_thread::yield();
+		}
+	}
+
+private:
+	unsigned int width, height;
+	std::string outDir;
+	bool raw;
+	unsigned int PBO[READBACK_DEPTH];
+	GLsync fence[READBACK_DEPTH] = {};
+	unsigned int frameOf[READBACK_DEPTH] = {};
+	unsigned int next = 0;
+	std::atomic<unsigned int> writing{ 0 };
+
+	void collect(unsigned int slot) {
+		PROFILE_SCOPE("collect readback");
+		// normally signalled long ago, this only blocks when the GPU is more than READBACK_DEPTH frames behind
+		glClientWaitSync(fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(fence[slot]);
+		fence[slot] = 0;
+		framesRead++;
+		if (outDir.empty())
+			return;
+
+		std::vector<unsigned char> pixels((size_t)width * height * 4);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO[slot]);
+		void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixels.size(), GL_MAP_READ_BIT);
+		if (mapped) {
+			std::memcpy(pixels.data(), mapped, pixels.size());
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		if (!mapped) {
+			std::cout << "ERROR::HEADLESS::COULD_NOT_MAP_READBACK_BUFFER" << std::endl;
+			return;
+		}
+
+		unsigned int frame = frameOf[slot];
+		writing++;
+		workerPool().submit([this, frame, pixels = std::move(pixels)]() {
+			PROFILE_SCOPE("write frame");
+			if (writeFrame(frame, pixels))
+				framesWritten++;
+			writing--;
+		});
+	}
+
+	bool writeFrame(unsigned int frame, const std::vector<unsigned char>& pixels) const {
+		char name[32];
+		std::snprintf(name, sizeof(name), "frame_%05u.%s", frame, raw ? "rgba" : "ppm");
+		std::string path = outDir + "/" + name;
+		FILE* file = std::fopen(path.c_str(), "wb");
+		if (!file) {
+			std::cout << "ERROR::HEADLESS::COULD_NOT_WRITE " << path << std::endl;
+			return false;
+		}
+		if (raw) {
+			std::fwrite(pixels.data(), 1, pixels.size(), file);
+		}
+		else {
+			// PPM is RGB top-down, GL rows come bottom-up
+			std::fprintf(file, "P6\n%u %u\n255\n", width, height);
+			std::vector<unsigned char> row(width * 3);
+			for (unsigned int y = height; y-- > 0;) {
+				const unsigned char* in = &pixels[(size_t)y * width * 4];
+				for (unsigned int x = 0; x < width; x++) {
+					row[x * 3 + 0] = in[x * 4 + 0];
+					row[x * 3 + 1] = in[x * 4 + 1];
+					row[x * 3 + 2] = in[x * 4 + 2];
+				}
+				std::fwrite(row.data(), 1, row.size(), file);
+			}
+		}
+		return std::fclose(file) == 0;
+	}
+};
@@ -0,0 +1,200 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+/* Minimal KTX2 container, just what the Model Maker writes and the runtime reads: one 2D image with a full mip chain
+in a block-compressed format, no supercompression and no key/value data. Level data is stored smallest mip first
+(as the spec recommends) and located through the level index, so single levels can be read on their own. */
+
+const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+// VkFormat values of the formats we cook to
+const uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+const uint32_t VK_FORMAT_BC3_UNORM_BLOCK = 137;
+const uint32_t VK_FORMAT_BC5_UNORM_BLOCK = 141;
+const uint32_t VK_FORMAT_BC7_UNORM_BLOCK = 145;
+
+// not every glad config has the S3TC extension enums
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+struct Ktx2Level
+{
+	uint64_t offset;
+	uint64_t size;
+	unsigned int width;
+	unsigned int height;
+};
+
+inline unsigned int ktx2BlockBytes(uint32_t vkFormat) {
+	return vkFormat == VK_FORMAT_BC1_RGB_UNORM_BLOCK ? 8 : 16;
+}
+
+// 0 if we don't know the format
+inline GLenum ktx2GLFormat(uint32_t vkFormat) {
+	switch (vkFormat) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case VK_FORMAT_BC3_UNORM_BLOCK: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case VK_FORMAT_BC5_UNORM_BLOCK: return GL_COMPRESSED_RG_RGTC2;
+	case VK_FORMAT_BC7_UNORM_BLOCK: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default: return 0;
+	}
+}
+
+inline uint64_t ktx2LevelSize(uint32_t vkFormat, unsigned int width, unsigned int height) {
+	return (uint64_t)((width + 3) / 4) * ((height + 3) / 4) * ktx2BlockBytes(vkFormat);
+}
+
+// Header + level index of a KTX2 file, level data is read on demand
+struct Ktx2File
+{
+	std::string path;
+	uint32_t vkFormat = 0;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	std::vector<Ktx2Level> levels; // levels[0] is the full-size image
+
+	// False for anything we didn't write ourselves or that's damaged, the caller falls back to the source image
+	bool open(const std::string& path) {
+		this->path = path;
+		levels.clear();
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+			return false;
+		uint64_t fileSize = (uint64_t)file.tellg();
+		file.seekg(0);
+		unsigned char identifier[12];
+		uint32_t header[9];
+		if (!file.read((char*)identifier, sizeof(identifier)) || std::memcmp(identifier, KTX2_IDENTIFIER, sizeof(identifier)) != 0)
+			return false;
+		if (!file.read((char*)header, sizeof(header)))
+			return false;
+
+		vkFormat = header[0];
+		width = header[2];
+		height = header[3];
+		uint32_t levelCount = header[7] == 0 ? 1 : header[7];
+		if (header[8] != 0 || ktx2GLFormat(vkFormat) == 0)
+			return false; // supercompressed or a format we can't upload
+		if (width == 0 || height == 0 || header[4] > 1 || header[5] > 1 || header[6] > 1)
+			return false; // 3D, array or cube: not something we'd upload as a 2D texture
+		unsigned int maxLevels = 1;
+		while ((std::max(width, height) >> maxLevels) > 0)
+			maxLevels++;
+		if (levelCount > maxLevels)
+			return false;
+
+		// skip the dfd/kvd/sgd index, we don't need any of it
+		file.seekg(80);
+		levels.resize(levelCount);
+		for (uint32_t i = 0; i < levelCount; i++) {
+			uint64_t entry[3];
+			if (!file.read((char*)entry, sizeof(entry)))
+				return false;
+			levels[i].offset = entry[0];
+			levels[i].size = entry[1];
+			levels[i].width = width >> i > 0 ? width >> i : 1;
+			levels[i].height = height >> i > 0 ? height >> i : 1;
+			// level data has to be in the file and exactly as big as the format says
+			if (levels[i].offset > fileSize || levels[i].size > fileSize - levels[i].offset
+				|| levels[i].size != ktx2LevelSize(vkFormat, levels[i].width, levels[i].height))
+				return false;
+		}
+		return true;
+	}
+
+	std::vector<unsigned char> readLevel(unsigned int level) const {
+		std::vector<unsigned char> data(levels[level].size);
+		std::ifstream file(path, std::ios::binary);
+		file.seekg(levels[level].offset);
+		file.read((char*)data.data(), data.size());
+		if (!file)
+			data.clear();
+		return data;
+	}
+};
+
+// Data Format Descriptor for our block formats, mostly for the benefit of other KTX2 tools
+inline std::vector<uint32_t> ktx2Descriptor(uint32_t vkFormat) {
+	// (KHR_DF_MODEL_*, channel ids of the 64-bit halves of a block)
+	uint32_t model;
+	std::vector<uint32_t> channels;
+	switch (vkFormat) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK: model = 128; channels = { 0 }; break;
+	case VK_FORMAT_BC3_UNORM_BLOCK: model = 130; channels = { 15, 0 }; break;
+	case VK_FORMAT_BC5_UNORM_BLOCK: model = 132; channels = { 0, 1 }; break;
+	default: model = 134; channels = { 0 }; break; // BC7, one 128-bit sample
+	}
+
+	uint32_t blockSize = 24 + 16 * (uint32_t)channels.size();
+	std::vector<uint32_t> dfd;
+	dfd.push_back(4 + blockSize); // dfdTotalSize
+	dfd.push_back(0); // vendorId | descriptorType
+	dfd.push_back(2 | (blockSize << 16)); // versionNumber | descriptorBlockSize
+	dfd.push_back(model | (1 << 8) | (1 << 16)); // model | BT709 primaries | linear transfer | straight alpha
+	dfd.push_back(3 | (3 << 8)); // texel block 4x4x1x1 (stored minus one)
+	dfd.push_back(ktx2BlockBytes(vkFormat)); // bytesPlane0
+	dfd.push_back(0); // bytesPlane4..7
+	unsigned int bitLength = channels.size() == 1 ? ktx2BlockBytes(vkFormat) * 8 : 64;
+	for (uint32_t i = 0; i < channels.size(); i++) {
+		dfd.push_back((i * 64) | ((bitLength - 1) << 16) | (channels[i] << 24));
+		dfd.push_back(0); // sample position
+		dfd.push_back(0); // sampleLower
+		dfd.push_back(0xFFFFFFFF); // sampleUpper
+	}
+	return dfd;
+}
+
+// levels[0] is the full-size image, each following level half the size (rounded down, at least 1)
+inline bool writeKtx2(const std::string& path, uint32_t vkFormat, unsigned int width, unsigned int height, const std::vector<std::vector<unsigned char>>& levels) {
+	std::vector<uint32_t> dfd = ktx2Descriptor(vkFormat);
+	uint32_t levelCount = (uint32_t)levels.size();
+	uint32_t dfdOffset = 80 + 24 * levelCount;
+	uint32_t dfdLength = (uint32_t)dfd.size() * 4;
+
+	// level data, smallest first, each aligned to the block size
+	uint64_t alignment = ktx2BlockBytes(vkFormat);
+	uint64_t offset = dfdOffset + dfdLength;
+	std::vector<uint64_t> offsets(levelCount);
+	for (uint32_t i = levelCount; i-- > 0;) {
+		offset = (offset + alignment - 1) / alignment * alignment;
+		offsets[i] = offset;
+		offset += levels[i].size();
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+
+	uint32_t header[9] = { vkFormat, 1, width, height, 0, 0, 1, levelCount, 0 };
+	uint32_t index[4] = { dfdOffset, dfdLength, 0, 0 };
+	uint64_t sgd[2] = { 0, 0 };
+	file.write((const char*)KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+	file.write((const char*)header, sizeof(header));
+	file.write((const char*)index, sizeof(index));
+	file.write((const char*)sgd, sizeof(sgd));
+	for (uint32_t i = 0; i < levelCount; i++) {
+		uint64_t entry[3] = { offsets[i], levels[i].size(), levels[i].size() };
+		file.write((const char*)entry, sizeof(entry));
+	}
+	file.write((const char*)dfd.data(), dfdLength);
+
+	uint64_t written = dfdOffset + dfdLength;
+	for (uint32_t i = levelCount; i-- > 0;) {
+		static const char zeros[16] = { 0 };
+		file.write(zeros, offsets[i] - written);
+		file.write((const char*)levels[i].data(), levels[i].size());
+		written = offsets[i] + levels[i].size();
+	}
+	return (bool)file;
+}
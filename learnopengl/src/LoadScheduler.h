@@ -0,0 +1,82 @@
+#pragma once
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include "Model.h"
+#include "ShaderPermutations.h"
+#include "Profiler.h"
+
+// milliseconds of loading work per frame, LEARNOPENGL_LOAD_BUDGET_MS overrides it
+const double DEFAULT_LOAD_BUDGET_MS = 4.0;
+
+/* Spreads incrementally loading models (Model(directory, true)) over frames. update() runs their work items until the
+frame's budget is used up; it only checks the clock between items, so a frame spends at most the budget plus one item
+on loading. Models load one after the other, not interleaved, so each one is complete as early as it can be.
+GL thread only, like the loads themselves (see Model::Prepare for doing their CPU part elsewhere first). */
+class LoadScheduler
+{
+public:
+	double budgetMs;
+	unsigned int itemsRun = 0;
+	unsigned int failures = 0;
+
+	LoadScheduler() {
+		const char* env = std::getenv("LEARNOPENGL_LOAD_BUDGET_MS");
+		budgetMs = env ? std::atof(env) : DEFAULT_LOAD_BUDGET_MS;
+	}
+
+	void add(const std::shared_ptr<Model>& model) {
+		if (!model->IsLoaded())
+			loading.push_back(model);
+	}
+
+	// Once per frame. With shaders, variants a model turns out to need are requested as soon as they're known.
+	void update(ShaderPermutations* shaders = nullptr) {
+		if (loading.empty())
+			return;
+		PROFILE_SCOPE("incremental loading");
+		auto start = std::chrono::steady_clock::now();
+		std::chrono::duration<double, std::milli> budget(budgetMs);
+		while (!loading.empty() && std::chrono::steady_clock::now() - start < budget) {
+			std::shared_ptr<Model>& model = loading.front();
+			bool more;
+			try {
+				more = model->LoadStep();
+			}
+			catch (const std::exception& e) {
+				std::cout << "ERROR::MODEL_LOADING::" << e.what() << std::endl;
+				model->FailLoad(); // the asset manager drops it from its cache
+				failures++;
+				more = false;
+			}
+			itemsRun++;
+			if (shaders)
+				model->RequestShaders(*shaders);
+			if (!more)
+				loading.pop_front();
+		}
+	}
+
+	bool idle() const {
+		return loading.empty();
+	}
+
+	// Stops every load that hasn't finished, e.g. at shutdown
+	void cancel() {
+		for (std::shared_ptr<Model>& model : loading) {
+			model->AbandonLoad();
+		}
+		loading.clear();
+	}
+
+private:
+	std::deque<std::shared_ptr<Model>> loading;
+};
+
+inline LoadScheduler& loadScheduler() {
+	static LoadScheduler scheduler;
+	return scheduler;
+}
@@ -0,0 +1,154 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+// Texture slots of a material. The slot is also the texture unit it gets bound to (SLOT_COUNT + slot for textures
+// that live in an array), and the shaders declare their samplers with the matching layout(binding = ...), so nothing
+// has to be looked up by name at draw time.
+enum TextureSlot {
+	SLOT_BASE_COLOR = 0,
+	SLOT_METALLIC_ROUGHNESS,
+	SLOT_NORMAL,
+	SLOT_OCCLUSION,
+	SLOT_EMISSIVE,
+	SLOT_COUNT
+};
+
+// SSBO binding point of the material table
+const unsigned int MATERIAL_BINDING = 0;
+
+// One entry of the material table, laid out for std430 (keep in sync with the Material struct in the shaders)
+struct MaterialParams
+{
+	glm::vec4 baseColorFactor = glm::vec4(1.0f);
+	glm::vec4 emissiveFactor = glm::vec4(0.0f); // w unused
+	float metallicFactor = 1.0f;
+	float roughnessFactor = 1.0f;
+	float normalScale = 1.0f;
+	float alphaCutoff = 0.5f;
+	unsigned int textureMask = 0; // bit n set -> slot n has a texture
+	unsigned int arrayMask = 0; // bit n set -> slot n is a layer of a texture array (see TextureArrays.h)
+	unsigned int atlasMask = 0; // bit n set -> ... and an atlas entry, sampled through atlasRect[n]
+	unsigned int pad0 = 0;
+	glm::vec4 atlasRect[SLOT_COUNT] = { glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(0.0f) }; // uv scale (xy) and offset (zw) of atlas entries
+	unsigned int layer[SLOT_COUNT] = { 0 };
+	unsigned int pad1[3] = { 0, 0, 0 };
+};
+
+struct Material
+{
+	std::string name;
+	MaterialParams params;
+	unsigned int textures[SLOT_COUNT] = { 0 }; // GL texture per slot, 0 = none
+	unsigned int arrays[SLOT_COUNT] = { 0 }; // GL_TEXTURE_2D_ARRAY per slot, 0 = none
+	bool alphaTest = false; // glTF alphaMode MASK
+
+	void setTexture(TextureSlot slot, unsigned int id) {
+		textures[slot] = id;
+		arrays[slot] = 0;
+		params.arrayMask &= ~(1u << slot);
+		params.atlasMask &= ~(1u << slot);
+		if (id != 0)
+			params.textureMask |= 1u << slot;
+		else
+			params.textureMask &= ~(1u << slot);
+	}
+
+	// The slot's texture is a layer of an array; atlas entries only cover rect (uv scale, offset) of the layer
+	void setArrayTexture(TextureSlot slot, unsigned int array, unsigned int layer, const glm::vec4& rect, bool atlas) {
+		setTexture(slot, 0);
+		arrays[slot] = array;
+		params.layer[slot] = layer;
+		params.atlasRect[slot] = rect;
+		if (array == 0)
+			return;
+		params.textureMask |= 1u << slot;
+		params.arrayMask |= 1u << slot;
+		if (atlas)
+			params.atlasMask |= 1u << slot;
+	}
+
+	bool hasTexture(TextureSlot slot) const {
+		return (params.textureMask & (1u << slot)) != 0;
+	}
+};
+
+/* All materials of a model, built at load (and again once the textures are in, for models loaded incrementally).
+Parameters live in one SSBO indexed by material, so the material index can come with each draw, and materials whose
+textures are all in the same arrays don't need any binds in between. */
+class MaterialTable
+{
+public:
+	std::vector<Material> materials;
+	std::vector<unsigned int> streamed; // textures the model got from the texture streamer, by their current names
+
+	unsigned int add(const Material& material) {
+		materials.push_back(material);
+		return (unsigned int)materials.size() - 1;
+	}
+
+	// Pack parameters into the SSBO, call again after changing any of them
+	void upload() {
+		std::vector<MaterialParams> params;
+		for (const Material& material : materials) {
+			params.push_back(material.params);
+		}
+		if (SSBO == 0)
+			glGenBuffers(1, &SSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, SSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, params.size() * sizeof(MaterialParams), params.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	void bind() const {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_BINDING, SSBO);
+	}
+
+	// Textures and arrays of every slot in one call (empty slots get unbound)
+	void bindTextures(unsigned int material) const {
+		unsigned int units[2 * SLOT_COUNT];
+		std::copy(materials[material].textures, materials[material].textures + SLOT_COUNT, units);
+		std::copy(materials[material].arrays, materials[material].arrays + SLOT_COUNT, units + SLOT_COUNT);
+		glBindTextures(0, 2 * SLOT_COUNT, units);
+	}
+
+	// True if binding b's textures after a's would change nothing
+	bool sameTextures(unsigned int a, unsigned int b) const {
+		return std::equal(materials[a].textures, materials[a].textures + SLOT_COUNT, materials[b].textures)
+			&& std::equal(materials[a].arrays, materials[a].arrays + SLOT_COUNT, materials[b].arrays);
+	}
+
+	// Orders materials so ones with the same bindings end up next to each other
+	bool texturesBefore(unsigned int a, unsigned int b) const {
+		if (!std::equal(materials[a].arrays, materials[a].arrays + SLOT_COUNT, materials[b].arrays))
+			return std::lexicographical_compare(materials[a].arrays, materials[a].arrays + SLOT_COUNT, materials[b].arrays, materials[b].arrays + SLOT_COUNT);
+		return std::lexicographical_compare(materials[a].textures, materials[a].textures + SLOT_COUNT, materials[b].textures, materials[b].textures + SLOT_COUNT);
+	}
+
+	unsigned int size() const {
+		return (unsigned int)materials.size();
+	}
+
+	void release() {
+		glDeleteBuffers(1, &SSBO);
+		SSBO = 0;
+	}
+
+	// A texture got a new GL name (texture streaming reallocates on residency changes)
+	void replaceTexture(unsigned int oldId, unsigned int newId) {
+		std::replace(streamed.begin(), streamed.end(), oldId, newId);
+		for (Material& material : materials) {
+			for (unsigned int& id : material.textures) {
+				if (id == oldId)
+					id = newId;
+			}
+		}
+	}
+
+private:
+	unsigned int SSBO = 0;
+};
@@ -4,18 +4,19 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <vector> // why?
+#include <cstddef>
+#include <cstdint>
 #include <string>
-#include "Shader.h"
+#include "Arena.h"
+#include "StreamingBuffer.h"
+#include "Profiler.h"
 
 struct Vertex
 {
 	glm::vec3 Position;
 	glm::vec2 TexCoords;
 	glm::vec3 Normal;
-	// Probably adding these later on
-	// 
-	//glm::vec3 Tangent;
-	//glm::vec3 Bitangent;
+	glm::vec4 Tangent; // xyz: unit tangent, w: bitangent sign (bitangent = w * cross(Normal, Tangent)), see TangentSpace.h
 	//bone stuff for animation?
 };
 
@@ -23,27 +24,53 @@ struct Texture
 {
 	unsigned int id;
 	std::string filepath;
-	std::string type; // Provisory types: diffuse, specular, normal, height
+	std::string type; // diffuse, metallicRoughness, normal, occlusion or emissive (see Material.h for the slots)
+	int poolEntry = -1; // entry in the model's TextureArrayPool instead of a texture of its own
+	int streamed = -1;  // entry in the material table's streamed list (id goes stale as the streamer renames it)
 };
 
-class Mesh // TODO: make destructor to delete VBO/VAO/EBO? Good idea?
+// Range of a Mesh's buffers that came from one glTF primitive
+struct SubMesh
 {
-public:
-	// properties
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
-	std::vector<Texture> textures;
-	glm::mat4 model;
+	unsigned int indexOffset; // in indices, not bytes
+	unsigned int indexCount;
+	int baseVertex; // sub-mesh indices are relative to this vertex
+	unsigned int node; // index into the owning model's TransformHierarchy
+	unsigned int material; // index into the owning model's MaterialTable
+	glm::vec3 boundsMin; // node-space bounding box
+	glm::vec3 boundsMax;
+};
 
-	unsigned int VAO;
+// Layout glMultiDrawElementsIndirect reads its commands in
+struct DrawElementsIndirectCommand
+{
+	unsigned int count;
+	unsigned int instanceCount;
+	unsigned int firstIndex;
+	int baseVertex;
+	unsigned int baseInstance;
+};
 
-	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures, glm::mat4 model = glm::mat4(1.0f)) {
-		this->indices = indices;
-		this->textures = textures;
-		this->vertices = vertices;
-		this->model = model;
+class Mesh // meshes get copied around, so GL objects are freed explicitly with Release()
+{
+public:
+	// properties, vertex and index data only live on the GPU
+	std::vector<SubMesh> subMeshes; // primitives sharing this mesh's vertex layout, in draw order
 
-		unsigned int VBO, EBO;
+	unsigned int VAO;
+	GLenum indexType = GL_UNSIGNED_INT; // GL_UNSIGNED_SHORT when every sub-mesh has at most 65536 vertices
+	uint64_t gpuBytes = 0; // vertex and index buffers
+	unsigned int firstDraw = 0; // model-wide draw index of subMeshes[0]
+
+	// indices: indexCount of indexType (GL_UNSIGNED_SHORT or GL_UNSIGNED_INT), relative to their sub-mesh's baseVertex.
+	// firstDraw: the model-wide draw index of subMeshes[0], passed to the shaders as baseInstance
+	Mesh(Span<const Vertex> vertices, const void* indices, size_t indexCount, GLenum indexType, const std::vector<SubMesh>& subMeshes, unsigned int firstDraw) {
+		this->subMeshes = subMeshes;
+		this->indexType = indexType;
+		size_t indexBytes = indexCount * indexSize(indexType);
+		gpuBytes = vertices.size * sizeof(Vertex) + indexBytes;
+
+		PROFILE_SCOPE("upload mesh");
 		// create VAO/VBO/EBO
 		glGenVertexArrays(1, &VAO);
 		glGenBuffers(1, &VBO);
@@ -53,9 +80,9 @@ public:
 		glBindVertexArray(VAO);
 		glBindBuffer(GL_ARRAY_BUFFER, VBO);
 		// TODO: When to not make static draw?
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size * sizeof(Vertex), vertices.data, GL_STATIC_DRAW);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indices, GL_STATIC_DRAW);
 
 		// configure VAO
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
@@ -64,52 +91,77 @@ public:
 		glEnableVertexAttribArray(1);
 		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
 		glEnableVertexAttribArray(2);
-		// TODO: Add extra vertex info (normals, etc)
+		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+		glEnableVertexAttribArray(3);
 
 		glBindVertexArray(0); // Don't really need to "unbind" this 
+
+		UploadDrawCommands(firstDraw);
 	}
 
-	void Draw(Shader &shader, glm::mat4 view, glm::mat4 projection) {
-		// TODO: figure out shaders (prob similar to textures)
-
-		// bind appropriate textures abiding by our provisory texture types
-		unsigned short diffuseCount = 1;
-		unsigned short specularCount = 1;
-		unsigned short normalCount = 1;
-		unsigned short heightCount = 1;
-
-		for (unsigned short i = 0; i < textures.size(); i++) {
-			std::string name = textures[i].type.c_str();
-			std::string number;
-
-			if (name == "diffuse") {
-				number = std::to_string(diffuseCount++);
-			}
-			else if (name == "specular") {
-				number = std::to_string(specularCount++);
-			}
-			else if (name == "normal") {
-				number = std::to_string(normalCount++);
-			}
-			else if (name == "height") {
-				number = std::to_string(heightCount++);
-			}
-
-			// activate texture
-			glActiveTexture(GL_TEXTURE0 + i);
-
-			// now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), 0);
-
-			// and finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+	// One indirect command per sub-mesh, in subMeshes order. Again after reordering subMeshes (the sub-mesh ranges
+	// themselves never change).
+	void UploadDrawCommands(unsigned int firstDraw) {
+		this->firstDraw = firstDraw;
+		LinearArena& arena = loadArena();
+		LinearArena::Marker marker = arena.mark();
+		Span<DrawElementsIndirectCommand> commands = arena.allocate<DrawElementsIndirectCommand>(subMeshes.size());
+		for (unsigned int i = 0; i < subMeshes.size(); i++) {
+			const SubMesh& sub = subMeshes[i];
+			commands[i] = { sub.indexCount, 1, sub.indexOffset, sub.baseVertex, firstDraw + i };
 		}
+		if (indirectBuffer == 0)
+			glGenBuffers(1, &indirectBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size * sizeof(DrawElementsIndirectCommand), commands.data, GL_STATIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		arena.rewind(marker);
+	}
 
-		shader.use();
-		// precompute MVP
-		glm::mat4 MVP = projection * view * this->model;
-		shader.setMat4("MVP", MVP);
+	// Draws sub-meshes [first, first + count) in one call. Program, textures and the per-draw buffers (MVPs, materials)
+	// are set up by the caller, see Model::Draw
+	void Draw(unsigned int first, unsigned int count) const {
+		countDraws(first, count, 1);
 		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, (void*)(first * sizeof(DrawElementsIndirectCommand)), count, 0);
+	}
+
+	// Same, with every sub-mesh drawn instances times. The instance count changes from frame to frame, so these
+	// commands are written into the streaming ring instead of the static indirect buffer.
+	void DrawInstanced(unsigned int first, unsigned int count, unsigned int instances) const {
+		StreamAllocation<DrawElementsIndirectCommand> commands = streamingBuffer().allocate<DrawElementsIndirectCommand>(count);
+		for (unsigned int i = 0; i < count; i++) {
+			const SubMesh& sub = subMeshes[first + i];
+			commands.data[i] = { sub.indexCount, instances, sub.indexOffset, sub.baseVertex, firstDraw + first + i };
+		}
+		countDraws(first, count, instances);
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.buffer);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, (void*)commands.offset, count, 0);
+	}
+
+	static size_t indexSize(GLenum indexType) {
+		return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+	}
+
+	void Release() {
+		glDeleteVertexArrays(1, &VAO);
+		unsigned int buffers[3] = { VBO, EBO, indirectBuffer };
+		glDeleteBuffers(3, buffers);
+		VAO = VBO = EBO = indirectBuffer = 0;
+		gpuBytes = 0;
+	}
+
+private:
+	unsigned int VBO = 0, EBO = 0;
+	unsigned int indirectBuffer = 0;
+
+	void countDraws(unsigned int first, unsigned int count, unsigned int instances) const {
+		RenderCounters& counters = renderCounters();
+		counters.calls++;
+		counters.draws += count;
+		for (unsigned int i = first; i < first + count; i++)
+			counters.triangles += (uint64_t)(subMeshes[i].indexCount / 3) * instances;
 	}
 };
\ No newline at end of file
@@ -5,76 +5,725 @@
 
 
 #include "Mesh.h"
+#include "Material.h"
+#include "ShaderPermutations.h"
+#include "KTX2.h"
+#include "TextureStreamer.h"
+#include "TextureArrays.h"
+#include "TransformHierarchy.h"
+#include "FrameTransforms.h"
+#include "Profiler.h"
+#include "Arena.h"
+#include "SpatialIndex.h"
+#include "TangentSpace.h"
+#include "ThreadPool.h"
 #include <iostream>
+#include <map>
+#include <deque>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
 
 using json = nlohmann::json;
 
-struct TexToLoad {
-	unsigned int texID;
-	const char* type;
+// vertex attributes present in a primitive
+const unsigned int LAYOUT_POSITION = 1 << 0;
+const unsigned int LAYOUT_TEXCOORD = 1 << 1;
+const unsigned int LAYOUT_NORMAL = 1 << 2;
+const unsigned int LAYOUT_TANGENT = 1 << 3;
+// and the index width its mesh needs: 32 bits only for primitives with more vertices than 16 bits can address
+const unsigned int LAYOUT_INDEX32 = 1 << 4;
+const unsigned int MAX_INDEX16_VERTICES = 65536;
+// incremental loads upload a batch once it holds this many vertices and start another one for its layout, so
+// geometry shows up while the rest is still decoding (and no single upload item gets big)
+const unsigned int INCREMENTAL_BATCH_VERTICES = 65536;
+
+// SSBO binding point of the per-draw material indices
+const unsigned int DRAW_MATERIAL_BINDING = 2;
+// SSBO binding point of the per-draw node transforms of instanced draws
+const unsigned int DRAW_WORLD_BINDING = 3;
+
+// accessor data of one primitive, decoded into the load arena (missing attributes are empty)
+struct DecodedPrimitive {
+	Span<glm::vec3> positions;
+	Span<glm::vec2> texCoords;
+	Span<glm::vec3> normals;
+	Span<glm::vec4> tangents;
+	Span<unsigned int> indices;
+	bool generateNormals = false; // once the vertices are assembled, see TangentSpace.h
+	bool generateTangents = false;
+};
+
+// primitives sharing a vertex layout, concatenated into one vertex/index buffer (materials are per sub-mesh)
+struct PrimitiveBatch {
+	unsigned int layout;
+	unsigned int vertexCount = 0;
+	unsigned int indexCount = 0;
+	std::vector<SubMesh> subMeshes;
+	std::vector<DecodedPrimitive> primitives; // same order as subMeshes
+	bool queued = false; // its upload is queued, nothing gets appended any more
 };
 
 class Model
 {
 public:
-	Model(const char* directory) {
-		// create json
+	/* Loads the glTF in directory (with trailing slash). incremental only queues the work and returns right away:
+	LoadStep() then does one item at a time (a file read, the JSON parse, one mesh's accessors, one batch's upload, one
+	image, one texture array...), see LoadScheduler for spreading them over frames. The model can be drawn at any point
+	and shows what is ready: nothing, then untextured geometry batch by batch, then the textured result.
+	queueOnly queues a regular load the same way, for the caller to run: Prepare() on any thread, then LoadStep() on
+	the GL thread until it's done (see AssetManager::acquireAll). */
+	Model(const char* directory, bool incremental = false, bool queueOnly = false) {
+		PROFILE_SCOPE("load model");
 		this->directory = directory;
-		std::string fileStr = directory + std::string("scene.gltf");
-		const char* file = fileStr.c_str();
-		std::string text = readFile(file);
-		JSON = json::parse(text);
-
+		this->incremental = incremental;
+		work.push_back({ "read file", [this] {
+			// every load-time temporary comes from an arena of the load's own and is dropped in one go once uploaded
+			decodeArena = arenaPool().acquire();
+			loadText = readFile((this->directory + "scene.gltf").c_str());
+		} });
+		work.push_back({ "parse JSON", [this] {
+			JSON = json::parse(loadText);
+			std::string().swap(loadText);
+		} });
 		// get bin data
-		data = getData();
+		work.push_back({ "read buffers", [this] { data = getData(); } });
+		// build node hierarchy, then gather primitives into batches mesh by mesh
+		work.push_back({ "load nodes", [this] {
+			loadNodes();
+			work.push_back({ "load materials", [this] { queueMaterialWork(); } });
+		} });
+
+		if (!incremental && !queueOnly) {
+			try {
+				while (LoadStep());
+			}
+			catch (...) {
+				AbandonLoad();
+				throw;
+			}
+		}
+
+		// streamed textures get new GL names as their residency changes
+		textureStreamer().addListener(&materialTable);
+	}
+
+	// Runs the next loading work item, true while there is more. On the GL thread (that's where uploads happen).
+	bool LoadStep() {
+		if (work.empty())
+			return false;
+		LoadItem item = std::move(work.front());
+		work.pop_front();
+		{
+			PROFILE_SCOPE(item.name);
+			item.run();
+		}
+		return !work.empty();
+	}
+
+	// Runs every queued item that doesn't need the GL thread (file reads, parsing, accessor and image decoding), on
+	// whatever thread calls it. The ones that do stay queued in order for LoadStep. Not while LoadStep runs.
+	void Prepare() {
+		std::deque<LoadItem> later;
+		while (!work.empty()) {
+			LoadItem item = std::move(work.front());
+			work.pop_front();
+			if (item.gl) {
+				later.push_back(std::move(item));
+				continue;
+			}
+			PROFILE_SCOPE(item.name);
+			item.run();
+		}
+		work = std::move(later);
+	}
+
+	bool IsLoaded() const {
+		return work.empty();
+	}
+
+	// A work item threw: the rest of the load is dropped and the model is marked so caches don't hand it out again
+	void FailLoad() {
+		AbandonLoad();
+		failed = true;
+	}
+
+	bool LoadFailed() const {
+		return failed;
+	}
+
+	// Drops whatever loading is left (after a work item threw, or to cancel it), keeps what's already drawable
+	void AbandonLoad() {
+		work.clear();
+		if (decodeArena) {
+			arenaPool().release(decodeArena);
+			decodeArena = nullptr;
+		}
+		batches.clear();
+		batchLookup.clear();
+	}
+
+	~Model() {
+		textureStreamer().removeListener(&materialTable);
+	}
+
+	// the queued work items point back at the model
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+
+	// Free the model's GL objects (not done by the destructor, which may run after the context is gone), streamed
+	// textures included
+	void Release() {
+		for (unsigned int id : materialTable.streamed) {
+			textureStreamer().remove(id);
+		}
+		materialTable.streamed.clear();
+		for (Mesh& mesh : meshes) {
+			mesh.Release();
+		}
+		texturePool.release();
+		materialTable.release();
+		glDeleteBuffers(1, &drawMaterialBuffer);
+		drawMaterialBuffer = 0;
+	}
+
+	// Rough memory the model holds on to: GPU buffers, texture arrays and streamed textures' resident levels plus the
+	// CPU copy of the glTF buffer
+	uint64_t MemoryUsage() const {
+		uint64_t bytes = data.size() + texturePool.gpuBytes;
+		for (unsigned int id : materialTable.streamed) {
+			bytes += textureStreamer().residentSize(id);
+		}
+		for (const Mesh& mesh : meshes) {
+			bytes += mesh.gpuBytes;
+		}
+		return bytes;
+	}
+
+	// per-node transforms, can be changed at any time and are picked up on the next Draw
+	TransformHierarchy transforms;
+
+	// Model-space box around every sub-mesh, false until the load is done (a partly uploaded model's box only covers
+	// some of it, and lights or shadow cascades fitted to that would stay wrong), like Scene::Bounds
+	bool Bounds(glm::vec3& min, glm::vec3& max) {
+		if (!IsLoaded())
+			return false;
+		transforms.update();
+		bool any = false;
+		for (const Mesh& mesh : meshes) {
+			for (const SubMesh& sub : mesh.subMeshes) {
+				glm::vec3 subMin, subMax;
+				transformBounds(transforms.world[sub.node], sub.boundsMin, sub.boundsMax, subMin, subMax);
+				min = any ? glm::min(min, subMin) : subMin;
+				max = any ? glm::max(max, subMax) : subMax;
+				any = true;
+			}
+		}
+		return any;
+	}
+
+	// Batch stage: bring world matrices up to date and append one MVP per sub-mesh to this frame's transforms. A model
+	// is all static, so DRAW_DYNAMIC leaves it out (until the next PrepareFrame).
+	void PrepareFrame(FrameTransforms& frame, DrawSubset subset = DRAW_ALL) {
+		transforms.update();
+		skipDraw = subset == DRAW_DYNAMIC;
+		if (!skipDraw)
+			firstTransform = frame.append(transforms.world.data(), drawNodes.data(), (unsigned int)drawNodes.size());
+	}
+
+	// Changes whenever the model's shadow could have: meshes or materials loaded, or a node moved
+	uint64_t StaticVersion() const {
+		return (uint64_t)drawOrderVersion << 32 | transforms.version;
+	}
+
+	bool HasDynamicCasters() const {
+		return false;
+	}
+
+	// Instanced stage: the node transform of every draw (in draw order) goes into this frame's streaming ring, for
+	// DrawInstanced to combine with each instance's MVP
+	StreamAllocation<glm::mat4> PrepareInstances() {
+		transforms.update();
+		StreamAllocation<glm::mat4> drawWorlds = streamingBuffer().allocate<glm::mat4>(drawNodes.size());
+		for (unsigned int i = 0; i < drawNodes.size(); i++) {
+			drawWorlds.data[i] = transforms.world[drawNodes[i]];
+		}
+		return drawWorlds;
+	}
 
-		// begin recurse
-		traverseNode(0);
+	/* Tell the texture streamer how large each material's textures are on screen: every sub-mesh's bounding sphere
+	is projected with this frame's camera and reported for all of its material's textures (the streamer keeps the
+	largest). Assumes UVs span each texture about once across a sub-mesh, which is close enough for picking mip levels.
+	instanceWorld places the whole model, for instances. */
+	void UpdateStreaming(const FrameTransforms& frame, float viewportHeight, const glm::mat4& instanceWorld = glm::mat4(1.0f)) {
+		// pixels per unit of radius at distance 1
+		float pixelScale = frame.projection[1][1] * viewportHeight * 0.5f;
+		for (const Mesh& mesh : meshes) {
+			for (const SubMesh& sub : mesh.subMeshes) {
+				glm::mat4 world = instanceWorld * transforms.world[sub.node];
+				glm::vec3 center = glm::vec3(frame.view * world * glm::vec4((sub.boundsMin + sub.boundsMax) * 0.5f, 1.0f));
+				float scale = std::max(glm::length(glm::vec3(world[0])), std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+				float radius = glm::length(sub.boundsMax - sub.boundsMin) * 0.5f * scale;
+				float distance = std::max(glm::length(center) - radius, 0.1f);
+				float pixels = 2.0f * radius * pixelScale / distance;
+				for (unsigned int id : materialTable.materials[sub.material].textures) {
+					if (id != 0)
+						textureStreamer().requestPixels(id, pixels);
+				}
+			}
+		}
 	}
 
-	void Draw(Shader& shader, glm::mat4 view, glm::mat4 projection) {
-		for (Mesh mesh : meshes) {
-			mesh.Draw(shader, view, projection);
+	// Start compiling every shader variant this model's materials use, without waiting on any of them.
+	// extraFeatures: e.g. FEATURE_INSTANCED for models that get drawn instanced.
+	void RequestShaders(ShaderPermutations& shaders, unsigned int extraFeatures = 0) {
+		for (unsigned int features : materialFeatures) {
+			shaders.request(features | extraFeatures);
 		}
 	}
 
+	// Must come after PrepareFrame (and the frame's upload) for the same frame
+	void Draw(ShaderPermutations& shaders, const FrameTransforms& frame) {
+		PROFILE_SCOPE("Model::Draw");
+		if (!skipDraw)
+			drawRuns(shaders, firstTransform, 0);
+	}
+
+	// Draws the model instances times, the instances' MVPs start at slot firstInstance of this frame's transforms.
+	// drawWorlds comes from PrepareInstances for the same frame.
+	void DrawInstanced(ShaderPermutations& shaders, const StreamAllocation<glm::mat4>& drawWorlds, unsigned int firstInstance, unsigned int instances) {
+		PROFILE_SCOPE("Model::DrawInstanced");
+		if (instances == 0 || drawWorlds.data.empty())
+			return;
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, DRAW_WORLD_BINDING, drawWorlds.buffer, drawWorlds.offset, drawWorlds.data.size * sizeof(glm::mat4));
+		drawRuns(shaders, firstInstance, instances);
+	}
+
 private:
-	const char* directory;
+	// Multi-draws every mesh, with one run per stretch of sub-meshes sharing a program and textures.
+	// instances == 0: regular draw, MVPs of the draws start at firstSlot. Otherwise MVPs of the instances do.
+	void drawRuns(ShaderPermutations& shaders, unsigned int firstSlot, unsigned int instances) {
+		if (meshes.empty())
+			return; // still loading
+		unsigned int extraFeatures = instances ? FEATURE_INSTANCED : 0;
+		auto drawRun = [instances](const Mesh& mesh, unsigned int first, unsigned int count) {
+			if (instances)
+				mesh.DrawInstanced(first, count, instances);
+			else
+				mesh.Draw(first, count);
+		};
+		materialTable.bind();
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_MATERIAL_BINDING, drawMaterialBuffer);
+
+		Shader* shader = nullptr;
+		unsigned int boundFeatures = (unsigned int)-1;
+		unsigned int boundMaterial = (unsigned int)-1;
+		for (const Mesh& mesh : meshes) {
+			// sub-meshes are sorted by variant and then textures, a run only ends when one of them changes
+			unsigned int runStart = 0;
+			for (unsigned int i = 0; i < mesh.subMeshes.size(); i++) {
+				unsigned int material = mesh.subMeshes[i].material;
+				bool newProgram = materialFeatures[material] != boundFeatures;
+				bool newTextures = boundMaterial == (unsigned int)-1 || !materialTable.sameTextures(material, boundMaterial);
+				if ((newProgram || newTextures) && i > runStart) {
+					if (shader)
+						drawRun(mesh, runStart, i - runStart);
+					runStart = i;
+				}
+				if (newProgram) {
+					boundFeatures = materialFeatures[material];
+					// only blocks if this variant is still compiling, a model that's loading in skips it for now
+					shader = incremental ? shaders.tryGet(boundFeatures | extraFeatures) : &shaders.get(boundFeatures | extraFeatures);
+					if (shader) {
+						shader->use();
+						shader->setUint(UNIFORM_FIRST_DRAW, firstSlot); // uniforms are per program
+					}
+				}
+				if (newTextures)
+					materialTable.bindTextures(material);
+				boundMaterial = material;
+			}
+			if (shader && runStart < mesh.subMeshes.size())
+				drawRun(mesh, runStart, (unsigned int)mesh.subMeshes.size() - runStart);
+		}
+	}
+
+	std::string directory;
 	json JSON;
 	std::vector<unsigned char> data;
 	std::vector<Mesh> meshes;
+	std::vector<unsigned int> drawNodes; // node of every sub-mesh in draw order, kept contiguous for the MVP batch
+	unsigned int firstTransform = 0;
+	bool skipDraw = false; // PrepareFrame left this frame's subset empty
+	bool failed = false;   // see FailLoad
+	unsigned int drawOrderVersion = 0; // buildDrawOrder runs
 	std::vector<Texture> texturesLoaded;
+	MaterialTable materialTable;
+	std::vector<unsigned int> materialFeatures; // shader features per material table entry
+
+	unsigned int drawMaterialBuffer = 0; // material per draw, in draw order
+	TextureArrayPool texturePool;
+
+	// loading work left, see LoadStep
+	struct LoadItem {
+		const char* name;
+		std::function<void()> run;
+		bool gl = false; // needs the GL thread, or has to wait for an item that does (see Prepare)
+	};
+	std::deque<LoadItem> work;
+	bool incremental = false;
+	std::string loadText; // scene.gltf between reading and parsing
+	LinearArena* decodeArena = nullptr; // from arenaPool(), while loading
+	std::vector<unsigned int> materialSources; // glTF material of every material table entry
+	std::map<unsigned int, unsigned int> materialLookup; // glTF material -> index in the material table
+	std::vector<unsigned int> drawMaterials; // material of every draw, what drawMaterialBuffer holds
+
+	// primitives gathered while loading, keyed by layout
+	std::vector<PrimitiveBatch> batches;
+	std::map<unsigned int, unsigned int> batchLookup;
+
+	// material slots waiting for their texture array
+	struct PooledSlot {
+		unsigned int material;
+		TextureSlot slot;
+		unsigned int entry;
+	};
+	std::vector<PooledSlot> pooledSlots;
+
+	void loadMesh(unsigned int indMesh, unsigned int node) {
+		json& primitives = JSON["meshes"][indMesh]["primitives"];
+		for (unsigned int p = 0; p < primitives.size(); p++) {
+			loadPrimitive(primitives[p], node);
+		}
+	}
+
+	void loadPrimitive(json& primitive, unsigned int node) {
+		// only triangle lists for now (4 is also the default mode)
+		if (primitive.value("mode", 4) != 4) {
+			std::cout << "WARNING::MODEL_LOADING: skipping primitive with unsupported mode " << primitive.value("mode", 4) << std::endl;
+			return;
+		}
 
-	void loadMesh(unsigned int indMesh, glm::mat4 matrix) {
 		// get accessor indices
-		unsigned int posAcc = JSON["meshes"][indMesh]["primitives"][0]["attributes"]["POSITION"];
-		unsigned int texAcc = JSON["meshes"][indMesh]["primitives"][0]["attributes"]["TEXCOORD_0"]; // what happens when I need more UVs?
-		unsigned int indAcc = JSON["meshes"][indMesh]["primitives"][0]["indices"];
-		unsigned int norAcc = JSON["meshes"][indMesh]["primitives"][0]["attributes"]["NORMAL"];
-		unsigned int matAcc = JSON["meshes"][indMesh]["primitives"][0].value("material", 0);
+		json& attributes = primitive["attributes"];
+		unsigned int posAcc = attributes["POSITION"];
+		unsigned int matAcc = primitive.value("material", 0);
+
+		// attributes this primitive actually has, primitives only merge if these match
+		unsigned int layout = LAYOUT_POSITION;
+		if (attributes.find("TEXCOORD_0") != attributes.end()) layout |= LAYOUT_TEXCOORD; // what happens when I need more UVs?
+		if (attributes.find("NORMAL") != attributes.end()) layout |= LAYOUT_NORMAL;
+		// glTF ignores tangents that come without normals
+		if ((layout & LAYOUT_NORMAL) && attributes.find("TANGENT") != attributes.end()) layout |= LAYOUT_TANGENT;
+
+		// decode straight into the arena, vertices are assembled once the batch sizes are known
+		LinearArena& arena = *decodeArena;
+		DecodedPrimitive decoded;
+		{
+			PROFILE_SCOPE("decode accessors");
+			decoded.positions = getAccessor<glm::vec3>(posAcc, arena);
+			if (layout & LAYOUT_TEXCOORD)
+				decoded.texCoords = getAccessor<glm::vec2>(attributes["TEXCOORD_0"], arena);
+			if (layout & LAYOUT_NORMAL)
+				decoded.normals = getAccessor<glm::vec3>(attributes["NORMAL"], arena);
+			if (layout & LAYOUT_TANGENT)
+				decoded.tangents = getAccessor<glm::vec4>(attributes["TANGENT"], arena);
+
+			// non-indexed primitives just draw their vertices in order
+			if (primitive.find("indices") != primitive.end()) {
+				decoded.indices = getIndices(primitive["indices"], arena);
+			}
+			else {
+				decoded.indices = arena.allocate<unsigned int>(decoded.positions.size);
+				for (unsigned int i = 0; i < decoded.indices.size; i++) {
+					decoded.indices[i] = i;
+				}
+			}
+		}
+		for (unsigned int index : decoded.indices) {
+			if (index >= decoded.positions.size) {
+				std::cout << "WARNING::MODEL_LOADING: skipping primitive with out of range index " << index << std::endl;
+				return;
+			}
+		}
+
+		// whatever is missing gets generated once the vertices are assembled, so every primitive ends up with the full
+		// layout. glTF wants flat normals when there are none: every triangle gets vertices of its own for that.
+		if (!(layout & LAYOUT_NORMAL) && !smoothGeneratedNormals())
+			unweld(decoded, arena);
+		decoded.generateNormals = !(layout & LAYOUT_NORMAL);
+		decoded.generateTangents = !(layout & LAYOUT_TANGENT);
+		layout |= LAYOUT_NORMAL | LAYOUT_TANGENT;
+		// indices are relative to the primitive's baseVertex, so only its own vertex count decides (whatever width the
+		// accessor had). Wide primitives get a mesh of their own instead of widening everything they'd be batched with.
+		if (decoded.positions.size > MAX_INDEX16_VERTICES)
+			layout |= LAYOUT_INDEX32;
+
+		// find (or start) the batch for this layout and append to it. Incremental loads upload a full batch right away
+		// (the item goes first in line) and start a new one.
+		unsigned int batchIndex;
+		auto found = batchLookup.find(layout);
+		if (found != batchLookup.end() && incremental && batches[found->second].vertexCount > 0
+			&& batches[found->second].vertexCount + decoded.positions.size > INCREMENTAL_BATCH_VERTICES) {
+			queueUpload(found->second, true);
+			batchLookup.erase(found);
+			found = batchLookup.end();
+		}
+		if (found == batchLookup.end()) {
+			batchIndex = (unsigned int)batches.size();
+			batchLookup[layout] = batchIndex;
+			PrimitiveBatch batch;
+			batch.layout = layout;
+			batches.push_back(batch);
+		}
+		else {
+			batchIndex = found->second;
+		}
+		PrimitiveBatch& batch = batches[batchIndex];
+
+		SubMesh sub;
+		sub.indexOffset = batch.indexCount;
+		sub.indexCount = (unsigned int)decoded.indices.size;
+		sub.baseVertex = (int)batch.vertexCount;
+		sub.node = node;
+		sub.material = materialIndex(matAcc);
+		sub.boundsMin = sub.boundsMax = decoded.positions.empty() ? glm::vec3(0.0f) : decoded.positions[0];
+		for (const glm::vec3& position : decoded.positions) {
+			sub.boundsMin = glm::min(sub.boundsMin, position);
+			sub.boundsMax = glm::max(sub.boundsMax, position);
+		}
+		batch.subMeshes.push_back(sub);
+		batch.primitives.push_back(decoded);
+		batch.vertexCount += (unsigned int)decoded.positions.size;
+		batch.indexCount += (unsigned int)decoded.indices.size;
+	}
+
+	// Table entry of a glTF material, added the first time a primitive uses it
+	unsigned int materialIndex(unsigned int materialID) {
+		auto found = materialLookup.find(materialID);
+		if (found != materialLookup.end())
+			return found->second;
+		unsigned int index = (unsigned int)materialSources.size();
+		materialLookup[materialID] = index;
+		materialSources.push_back(materialID);
+		return index;
+	}
+
+	// After the primitives are decoded: queue the upload of every batch that isn't queued yet, then the textures (one
+	// item per image, then one per texture array) and finally the textured materials
+	void queueMaterialWork() {
+		for (unsigned int i = 0; i < batches.size(); i++) {
+			if (!batches[i].queued)
+				queueUpload(i, false);
+		}
+		work.push_back({ "free decoded data", [this] {
+			// CPU copies aren't needed anymore
+			batches.clear();
+			batchLookup.clear();
+			arenaPool().release(decodeArena);
+			decodeArena = nullptr;
+		}, true });
+
+		// one item per image, each only gets loaded once. Streamed ones upload their mip tail right away.
+		bool streamed = textureStreamer().budget > 0;
+		std::vector<unsigned int> queued;
+		for (unsigned int source : materialSources) {
+			for (const TextureRef& ref : textureRefs(source)) {
+				if (std::find(queued.begin(), queued.end(), ref.texture) != queued.end())
+					continue;
+				queued.push_back(ref.texture);
+				work.push_back({ "load texture", [this, ref] { getTexture(ref.texture, ref.type); }, streamed });
+			}
+		}
+
+		// the arrays are only known once every texture is staged
+		work.push_back({ "plan texture arrays", [this] {
+			unsigned int arrays = texturePool.plan();
+			for (unsigned int i = 0; i < arrays; i++) {
+				work.push_back({ "upload texture array", [this] { texturePool.buildNext(); }, true });
+			}
+			work.push_back({ incremental ? "apply textures" : "build materials", [this] {
+				buildMaterials(true);
+				buildDrawOrder();
+			}, true });
+		}, true });
+	}
+
+	// Queue uploading batches[index], first in line (a batch that just filled up) or last. Incremental loads draw it
+	// (untextured) as soon as it's uploaded.
+	void queueUpload(unsigned int index, bool next) {
+		batches[index].queued = true;
+		LoadItem item = { "upload batch", [this, index] {
+			uploadBatch(batches[index]);
+			if (incremental) {
+				addMaterials();
+				buildDrawOrder((unsigned int)meshes.size() - 1);
+			}
+		}, true };
+		if (next)
+			work.push_front(item);
+		else
+			work.push_back(item);
+	}
+
+	// (Re)build the material table from materialSources. With textures, the texture arrays have to be built already
+	// (see TextureArrayPool::buildNext), pooled slots are filled in from them.
+	void buildMaterials(bool withTextures) {
+		{
+			PROFILE_SCOPE("load materials");
+			materialTable.materials.clear();
+			for (unsigned int i = 0; i < materialSources.size(); i++) {
+				materialTable.add(buildMaterial(materialSources[i], i, withTextures));
+			}
+		}
+
+		if (withTextures) {
+			for (const PooledSlot& pooled : pooledSlots) {
+				const TextureLayer& layer = texturePool.get(pooled.entry);
+				materialTable.materials[pooled.material].setArrayTexture(pooled.slot, layer.array, layer.layer, layer.rect, layer.atlas);
+			}
+			pooledSlots.clear();
+		}
+
+		materialTable.upload();
+		materialFeatures.clear();
+		for (const Material& material : materialTable.materials) {
+			materialFeatures.push_back(ShaderPermutations::featuresFor(material));
+		}
+	}
+
+	// Untextured table entries for materials primitives started using since the last call, while batches upload
+	void addMaterials() {
+		if (materialTable.materials.size() == materialSources.size())
+			return;
+		for (unsigned int i = (unsigned int)materialTable.materials.size(); i < materialSources.size(); i++) {
+			materialTable.add(buildMaterial(materialSources[i], i, false));
+			materialFeatures.push_back(ShaderPermutations::featuresFor(materialTable.materials.back()));
+		}
+		materialTable.upload();
+	}
+
+	// One Mesh for the batch, its decoded primitives stay in the arena until "free decoded data"
+	void uploadBatch(PrimitiveBatch& batch) {
+		// one vertex and index array per batch, filled in place. Primitives write disjoint ranges of them, so they
+		// are assembled (and get their normals and tangents generated) on the workers.
+		LinearArena& arena = *decodeArena;
+		Span<Vertex> vertices = arena.allocate<Vertex>(batch.vertexCount);
+		bool wide = (batch.layout & LAYOUT_INDEX32) != 0;
+		Span<uint32_t> indices32 = wide ? arena.allocate<uint32_t>(batch.indexCount) : Span<uint32_t>();
+		Span<uint16_t> indices16 = wide ? Span<uint16_t>() : arena.allocate<uint16_t>(batch.indexCount);
+		{
+			PROFILE_SCOPE("assemble vertices");
+			workerPool().parallelFor((unsigned int)batch.primitives.size(), 1, [&](unsigned int begin, unsigned int end) {
+				for (unsigned int p = begin; p < end; p++) {
+					const SubMesh& sub = batch.subMeshes[p];
+					const DecodedPrimitive& primitive = batch.primitives[p];
+					Vertex* out = vertices.data + sub.baseVertex;
+					assembleVertices(primitive, out);
+					if (wide)
+						std::copy(primitive.indices.begin(), primitive.indices.end(), indices32.data + sub.indexOffset);
+					else
+						std::transform(primitive.indices.begin(), primitive.indices.end(), indices16.data + sub.indexOffset, [](unsigned int index) { return (uint16_t)index; });
+					if (primitive.generateNormals || primitive.generateTangents) {
+						PROFILE_SCOPE("generate tangent space");
+						unsigned int vertexCount = (unsigned int)primitive.positions.size;
+						if (primitive.generateNormals)
+							generateNormals(out, vertexCount, primitive.indices.data, (unsigned int)primitive.indices.size);
+						if (primitive.generateTangents)
+							generateTangents(out, vertexCount, primitive.indices.data, (unsigned int)primitive.indices.size);
+					}
+				}
+			});
+		}
+		if (wide)
+			meshes.push_back(Mesh(vertices, indices32.data, indices32.size, GL_UNSIGNED_INT, batch.subMeshes, 0));
+		else
+			meshes.push_back(Mesh(vertices, indices16.data, indices16.size, GL_UNSIGNED_SHORT, batch.subMeshes, 0));
+		std::vector<DecodedPrimitive>().swap(batch.primitives);
+	}
+
+	/* Draw order is shader variant, then texture bindings, then material, so consecutive draws sharing a program and
+	textures can go out as one multi-draw. Redone whenever the materials change; meshes from firstMesh on are (re)sorted
+	and the ones before keep their draws, which is all a newly uploaded mesh needs. */
+	void buildDrawOrder(unsigned int firstMesh = 0) {
+		unsigned int keptDraws = 0;
+		for (unsigned int m = 0; m < firstMesh; m++) {
+			keptDraws += (unsigned int)meshes[m].subMeshes.size();
+		}
+		drawNodes.resize(keptDraws);
+		drawMaterials.resize(keptDraws);
+		for (unsigned int m = firstMesh; m < meshes.size(); m++) {
+			Mesh& mesh = meshes[m];
+			std::sort(mesh.subMeshes.begin(), mesh.subMeshes.end(), [this](const SubMesh& a, const SubMesh& b) {
+				if (materialFeatures[a.material] != materialFeatures[b.material])
+					return materialFeatures[a.material] < materialFeatures[b.material];
+				if (!materialTable.sameTextures(a.material, b.material))
+					return materialTable.texturesBefore(a.material, b.material);
+				if (a.material != b.material)
+					return a.material < b.material;
+				return a.indexOffset < b.indexOffset; // load order, so the result doesn't depend on the previous order
+			});
+
+			unsigned int firstDraw = (unsigned int)drawNodes.size();
+			for (const SubMesh& sub : mesh.subMeshes) {
+				drawNodes.push_back(sub.node);
+				drawMaterials.push_back(sub.material);
+			}
+			mesh.UploadDrawCommands(firstDraw);
+		}
+
+		// material of every draw, indexed by baseInstance in the shaders
+		if (drawMaterialBuffer == 0)
+			glGenBuffers(1, &drawMaterialBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawMaterialBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, drawMaterials.size() * sizeof(unsigned int), drawMaterials.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		drawOrderVersion++;
+	}
+
+	// Flatten the node tree into the transform hierarchy (breadth-first) and load the meshes hanging off it
+	void loadNodes() {
+		// start from the scene's root nodes, or node 0 if the file doesn't list any scenes
+		std::vector<unsigned int> roots;
+		if (JSON.find("scenes") != JSON.end()) {
+			unsigned int scene = JSON.value("scene", 0);
+			for (unsigned int i = 0; i < JSON["scenes"][scene]["nodes"].size(); i++) {
+				roots.push_back(JSON["scenes"][scene]["nodes"][i]);
+			}
+		}
+		else {
+			roots.push_back(0);
+		}
 
-		// use indices to get all components
-		std::vector<float> flPos = getFloats(posAcc);
-		std::vector<float> flTex = getFloats(texAcc);
-		std::vector<float> flNor = getFloats(norAcc);
-		std::vector<Texture> textures = getTextures(matAcc);
+		// queue of (glTF node, parent index in the hierarchy)
+		std::vector<std::pair<unsigned int, int>> queue;
+		for (unsigned int root : roots) {
+			queue.push_back({ root, -1 });
+		}
 
-		// group components
-		std::vector<glm::vec3> positions = groupFloatsVec3(flPos);
-		std::vector<glm::vec2> texCoords = groupFloatsVec2(flTex);
-		std::vector<glm::vec3> normals = groupFloatsVec3(flNor);
+		for (unsigned int head = 0; head < queue.size(); head++) {
+			unsigned int indNode = queue[head].first;
+			unsigned int nodeIndex = readNode(indNode, queue[head].second);
 
-		// combine into Mesh
-		std::vector<unsigned int> indices = getIndices(indAcc);
-		std::vector<Vertex> vertices = assembleVertices(positions, texCoords, normals);
+			json& node = JSON["nodes"][indNode];
+			// load mesh if it exists
+			if (node.find("mesh") != node.end()) {
+				unsigned int mesh = node["mesh"];
+				work.push_back({ "load mesh", [this, mesh, nodeIndex] { loadMesh(mesh, nodeIndex); } });
+			}
 
-		// make meshes
-		meshes.push_back(Mesh(vertices, indices, textures, matrix));
+			// queue children if they exist
+			if (node.find("children") != node.end()) {
+				for (unsigned int i = 0; i < node["children"].size(); i++) {
+					queue.push_back({ node["children"][i], (int)nodeIndex });
+				}
+			}
+		}
 	}
 
-	void traverseNode(unsigned int nextNode, glm::mat4 matrix = glm::mat4(1.0f)) {
+	unsigned int readNode(unsigned int indNode, int parentIndex) {
 		// current node
-		json node = JSON["nodes"][nextNode];
+		json& node = JSON["nodes"][indNode];
 
 		// get matrix if it exists
 		glm::mat4 matNode = glm::mat4(1.0f);
@@ -116,29 +765,8 @@ private:
 			quaternion = glm::make_quat(values);
 		}
 
-		// initialize matrices
-		glm::mat4 trans = glm::mat4(1.0f);
-		glm::mat4 sca = glm::mat4(1.0f);
-
-		// apply transformations
-		trans = glm::translate(trans, translation);
-		glm::mat4 rot = glm::mat4_cast(quaternion);
-		sca = glm::scale(sca, scale);
-
-
-		glm::mat4 matNextNode = trans * rot * sca * matrix * matNode;
-
-		// load mesh if it exists
-		if (node.find("mesh") != node.end()) {
-			loadMesh(node["mesh"], matNextNode);
-		}
-
-		// traverse through children if they exist
-		if (node.find("children") != node.end()) {
-			for (unsigned int i = 0; i < node["children"].size(); i++) {
-				traverseNode(node["children"][i], matNextNode);
-			}
-		}
+		// world matrices are parent * local (T * R * S * matrix) and get computed in TransformHierarchy::update
+		return transforms.addNode(parentIndex, node.value("name", ""), translation, quaternion, scale, matNode);
 	}
 
 	std::vector<unsigned char> getData() {
@@ -154,20 +782,37 @@ private:
 		return data;
 	}
 
-	std::vector<float> getFloats(unsigned int accessorID) {
-		std::vector<float> floats;
-
-		// Get properties from accessor
-		unsigned int buffViewInd = JSON["accessors"][accessorID].value("bufferView", 0);
-		unsigned int byteOffset = JSON["accessors"][accessorID].value("byteOffset", 0);
-		unsigned int count = JSON["accessors"][accessorID]["count"];
-		std::string type = JSON["accessors"][accessorID]["type"];
+	/* Byte offset of an accessor's first element in data, checked to hold count tightly packed elements of
+	elementSize bytes. Only what getData() loads can be read: the first buffer, and no interleaved (strided) views. */
+	size_t accessorOffset(const json& accessor, size_t count, size_t elementSize) {
+		if (accessor.find("bufferView") == accessor.end())
+			throw std::invalid_argument("INVALID ACCESSOR: has no bufferView\n");
+		const json& bufferView = JSON["bufferViews"][accessor["bufferView"].get<unsigned int>()];
+		if (bufferView.value("buffer", 0u) != 0)
+			throw std::invalid_argument("INVALID ACCESSOR: only the first buffer is loaded\n");
+		size_t stride = bufferView.value("byteStride", (size_t)0);
+		if (stride != 0 && stride != elementSize)
+			throw std::invalid_argument("INVALID ACCESSOR: interleaved (strided) buffer views aren't supported\n");
+
+		// 64-bit sums, so a huge count or offset can't wrap around the checks
+		size_t accessorStart = accessor.value("byteOffset", (size_t)0);
+		size_t byteLength = count * elementSize;
+		size_t viewLength = bufferView.value("byteLength", (size_t)0);
+		if (accessorStart + byteLength > viewLength)
+			throw std::invalid_argument("INVALID ACCESSOR: reads past the end of its buffer view\n");
+		size_t byteOffset = bufferView.value("byteOffset", (size_t)0) + accessorStart;
+		if (byteOffset + byteLength > data.size())
+			throw std::invalid_argument("INVALID ACCESSOR: reads past the end of the buffer\n");
+		return byteOffset;
+	}
 
-		// Get properties from the bufferview if it exists
-		if (buffViewInd != 0) {
-			json bufferView = JSON["bufferViews"][buffViewInd];
-			byteOffset += bufferView["byteOffset"];
-		}
+	// Float accessor (SCALAR, VEC2, VEC3 or VEC4 to match T) copied out of the buffer into the arena. One without a
+	// bufferView is all zeros, as glTF defines it (sparse substitutions aren't supported).
+	template <typename T>
+	Span<T> getAccessor(unsigned int accessorID, LinearArena& arena) {
+		const json& accessor = JSON["accessors"][accessorID];
+		unsigned int count = accessor["count"];
+		const std::string& type = accessor["type"].get_ref<const std::string&>();
 
 		// Interpret type
 		unsigned int dim;
@@ -176,66 +821,69 @@ private:
 		else if (type == "VEC3") dim = 3;
 		else if (type == "VEC4") dim = 4;
 		else throw std::invalid_argument("INVALID TYPE: must be scalar, vec2, vec3, or vec4\n");
-
-		// Get bytes from data
-		unsigned int length = count * 4 * dim;
-		for (int i = byteOffset; i < byteOffset + length; i += 4) {
-			unsigned char bytes[] = { data[i], data[i + 1], data[i + 2], data[i + 3] }; // little-endian?
-			float val;
-			std::memcpy(&val, bytes, sizeof(float));
-			floats.push_back(val);
+		if (dim * sizeof(float) != sizeof(T))
+			throw std::invalid_argument("INVALID TYPE: accessor doesn't have the expected number of components\n");
+		// componentTypes: 5126 -> float, the integer ones (normalized or not) would need converting
+		if (accessor.value("componentType", 0u) != 5126 || accessor.value("normalized", false))
+			throw std::invalid_argument("INVALID TYPE: attribute must be float\n");
+		if (accessor.find("sparse") != accessor.end())
+			throw std::invalid_argument("INVALID ACCESSOR: sparse accessors aren't supported\n");
+
+		if (accessor.find("bufferView") == accessor.end()) {
+			Span<T> values = arena.allocate<T>(count);
+			if (count > 0)
+				std::memset((void*)values.data, 0, (size_t)count * sizeof(T));
+			return values;
 		}
-
-		return floats;
+		// Checked before allocating, so a bogus count is rejected instead of sizing the arena
+		size_t byteOffset = accessorOffset(accessor, count, sizeof(T));
+		Span<T> values = arena.allocate<T>(count);
+		// Get bytes from data, glTF buffers are little-endian like everything we run on
+		if (count > 0)
+			std::memcpy(values.data, &data[byteOffset], (size_t)count * sizeof(T));
+		return values;
 	}
 
-	std::vector<unsigned int> getIndices(unsigned int accessorID) {
-		std::vector<unsigned int> indices;
-
-		// Get properties from accessor
-		unsigned int buffViewInd = JSON["accessors"][accessorID].value("bufferView", 0);
-		unsigned int byteOffset = JSON["accessors"][accessorID].value("byteOffset", 0);
-		unsigned int count = JSON["accessors"][accessorID]["count"];
-
-		// componentTypes can be: 5125 -> uint; 5123 -> ushort; 5122 -> short
-		unsigned int type = JSON["accessors"][accessorID]["componentType"];
-
-		// Get properties from the bufferview if it exists
-		if (buffViewInd != 0) {
-			json bufferView = JSON["bufferViews"][buffViewInd];
-			byteOffset += bufferView["byteOffset"];
-		}
-
+	// Decoded to 32 bits whatever the accessor's width, the narrowest width that fits is picked per primitive when the
+	// mesh gets built (see LAYOUT_INDEX32)
+	Span<unsigned int> getIndices(unsigned int accessorID, LinearArena& arena) {
+		const json& accessor = JSON["accessors"][accessorID];
+		unsigned int count = accessor["count"];
+
+		// componentTypes can be: 5125 -> uint; 5123 -> ushort; 5122 -> short; 5121 -> ubyte
+		unsigned int type = accessor["componentType"];
+		unsigned int size = type == 5125 ? 4 : type == 5121 ? 1 : 2;
+		if (type != 5125 && type != 5123 && type != 5122 && type != 5121)
+			throw std::invalid_argument("INVALID TYPE: must be uint, ushort, short or ubyte\n");
+
+		if (accessor.find("sparse") != accessor.end())
+			throw std::invalid_argument("INVALID ACCESSOR: sparse accessors aren't supported\n");
+		size_t byteOffset = accessorOffset(accessor, count, size);
+		Span<unsigned int> indices = arena.allocate<unsigned int>(count);
+		const unsigned char* bytes = count > 0 ? &data[byteOffset] : nullptr;
 		switch (type) {
 		case 5125: // unsigned int 
-			for (int i = byteOffset; i < byteOffset + count * 4; i += 4)
-			{
-				unsigned char bytes[] = { data[i], data[i + 1], data[i + 2], data[i + 3] }; // little-endian?
-				unsigned int val;
-				std::memcpy(&val, bytes, sizeof(unsigned int));
-				indices.push_back(val);
-			}
+			if (count > 0)
+				std::memcpy(indices.data, bytes, count * sizeof(unsigned int));
 			break;
 		case 5123: // unsigned short
-			for (int i = byteOffset; i < byteOffset + count * 2; i += 2)
-			{
-				unsigned char bytes[] = { data[i], data[i + 1] };
+			for (unsigned int i = 0; i < count; i++) {
 				unsigned short val;
-				std::memcpy(&val, bytes, sizeof(unsigned short));
-				indices.push_back(val);
+				std::memcpy(&val, bytes + i * 2, sizeof(unsigned short));
+				indices[i] = val;
 			}
 			break;
 		case 5122: // short
-			for (int i = byteOffset; i < byteOffset + count * 2; i += 2)
-			{
-				unsigned char bytes[] = { data[i], data[i + 1] };
+			for (unsigned int i = 0; i < count; i++) {
 				short val;
-				std::memcpy(&val, bytes, sizeof(short));
-				indices.push_back(val);
+				std::memcpy(&val, bytes + i * 2, sizeof(short));
+				indices[i] = val;
 			}
 			break;
-		default:
-			throw std::invalid_argument("INVALID TYPE: must be uint, ushort, or short\n");
+		case 5121: // unsigned byte, GPUs would mostly convert these on the fly so they end up 16 bits wide
+			for (unsigned int i = 0; i < count; i++) {
+				indices[i] = bytes[i];
+			}
 			break;
 		}
 
@@ -243,55 +891,116 @@ private:
 	}
 
 	/* TODO: Cover more cases!
-	Very incomplete function, only getting base color texture, but can easily expand to also allow for other textures
-	(e.g. normal, specular), as well as different TEXCOORD mappings. Also where PBR information is stored. Doesn't make 
-	sense to make this too robust right now, but can easily be improved in the future. */
-	std::vector<Texture> getTextures(unsigned int accessorID) {
-		// store textures/texture info
-		std::vector<TexToLoad> toLoad;
-		std::vector<Texture> textures;
-
-		// Get Texture IDs
-		// base color texture is stored in PBR for some reason
-		unsigned int baseColorID = JSON["materials"][accessorID]["pbrMetallicRoughness"]["baseColorTexture"]["index"];
-		TexToLoad baseColor;
-		baseColor.texID = baseColorID;
-		baseColor.type = "diffuse";
-		toLoad.push_back(baseColor);
-
-		// TODO: Add more potential texture types
-
-		unsigned int pathID;
-		unsigned int sampID;
-		for (TexToLoad tex : toLoad) { // right now this loop is silly because we're only retrieving one texture per mesh
-			// get image path
-			unsigned int pathID = JSON["textures"][tex.texID]["source"];
-			int sampID = JSON["textures"][tex.texID].value("sampler", -1);
-			std::string path = this->directory + JSON["images"][pathID].value("uri", ""); // not sure why this is preventing from crashing
-			//const char* path = pathStr.c_str();
-
-			// check if texture is already loaded
-			bool skip = false;
-			for (Texture texture : texturesLoaded) {
-				if (std::strcmp(path.data(), texture.filepath.data()) == 0) {
-					textures.push_back(texture);
-					skip = true;
-					break;
+	Reads the metallic-roughness PBR factors and the five standard textures, but only TEXCOORD_0 mappings and none of the
+	KHR_ material extensions. */
+	// materialIndex: where the material will go in the material table. Without textures only the factors are set.
+	Material buildMaterial(unsigned int materialID, unsigned int materialIndex, bool withTextures) {
+		Material material;
+		if (JSON.find("materials") == JSON.end() || materialID >= JSON["materials"].size()) {
+			material.name = "default";
+			return material;
+		}
+
+		json& mat = JSON["materials"][materialID];
+		material.name = mat.value("name", "");
+		material.params.alphaCutoff = mat.value("alphaCutoff", 0.5f);
+		material.alphaTest = mat.value("alphaMode", "OPAQUE") == "MASK";
+
+		// base color and metallic/roughness are stored in PBR for some reason
+		if (mat.find("pbrMetallicRoughness") != mat.end()) {
+			json& pbr = mat["pbrMetallicRoughness"];
+			if (pbr.find("baseColorFactor") != pbr.end()) {
+				float values[4];
+				for (unsigned int i = 0; i < 4; i++) {
+					values[i] = pbr["baseColorFactor"][i];
 				}
+				material.params.baseColorFactor = glm::make_vec4(values);
 			}
-			if (!skip) { // load it if not
-				Texture texture;
-				texture.id = loadTexture(path.c_str(), sampID);
-				texture.filepath = path;
-				texture.type = "diffuse";
-				texturesLoaded.push_back(texture);
-				textures.push_back(texture);
+			material.params.metallicFactor = pbr.value("metallicFactor", 1.0f);
+			material.params.roughnessFactor = pbr.value("roughnessFactor", 1.0f);
+		}
+		if (mat.find("normalTexture") != mat.end())
+			material.params.normalScale = mat["normalTexture"].value("scale", 1.0f);
+		if (mat.find("emissiveFactor") != mat.end()) {
+			float values[3];
+			for (unsigned int i = 0; i < 3; i++) {
+				values[i] = mat["emissiveFactor"][i];
+			}
+			material.params.emissiveFactor = glm::vec4(glm::make_vec3(values), 0.0f);
+		}
+
+		if (withTextures) {
+			for (const TextureRef& ref : textureRefs(materialID)) {
+				setTexture(material, materialIndex, ref.slot, ref.texture, ref.type);
 			}
 		}
-		return textures;
+		return material;
 	}
 
-	unsigned int loadTexture(const char* path, int sampID) {
+	struct TextureRef {
+		TextureSlot slot;
+		unsigned int texture; // glTF texture index
+		const char* type;
+	};
+
+	// The five standard textures a glTF material references
+	std::vector<TextureRef> textureRefs(unsigned int materialID) {
+		std::vector<TextureRef> refs;
+		if (JSON.find("materials") == JSON.end() || materialID >= JSON["materials"].size())
+			return refs;
+
+		json& mat = JSON["materials"][materialID];
+		if (mat.find("pbrMetallicRoughness") != mat.end()) {
+			json& pbr = mat["pbrMetallicRoughness"];
+			if (pbr.find("baseColorTexture") != pbr.end())
+				refs.push_back({ SLOT_BASE_COLOR, pbr["baseColorTexture"]["index"], "diffuse" });
+			if (pbr.find("metallicRoughnessTexture") != pbr.end())
+				refs.push_back({ SLOT_METALLIC_ROUGHNESS, pbr["metallicRoughnessTexture"]["index"], "metallicRoughness" });
+		}
+		if (mat.find("normalTexture") != mat.end())
+			refs.push_back({ SLOT_NORMAL, mat["normalTexture"]["index"], "normal" });
+		if (mat.find("occlusionTexture") != mat.end())
+			refs.push_back({ SLOT_OCCLUSION, mat["occlusionTexture"]["index"], "occlusion" });
+		if (mat.find("emissiveTexture") != mat.end())
+			refs.push_back({ SLOT_EMISSIVE, mat["emissiveTexture"]["index"], "emissive" });
+		return refs;
+	}
+
+	// GL texture for a glTF texture index, each image only gets loaded once
+	Texture getTexture(unsigned int texID, const char* type) {
+		// get image path
+		unsigned int pathID = JSON["textures"][texID]["source"];
+		int sampID = JSON["textures"][texID].value("sampler", -1);
+		std::string path = this->directory + JSON["images"][pathID].value("uri", ""); // not sure why this is preventing from crashing
+
+		// check if texture is already loaded
+		for (const Texture& texture : texturesLoaded) {
+			if (texture.filepath == path) {
+				return texture;
+			}
+		}
+
+		// load it if not
+		Texture texture;
+		texture.id = 0;
+		loadTexture(path.c_str(), sampID, texture);
+		texture.filepath = path;
+		texture.type = type;
+		texturesLoaded.push_back(texture);
+		return texture;
+	}
+
+	// Pooled textures only get their array and layer in buildMaterials, so their slots are filled in there
+	void setTexture(Material& material, unsigned int materialIndex, TextureSlot slot, unsigned int texID, const char* type) {
+		Texture texture = getTexture(texID, type);
+		if (texture.poolEntry >= 0)
+			pooledSlots.push_back({ materialIndex, slot, (unsigned int)texture.poolEntry });
+		else
+			material.setTexture(slot, texture.streamed >= 0 ? materialTable.streamed[texture.streamed] : texture.id);
+	}
+
+	// Fills in texture.id for streamed textures, texture.poolEntry for pooled ones (neither if loading failed)
+	void loadTexture(const char* path, int sampID, Texture& texture) {
 		GLenum magFilter;
 		GLenum minFilter;
 		GLenum WrapS;
@@ -382,63 +1091,71 @@ private:
 			WrapT = GL_REPEAT;
 		}
 
-		// generate texture
-		unsigned int ID;
-		glGenTextures(1, &ID);
+		// prefer the Model Maker's cooked version: block compressed with its mips already built. With a texture budget
+		// it's streamed (only the mip tail now, the rest once it gets close enough to need it)
+		std::string cookedPath = std::string(path) + ".ktx2";
+		if (textureStreamer().budget > 0) {
+			texture.id = textureStreamer().add(cookedPath, WrapS, WrapT, minFilter, magFilter);
+			if (texture.id != 0) {
+				texture.streamed = (int)materialTable.streamed.size();
+				materialTable.streamed.push_back(texture.id);
+				return;
+			}
+		}
+
+		// everything else becomes a layer of a texture array (or an atlas entry), see TextureArrays.h
+		unsigned int entry;
+		Ktx2File cooked;
+		if (cooked.open(cookedPath) && texturePool.stage(cooked, WrapS, WrapT, minFilter, magFilter, entry)) {
+			texture.poolEntry = (int)entry;
+			return;
+		}
 
 		//stbi_set_flip_vertically_on_load(true); 
 
-		// retrieve data
+		// retrieve data, always as RGBA so textures of the same size share arrays whatever their channel count
 		int width, height, nrChannels;
-		unsigned char* data = stbi_load(path, &width, &height, &nrChannels, 0);
+		unsigned char* data;
+		{
+			PROFILE_SCOPE("decode image");
+			data = stbi_load(path, &width, &height, &nrChannels, 4);
+		}
 		if (data) {
-			GLint channels;
-			switch (nrChannels) { // retrieve number of channels
-			case 1:
-				channels = GL_RED;
-				break;
-			case 3:
-				channels = GL_RGB;
-				break;
-			case 4:
-				channels = GL_RGBA;
-				break;
-			default:
-				throw std::invalid_argument("INVALID NUMBER OF IMAGE CHANNELS: must be 1, 3, or 4\n");
-				break;
-			}
-
-			// bind texture
-			glBindTexture(GL_TEXTURE_2D, ID);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, channels, GL_UNSIGNED_BYTE, data);
-			glGenerateMipmap(GL_TEXTURE_2D);
-
-			// set texture parameters
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, WrapS);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, WrapT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+			texture.poolEntry = (int)texturePool.stage(data, width, height, WrapS, WrapT, minFilter, magFilter);
 		}
 		else {
 			std::cout << "Failed to load texture at path " << path << std::endl;
 		}
 		// free loaded image
 		stbi_image_free(data); // free image memory
-		return ID;
 	}
 
-	std::vector<Vertex> assembleVertices(std::vector<glm::vec3> position, std::vector < glm::vec2> TexCoords, std::vector<glm::vec3> normal) {
-		std::vector<Vertex> vertices;
-		Vertex vertex;
-
-		for (int i = 0; i < position.size(); i++) {
-			vertex.Position = position[i];
-			vertex.TexCoords = TexCoords[i];
-			vertex.Normal = normal[i];
-			vertices.push_back(vertex);
+	// Interleave a decoded primitive into out (one Vertex per position), missing attributes are zeroed
+	void assembleVertices(const DecodedPrimitive& primitive, Vertex* out) {
+		for (size_t i = 0; i < primitive.positions.size; i++) {
+			Vertex& vertex = out[i];
+			vertex.Position = primitive.positions[i];
+			vertex.TexCoords = i < primitive.texCoords.size ? primitive.texCoords[i] : glm::vec2(0.0f);
+			vertex.Normal = i < primitive.normals.size ? primitive.normals[i] : glm::vec3(0.0f);
+			vertex.Tangent = i < primitive.tangents.size ? primitive.tangents[i] : glm::vec4(0.0f);
 		}
+	}
 
-		return vertices;
+	// Gives every index a vertex of its own (for flat normals), indices become 0, 1, 2...
+	static void unweld(DecodedPrimitive& primitive, LinearArena& arena) {
+		Span<glm::vec3> positions = arena.allocate<glm::vec3>(primitive.indices.size);
+		Span<glm::vec2> texCoords;
+		if (!primitive.texCoords.empty())
+			texCoords = arena.allocate<glm::vec2>(primitive.indices.size);
+		for (unsigned int i = 0; i < primitive.indices.size; i++) {
+			unsigned int index = primitive.indices[i];
+			positions[i] = primitive.positions[index];
+			if (!texCoords.empty())
+				texCoords[i] = index < primitive.texCoords.size ? primitive.texCoords[index] : glm::vec2(0.0f);
+			primitive.indices[i] = i;
+		}
+		primitive.positions = positions;
+		primitive.texCoords = texCoords;
 	}
 
 	std::string readFile(const char *file) {
@@ -456,28 +1173,9 @@ private:
 			// stream -> string
 			return tstream.str();
 		}
-		catch (std::ifstream::failure e) {
-			std::cout << "ERROR::MODEL_LOADING::FILE_NOT_SUCCESSFULLY_READ\n" << file << std::endl;
-		}
-	}
-
-	std::vector<glm::vec2> groupFloatsVec2(std::vector<float> floats) {
-		std::vector<glm::vec2> vectors;
-
-		for (int i = 0; i < floats.size(); i += 2) {
-			vectors.push_back(glm::vec2(floats[i], floats[i + 1]));
+		catch (const std::ifstream::failure&) {
+			// the load can't go on without it, whoever runs the load reports it (see LoadScheduler, AssetManager)
+			throw std::runtime_error(std::string("FILE_NOT_SUCCESSFULLY_READ ") + file);
 		}
-		
-		return vectors;
-	}
-
-	std::vector<glm::vec3> groupFloatsVec3(std::vector<float> floats) {
-		std::vector<glm::vec3> vectors;
-
-		for (int i = 0; i < floats.size(); i += 3) {
-			vectors.push_back(glm::vec3(floats[i], floats[i + 1], floats[i + 2]));
-		}
-
-		return vectors;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,300 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+
+// events kept per thread (power of two), older ones get overwritten
+const unsigned int PROFILE_EVENTS_PER_THREAD = 1 << 16;
+// GL_TIME_ELAPSED scopes per frame, more are ignored
+const unsigned int PROFILE_GPU_SCOPES_PER_FRAME = 64;
+
+// name has to outlive the profiler (string literals), times are ns since the profiler started
+struct ProfileEvent
+{
+	const char* name;
+	uint64_t begin;
+	uint64_t end;
+};
+
+/* Events of one thread. Only the owning thread writes, so pushing is a store plus a release of the head; exporting
+from another thread copies the ring and throws away anything the owner might have overwritten meanwhile. */
+struct ThreadTrace
+{
+	unsigned int id;
+	std::string name;
+	std::unique_ptr<ProfileEvent[]> events{ new ProfileEvent[PROFILE_EVENTS_PER_THREAD] };
+	std::atomic<uint64_t> head{ 0 };
+
+	void push(const char* name, uint64_t begin, uint64_t end) {
+		uint64_t h = head.load(std::memory_order_relaxed);
+		events[h & (PROFILE_EVENTS_PER_THREAD - 1)] = { name, begin, end };
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	std::vector<ProfileEvent> snapshot() const {
+		uint64_t before = head.load(std::memory_order_acquire);
+		uint64_t first = before > PROFILE_EVENTS_PER_THREAD ? before - PROFILE_EVENTS_PER_THREAD : 0;
+		std::vector<ProfileEvent> copy;
+		for (uint64_t i = first; i < before; i++) {
+			copy.push_back(events[i & (PROFILE_EVENTS_PER_THREAD - 1)]);
+		}
+		// whatever got lapped while copying can be torn
+		uint64_t after = head.load(std::memory_order_acquire);
+		uint64_t lapped = after > PROFILE_EVENTS_PER_THREAD ? after - PROFILE_EVENTS_PER_THREAD : 0;
+		if (lapped > first)
+			copy.erase(copy.begin(), copy.begin() + (size_t)std::min<uint64_t>(lapped - first, copy.size()));
+		return copy;
+	}
+};
+
+/* CPU and GPU frame profiler, off unless LEARNOPENGL_PROFILE is set (to the trace file written at exit) or it's
+toggled at runtime. Disabled scopes cost one relaxed load and a branch.
+
+CPU: PROFILE_SCOPE("name") times the enclosing block into the calling thread's ring.
+GPU: PROFILE_GPU_SCOPE("name") wraps a render pass in a GL_TIME_ELAPSED query. Queries are double buffered, a frame's
+are read when its half comes around again (two beginFrame()s later) and only if already available, so nothing waits
+on the GPU. Elapsed queries can't nest, keep these to whole passes. GPU events go on their own track, laid out one
+after another from the CPU time their pass was submitted (GL_TIME_ELAPSED only gives durations).
+
+exportTrace writes everything still in the rings as Chrome trace JSON (chrome://tracing, ui.perfetto.dev). */
+class Profiler
+{
+public:
+	std::string tracePath; // from LEARNOPENGL_PROFILE, written by shutdown()
+	unsigned int droppedGpuScopes = 0; // not available two frames later, or over PROFILE_GPU_SCOPES_PER_FRAME
+
+	Profiler() {
+		const char* env = std::getenv("LEARNOPENGL_PROFILE");
+		if (env && *env) {
+			tracePath = env;
+			enabled.store(true);
+		}
+		gpuTrace.id = 0;
+		gpuTrace.name = "GPU";
+	}
+
+	bool isEnabled() const {
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	void setEnabled(bool on) {
+		gpuCount[0] = gpuCount[1] = 0; // anything pending belongs to the last capture
+		enabled.store(on);
+	}
+
+	// ns since the profiler started, never 0 (ProfileScope uses 0 for "wasn't enabled")
+	uint64_t now() const {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count() + 1;
+	}
+
+	void record(const char* name, uint64_t begin, uint64_t end) {
+		thread().push(name, begin, end);
+	}
+
+	void setThreadName(const std::string& name) {
+		thread().name = name;
+	}
+
+	// Once per frame on the GL thread, before any GPU scope of the frame
+	void beginFrame() {
+		if (!isEnabled())
+			return;
+		if (queries[0][0] == 0)
+			glGenQueries(2 * PROFILE_GPU_SCOPES_PER_FRAME, &queries[0][0]);
+		slot ^= 1;
+		resolve(slot); // last use of this slot was two frames ago
+	}
+
+	// Index to hand to endGpu, -1 if nothing was started
+	int beginGpu(const char* name) {
+		if (!isEnabled() || queries[0][0] == 0)
+			return -1;
+		if (gpuCount[slot] == PROFILE_GPU_SCOPES_PER_FRAME) {
+			droppedGpuScopes++;
+			return -1;
+		}
+		unsigned int index = gpuCount[slot]++;
+		gpuScopes[slot][index] = { name, now(), 0 };
+		glBeginQuery(GL_TIME_ELAPSED, queries[slot][index]);
+		return (int)index;
+	}
+
+	void endGpu(int index) {
+		if (index >= 0)
+			glEndQuery(GL_TIME_ELAPSED);
+	}
+
+	// Chrome trace JSON of everything still buffered
+	bool exportTrace(const std::string& path) {
+		std::ofstream file(path, std::ios::trunc);
+		if (!file) {
+			std::cout << "ERROR::PROFILER::COULD_NOT_WRITE " << path << std::endl;
+			return false;
+		}
+
+		std::vector<const ThreadTrace*> tracks;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (const std::unique_ptr<ThreadTrace>& trace : threads) {
+				tracks.push_back(trace.get());
+			}
+		}
+		tracks.push_back(&gpuTrace);
+
+		unsigned int eventCount = 0;
+		file << "{\"traceEvents\":[\n";
+		bool first = true;
+		for (const ThreadTrace* track : tracks) {
+			file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << track->id
+				<< ",\"args\":{\"name\":\"" << track->name << "\"}}";
+			first = false;
+			for (const ProfileEvent& event : track->snapshot()) {
+				file << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << track->id
+					<< ",\"ts\":" << event.begin / 1000.0 << ",\"dur\":" << (event.end - event.begin) / 1000.0 << "}";
+				eventCount++;
+			}
+		}
+		file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+		std::cout << "PROFILER: " << eventCount << " events written to " << path << std::endl;
+		return (bool)file;
+	}
+
+	// Every CPU event still buffered, from all threads
+	std::vector<ProfileEvent> cpuEvents() {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<ProfileEvent> events;
+		for (const std::unique_ptr<ThreadTrace>& trace : threads) {
+			std::vector<ProfileEvent> snapshot = trace->snapshot();
+			events.insert(events.end(), snapshot.begin(), snapshot.end());
+		}
+		return events;
+	}
+
+	// At exit: write the trace LEARNOPENGL_PROFILE asked for
+	void shutdown() {
+		if (isEnabled() && !tracePath.empty())
+			exportTrace(tracePath);
+	}
+
+private:
+	std::atomic<bool> enabled{ false };
+	std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+	std::mutex mutex; // only taken when a thread records for the first time, and by exportTrace
+	std::vector<std::unique_ptr<ThreadTrace>> threads;
+
+	ThreadTrace gpuTrace; // written on the GL thread only
+	unsigned int queries[2][PROFILE_GPU_SCOPES_PER_FRAME] = {};
+	ProfileEvent gpuScopes[2][PROFILE_GPU_SCOPES_PER_FRAME];
+	unsigned int gpuCount[2] = { 0, 0 };
+	unsigned int slot = 0;
+	uint64_t gpuCursor = 0; // end of the last GPU event
+
+	ThreadTrace& thread() {
+		thread_local ThreadTrace* local = nullptr;
+		if (!local) {
+			std::lock_guard<std::mutex> lock(mutex);
+			threads.push_back(std::make_unique<ThreadTrace>());
+			local = threads.back().get();
+			local->id = (unsigned int)threads.size();
+			local->name = "thread " + std::to_string(local->id);
+		}
+		return *local;
+	}
+
+	void resolve(unsigned int s) {
+		for (unsigned int i = 0; i < gpuCount[s]; i++) {
+			GLint available = 0;
+			glGetQueryObjectiv(queries[s][i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				droppedGpuScopes++;
+				continue;
+			}
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(queries[s][i], GL_QUERY_RESULT, &elapsed);
+			uint64_t begin = std::max(gpuScopes[s][i].begin, gpuCursor);
+			gpuCursor = begin + elapsed;
+			gpuTrace.push(gpuScopes[s][i].name, begin, gpuCursor);
+		}
+		gpuCount[s] = 0;
+	}
+};
+
+inline Profiler& profiler() {
+	static Profiler instance;
+	return instance;
+}
+
+// What the draws of the current frame submitted, counted by Mesh on the GL thread. Whoever measures frames resets it.
+struct RenderCounters
+{
+	uint64_t calls = 0;     // glMultiDrawElementsIndirect calls
+	uint64_t draws = 0;     // indirect commands in them
+	uint64_t triangles = 0; // instances included
+	uint64_t shadowPasses = 0; // shadow map layers drawn into (included above)
+
+	void reset() {
+		calls = draws = triangles = shadowPasses = 0;
+	}
+};
+
+inline RenderCounters& renderCounters() {
+	static RenderCounters instance;
+	return instance;
+}
+
+// Times the enclosing scope on the calling thread
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* name) : name(name), begin(profiler().isEnabled() ? profiler().now() : 0) {}
+
+	~ProfileScope() {
+		if (begin != 0)
+			profiler().record(name, begin, profiler().now());
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	const char* name;
+	uint64_t begin;
+};
+
+// Times the enclosing render pass on the GPU, GL thread only and not nested
+class GpuProfileScope
+{
+public:
+	explicit GpuProfileScope(const char* name) : index(profiler().beginGpu(name)) {}
+
+	~GpuProfileScope() {
+		profiler().endGpu(index);
+	}
+
+	GpuProfileScope(const GpuProfileScope&) = delete;
+	GpuProfileScope& operator=(const GpuProfileScope&) = delete;
+
+private:
+	int index;
+};
+
+// LEARNOPENGL_NO_PROFILER compiles every marker out
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#ifdef LEARNOPENGL_NO_PROFILER
+#define PROFILE_SCOPE(name)
+#define PROFILE_GPU_SCOPE(name)
+#else
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
+#endif
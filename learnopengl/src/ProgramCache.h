@@ -0,0 +1,173 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <filesystem>
+#include <thread>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "Hash.h"
+
+const char PROGRAM_CACHE_MAGIC[8] = { 'L', 'O', 'G', 'L', 'P', 'B', 'I', 'N' };
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+// header in front of every cached binary
+struct ProgramCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t format; // GLenum from glGetProgramBinary
+	uint64_t key;
+	uint64_t size;
+};
+
+/* On-disk cache of linked program binaries (glGetProgramBinary/glProgramBinary). Entries are keyed by a hash of the
+shader sources, defines and the driver's vendor/renderer/version strings, so a driver update or a source change
+just misses. Drivers are also allowed to reject a binary at any time, in which case the caller compiles normally and
+stores the fresh result. Set LEARNOPENGL_NO_PROGRAM_CACHE to bypass it (e.g. to compare timings under Mesa). */
+class ProgramCache
+{
+public:
+	unsigned int hits = 0;
+	unsigned int misses = 0;
+	unsigned int rejected = 0;
+
+	ProgramCache(const std::string& directory = "shadercache/") {
+		this->directory = directory;
+		enabled = std::getenv("LEARNOPENGL_NO_PROGRAM_CACHE") == nullptr;
+	}
+
+	// needs a current context, the driver strings are part of every key
+	uint64_t key(const std::string& vertexCode, const std::string& fragmentCode, const std::string& defines) {
+		if (driverHash == 0) {
+			driverHash = FNV_OFFSET;
+			GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+			for (GLenum name : strings) {
+				const char* value = (const char*)glGetString(name);
+				driverHash = hashString(value ? value : "", driverHash);
+			}
+
+			GLint formats = 0;
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+			if (formats == 0)
+				enabled = false; // driver can't give us binaries at all
+		}
+		uint64_t hash = hashString(vertexCode, driverHash);
+		hash = hashString(fragmentCode, hash);
+		return hashString(defines, hash);
+	}
+
+	// Try to fill program with the cached binary, returns false on a miss or if the driver rejected it
+	bool load(uint64_t key, unsigned int program) {
+		if (!enabled)
+			return false;
+
+		std::ifstream file(path(key), std::ios::binary | std::ios::ate);
+		std::streamoff fileSize = file ? (std::streamoff)file.tellg() : 0;
+		file.seekg(0);
+		ProgramCacheHeader header;
+		if (!file || !file.read((char*)&header, sizeof(header)) || !validHeader(header, key)) {
+			misses++;
+			return false;
+		}
+		// a truncated or corrupt entry is a miss, not a huge allocation
+		if ((std::streamoff)header.size != fileSize - (std::streamoff)sizeof(header)) {
+			misses++;
+			return false;
+		}
+		std::vector<char> binary(header.size);
+		if (!file.read(binary.data(), binary.size())) {
+			misses++;
+			return false;
+		}
+
+		glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+		GLint success;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (!success) {
+			rejected++;
+			return false;
+		}
+		hits++;
+		return true;
+	}
+
+	// Call before glLinkProgram so the driver keeps the binary around
+	void prepare(unsigned int program) {
+		if (enabled)
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	// Write a linked program's binary, via a temp file + rename so readers never see half a file
+	void store(uint64_t key, unsigned int program) {
+		if (!enabled)
+			return;
+
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+		std::vector<char> binary(length);
+		GLenum format;
+		glGetProgramBinary(program, length, &length, &format, binary.data());
+
+		ProgramCacheHeader header;
+		std::memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+		header.version = PROGRAM_CACHE_VERSION;
+		header.format = format;
+		header.key = key;
+		header.size = (uint64_t)length;
+
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		std::string finalPath = path(key);
+		std::stringstream tmpPath;
+		tmpPath << finalPath << ".tmp" << std::this_thread::get_id();
+		{
+			std::ofstream file(tmpPath.str(), std::ios::binary | std::ios::trunc);
+			if (!file) {
+				std::cout << "ERROR::PROGRAM_CACHE::COULD_NOT_WRITE " << tmpPath.str() << std::endl;
+				return;
+			}
+			file.write((const char*)&header, sizeof(header));
+			file.write(binary.data(), length);
+			if (!file) {
+				file.close();
+				std::filesystem::remove(tmpPath.str(), error);
+				return;
+			}
+		}
+		std::filesystem::rename(tmpPath.str(), finalPath, error);
+		if (error) {
+			std::cout << "ERROR::PROGRAM_CACHE::COULD_NOT_WRITE " << finalPath << std::endl;
+			std::filesystem::remove(tmpPath.str(), error);
+		}
+	}
+
+private:
+	std::string directory;
+	bool enabled;
+	uint64_t driverHash = 0;
+
+	std::string path(uint64_t key) const {
+		std::stringstream ss;
+		ss << directory << std::hex << key << ".bin";
+		return ss.str();
+	}
+
+	static bool validHeader(const ProgramCacheHeader& header, uint64_t key) {
+		return std::memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) == 0
+			&& header.version == PROGRAM_CACHE_VERSION
+			&& header.key == key;
+	}
+};
+
+inline ProgramCache& programCache() {
+	static ProgramCache cache;
+	return cache;
+}
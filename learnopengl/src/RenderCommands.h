@@ -0,0 +1,166 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+
+// commands one frame can hold, more are dropped (and counted)
+const unsigned int MAX_RENDER_COMMANDS = 256;
+
+enum RenderCommandType : uint8_t {
+	RENDER_CLEAR,
+	RENDER_SET_CAMERA,
+	RENDER_DRAW_MODEL,
+	RENDER_DRAW_SCENE,
+	RENDER_PRINT_STREAMING_STATS,
+	RENDER_TOGGLE_PROFILE_CAPTURE,
+	RENDER_END_BENCHMARK
+};
+
+// Plain data, only the fields of its type are meaningful
+struct RenderCommand
+{
+	RenderCommandType type;
+	unsigned int model;    // RENDER_DRAW_MODEL: index into the render thread's models
+	glm::vec4 color;       // RENDER_CLEAR
+	glm::mat4 view;        // RENDER_SET_CAMERA, the projection is built on the render thread from the current
+	float fovY;            // framebuffer size so it stays right while resizing
+	float zNear;
+	float zFar;
+};
+
+/* One frame worth of render commands, recorded by the logic thread and replayed by the render thread that owns the
+GL context. Fixed capacity, so recording never allocates. */
+class RenderCommandList
+{
+public:
+	RenderCommand commands[MAX_RENDER_COMMANDS];
+	unsigned int size = 0;
+	unsigned int dropped = 0;
+
+	void reset() {
+		size = 0;
+	}
+
+	void clear(const glm::vec4& color) {
+		if (RenderCommand* command = push(RENDER_CLEAR))
+			command->color = color;
+	}
+
+	void setCamera(const glm::mat4& view, float fovY, float zNear, float zFar) {
+		if (RenderCommand* command = push(RENDER_SET_CAMERA)) {
+			command->view = view;
+			command->fovY = fovY;
+			command->zNear = zNear;
+			command->zFar = zFar;
+		}
+	}
+
+	void drawModel(unsigned int model) {
+		if (RenderCommand* command = push(RENDER_DRAW_MODEL))
+			command->model = model;
+	}
+
+	// the render thread's scene, if it has one
+	void drawScene() {
+		push(RENDER_DRAW_SCENE);
+	}
+
+	void printStreamingStats() {
+		push(RENDER_PRINT_STREAMING_STATS);
+	}
+
+	void toggleProfileCapture() {
+		push(RENDER_TOGGLE_PROFILE_CAPTURE);
+	}
+
+	// last frame of a camera path replay, the render thread stops after drawing it
+	void endBenchmark() {
+		push(RENDER_END_BENCHMARK);
+	}
+
+	const RenderCommand* begin() const {
+		return commands;
+	}
+
+	const RenderCommand* end() const {
+		return commands + size;
+	}
+
+private:
+	RenderCommand* push(RenderCommandType type) {
+		if (size == MAX_RENDER_COMMANDS) {
+			dropped++;
+			return nullptr;
+		}
+		RenderCommand* command = &commands[size++];
+		command->type = type;
+		return command;
+	}
+};
+
+/* Double-buffered hand-off between the logic thread and the render thread. While the render thread replays one list
+the logic thread records the other; the logic thread only waits when it is a whole frame ahead (its last list hasn't
+been picked up yet). No list is ever skipped, so one-off commands always get replayed. The render thread keeps the
+list it got last until it acquires the next one, so it can replay it again (e.g. to redraw while resizing).
+
+	logic:  RenderCommandList& list = queue.beginRecording(); ...record... queue.submit();
+	render: if (const RenderCommandList* list = queue.acquire(timeout)) { ...replay... } */
+class RenderQueue
+{
+public:
+	// List for the next frame, emptied. Waits while the last submitted list hasn't been acquired yet.
+	RenderCommandList& beginRecording() {
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this] { return stopping || (submitted < 0 && replaying != recording); });
+		lists[recording].reset();
+		return lists[recording];
+	}
+
+	void submit() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			submitted = recording;
+			recording ^= 1;
+		}
+		changed.notify_all();
+	}
+
+	// The submitted list, or nullptr if none came within timeout or the queue was closed. Hands the previously
+	// acquired list back for recording.
+	const RenderCommandList* acquire(std::chrono::milliseconds timeout) {
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait_for(lock, timeout, [this] { return stopping || submitted >= 0; });
+		if (stopping || submitted < 0)
+			return nullptr;
+		replaying = submitted;
+		submitted = -1;
+		changed.notify_all();
+		return &lists[replaying];
+	}
+
+	// Wakes both sides for shutdown, acquire() returns nullptr from now on
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		changed.notify_all();
+	}
+
+	bool isClosed() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return stopping;
+	}
+
+private:
+	RenderCommandList lists[2];
+	std::mutex mutex;
+	std::condition_variable changed;
+	int recording = 0;
+	int submitted = -1;
+	int replaying = -1;
+	bool stopping = false;
+};
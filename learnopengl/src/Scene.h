@@ -0,0 +1,415 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include "Model.h"
+#include "AssetManager.h"
+#include "FrameTransforms.h"
+#include "StreamingBuffer.h"
+#include "ThreadPool.h"
+#include "SpatialIndex.h"
+#include "Profiler.h"
+
+// "LGSC" read as a little-endian uint32
+const uint32_t SCENE_MAGIC = 0x4353474C;
+const uint32_t SCENE_VERSION = 2; // 2 added the partition, version 1 files are read as PARTITION_GRID
+// instances per job when decoding transforms
+const unsigned int SCENE_DECODE_GRAIN = 8192;
+
+/* Scene file (.scene), everything little-endian:
+	SceneFileHeader
+	modelCount x { uint32 length, length chars }  model directories relative to the scene file, with trailing slash
+	instanceCount x SceneInstance                 sorted by cell
+	cellCount x SceneCell                         non-empty cells only, each a contiguous run of instances
+Instances are TRS with a uniform scale, 36 bytes each, so 100k of them are about 3.5 MB. */
+struct SceneFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t modelCount;
+	uint32_t instanceCount;
+	uint32_t cellCount;
+	float cellSize; // edge length of the cubic grid cells
+	uint32_t partition; // SpatialPartition the scene's instances are indexed with
+};
+
+struct SceneInstance
+{
+	uint32_t model; // index into the model table
+	float position[3];
+	float rotation[4]; // quaternion x, y, z, w
+	float scale;
+};
+
+struct SceneCell
+{
+	int32_t x, y, z; // floor(position / cellSize) of every instance in it
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+};
+
+static_assert(sizeof(SceneFileHeader) == 28 && sizeof(SceneInstance) == 36 && sizeof(SceneCell) == 20, "scene file structs must be packed");
+
+// Contents of a scene file
+struct SceneData
+{
+	std::vector<std::string> models;
+	std::vector<SceneInstance> instances;
+	std::vector<SceneCell> cells;
+	float cellSize = 64.0f;
+	SpatialPartition partition = PARTITION_GRID;
+
+	// Sorts instances by cell and rebuilds cells from them, writeScene does this before writing
+	void buildCells() {
+		auto cellOf = [this](const SceneInstance& instance) {
+			return glm::ivec3(glm::floor(glm::make_vec3(instance.position) / cellSize));
+		};
+		auto before = [](const glm::ivec3& a, const glm::ivec3& b) {
+			if (a.x != b.x) return a.x < b.x;
+			if (a.y != b.y) return a.y < b.y;
+			return a.z < b.z;
+		};
+		std::stable_sort(instances.begin(), instances.end(), [&](const SceneInstance& a, const SceneInstance& b) {
+			return before(cellOf(a), cellOf(b));
+		});
+
+		cells.clear();
+		for (uint32_t i = 0; i < instances.size(); i++) {
+			glm::ivec3 cell = cellOf(instances[i]);
+			if (cells.empty() || glm::ivec3(cells.back().x, cells.back().y, cells.back().z) != cell)
+				cells.push_back({ cell.x, cell.y, cell.z, i, 0 });
+			cells.back().instanceCount++;
+		}
+	}
+};
+
+// Writes data (with cells rebuilt) to path, false if the file can't be written
+inline bool writeScene(const std::string& path, SceneData& data) {
+	data.buildCells();
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		std::cout << "ERROR::SCENE::FILE_NOT_SUCCESSFULLY_WRITTEN " << path << std::endl;
+		return false;
+	}
+	SceneFileHeader header = { SCENE_MAGIC, SCENE_VERSION, (uint32_t)data.models.size(), (uint32_t)data.instances.size(), (uint32_t)data.cells.size(), data.cellSize, data.partition };
+	file.write((const char*)&header, sizeof(header));
+	for (const std::string& model : data.models) {
+		uint32_t length = (uint32_t)model.size();
+		file.write((const char*)&length, sizeof(length));
+		file.write(model.data(), length);
+	}
+	file.write((const char*)data.instances.data(), data.instances.size() * sizeof(SceneInstance));
+	file.write((const char*)data.cells.data(), data.cells.size() * sizeof(SceneCell));
+	return (bool)file;
+}
+
+// Reads and validates a scene file, throws std::invalid_argument if it's missing, truncated or inconsistent
+inline SceneData readScene(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		throw std::invalid_argument("ERROR::SCENE::FILE_NOT_SUCCESSFULLY_READ " + path);
+	std::stringstream contents;
+	contents << file.rdbuf();
+	std::string bytes = contents.str();
+
+	size_t cursor = 0;
+	auto read = [&](void* out, size_t size) {
+		if (cursor + size > bytes.size())
+			throw std::invalid_argument("ERROR::SCENE::TRUNCATED " + path);
+		std::memcpy(out, bytes.data() + cursor, size);
+		cursor += size;
+	};
+
+	SceneFileHeader header;
+	read(&header, offsetof(SceneFileHeader, partition));
+	if (header.magic != SCENE_MAGIC || header.version == 0 || header.version > SCENE_VERSION)
+		throw std::invalid_argument("ERROR::SCENE::NOT_A_SCENE_FILE " + path);
+	header.partition = PARTITION_GRID;
+	if (header.version >= 2)
+		read(&header.partition, sizeof(header.partition));
+	if (!(header.cellSize > 0.0f))
+		throw std::invalid_argument("ERROR::SCENE::BAD_CELL_SIZE " + path);
+	if (header.partition != PARTITION_GRID && header.partition != PARTITION_OCTREE)
+		throw std::invalid_argument("ERROR::SCENE::BAD_PARTITION " + path);
+
+	SceneData data;
+	data.cellSize = header.cellSize;
+	data.partition = (SpatialPartition)header.partition;
+	for (uint32_t i = 0; i < header.modelCount; i++) {
+		uint32_t length;
+		read(&length, sizeof(length));
+		std::string model(std::min<size_t>(length, bytes.size()), '\0');
+		read(&model[0], length);
+		data.models.push_back(model);
+	}
+	// sizes are checked against the file before anything gets allocated for them
+	if ((uint64_t)header.instanceCount * sizeof(SceneInstance) + (uint64_t)header.cellCount * sizeof(SceneCell) != bytes.size() - cursor)
+		throw std::invalid_argument("ERROR::SCENE::TRUNCATED " + path);
+	data.instances.resize(header.instanceCount);
+	read(data.instances.data(), data.instances.size() * sizeof(SceneInstance));
+	data.cells.resize(header.cellCount);
+	read(data.cells.data(), data.cells.size() * sizeof(SceneCell));
+
+	for (const SceneInstance& instance : data.instances) {
+		if (instance.model >= header.modelCount)
+			throw std::invalid_argument("ERROR::SCENE::BAD_MODEL_INDEX " + path);
+	}
+	for (const SceneCell& cell : data.cells) {
+		if ((uint64_t)cell.firstInstance + cell.instanceCount > header.instanceCount)
+			throw std::invalid_argument("ERROR::SCENE::BAD_CELL " + path);
+	}
+	return data;
+}
+
+/* A world of placed model instances, loaded from a scene file. Every referenced model is acquired once through the
+asset manager and drawn once per frame for all of its instances (instanced multi-draw, see Model::DrawInstanced),
+so there's no Model (or draw call) per instance. Has the same frame interface as Model: PrepareFrame, UpdateStreaming,
+Draw.
+
+Instance bounds live in a SpatialIndex (grid or octree, as the file says). Each frame only what the frustum query
+returns gets drawn, and moving an instance (MoveInstance) updates just its entry. An instance joins the index once
+its model has loaded, since that's when its bounds are known.
+
+For shadows, instances are static casters until they're first moved and dynamic from then on: cached shadow maps
+only have to be redrawn when the static set changes, the dynamic ones are drawn over them every frame. */
+class Scene
+{
+public:
+	// per-instance world matrices in file order, so each cell is still a contiguous range
+	std::vector<glm::mat4> worlds;
+	std::vector<SceneCell> cells;
+	float cellSize = 0.0f;
+	// world bounds of every instance whose model has loaded, for culling and picking (ids are instance indices)
+	SpatialIndex index;
+	unsigned int visibleInstances = 0; // drawn last frame
+
+	// path: the .scene file, model directories are relative to it. incremental: models are decoded before this returns
+	// but get uploaded over the next frames (see AssetManager::acquireAll), otherwise they're all loaded. GL thread only.
+	Scene(const std::string& path, bool incremental = false) {
+		PROFILE_SCOPE("load scene");
+		SceneData data;
+		{
+			PROFILE_SCOPE("read scene");
+			data = readScene(path);
+		}
+		cells = std::move(data.cells);
+		cellSize = data.cellSize;
+		instanceModel.resize(data.instances.size());
+		handles.assign(data.instances.size(), NO_HANDLE);
+		dynamic.assign(data.instances.size(), 0);
+
+		// every model is read and decoded on the workers at the same time, only the uploads happen on this thread
+		std::string base = std::filesystem::path(path).parent_path().generic_string();
+		if (!base.empty())
+			base += '/';
+		std::vector<std::string> directories;
+		for (const std::string& model : data.models) {
+			directories.push_back(base + model);
+		}
+		for (const std::shared_ptr<Model>& model : assetManager().acquireAll(directories, incremental)) {
+			ModelInstances batch;
+			batch.model = model;
+			models.push_back(batch);
+		}
+
+		{
+			PROFILE_SCOPE("decode instances");
+			worlds.resize(data.instances.size());
+			workerPool().parallelFor((unsigned int)worlds.size(), SCENE_DECODE_GRAIN, [&](unsigned int begin, unsigned int end) {
+				for (unsigned int i = begin; i < end; i++) {
+					const SceneInstance& instance = data.instances[i];
+					glm::quat rotation(instance.rotation[3], instance.rotation[0], instance.rotation[1], instance.rotation[2]);
+					glm::mat4 world = glm::mat4_cast(rotation) * instance.scale;
+					world[3] = glm::vec4(glm::make_vec3(instance.position), 1.0f);
+					worlds[i] = world;
+				}
+			});
+			for (unsigned int i = 0; i < data.instances.size(); i++) {
+				instanceModel[i] = data.instances[i].model;
+				models[data.instances[i].model].instances.push_back(i);
+			}
+		}
+
+		// the octree covers where the instances are now, anything that ends up outside it still works (just slower)
+		glm::vec3 rootMin(0.0f), rootMax(0.0f);
+		for (unsigned int i = 0; i < worlds.size(); i++) {
+			glm::vec3 position = glm::vec3(worlds[i][3]);
+			rootMin = i ? glm::min(rootMin, position) : position;
+			rootMax = i ? glm::max(rootMax, position) : position;
+		}
+		index = SpatialIndex(data.partition, cellSize, rootMin - glm::vec3(cellSize), rootMax + glm::vec3(cellSize));
+		indexLoadedModels();
+	}
+
+	unsigned int InstanceCount() const {
+		return (unsigned int)worlds.size();
+	}
+
+	// World box around every instance, false until all models have loaded (or if none of them has anything to draw)
+	bool Bounds(glm::vec3& min, glm::vec3& max) {
+		indexLoadedModels();
+		for (const ModelInstances& batch : models) {
+			if (!batch.indexed)
+				return false;
+		}
+		bool any = false;
+		for (unsigned int instance = 0; instance < worlds.size(); instance++) {
+			if (handles[instance] == NO_HANDLE)
+				continue;
+			glm::vec3 instanceMin, instanceMax;
+			instanceBounds(instance, instanceMin, instanceMax);
+			min = any ? glm::min(min, instanceMin) : instanceMin;
+			max = any ? glm::max(max, instanceMax) : instanceMax;
+			any = true;
+		}
+		return any;
+	}
+
+	// Places an instance somewhere else, only its own index entry is updated
+	void MoveInstance(unsigned int instance, const glm::mat4& world) {
+		worlds[instance] = world;
+		if (!dynamic[instance]) {
+			dynamic[instance] = 1;
+			dynamicInstances++;
+			staticVersion++;
+		}
+		if (handles[instance] != NO_HANDLE) {
+			glm::vec3 min, max;
+			instanceBounds(instance, min, max);
+			index.move(handles[instance], min, max);
+		}
+	}
+
+	// Batch stage: frustum query, then one MVP per visible instance of the subset, appended model by model so each
+	// model's instances are contiguous
+	void PrepareFrame(FrameTransforms& frame, DrawSubset subset = DRAW_ALL) {
+		indexLoadedModels();
+		{
+			PROFILE_SCOPE("cull instances");
+			visible.clear();
+			index.queryFrustum(Frustum(frame.viewProjection), visible);
+			if (subset == DRAW_ALL)
+				visibleInstances = (unsigned int)visible.size();
+			for (ModelInstances& batch : models) {
+				batch.visible.clear();
+			}
+			for (unsigned int instance : visible) {
+				if (subset == DRAW_ALL || (subset == DRAW_DYNAMIC) == (dynamic[instance] != 0))
+					models[instanceModel[instance]].visible.push_back(instance);
+			}
+		}
+		for (ModelInstances& batch : models) {
+			if (batch.visible.empty())
+				continue;
+			batch.drawWorlds = batch.model->PrepareInstances();
+			batch.firstInstance = frame.append(worlds.data(), batch.visible.data(), (unsigned int)batch.visible.size());
+		}
+	}
+
+	// Changes whenever the static casters could have: a model loaded or changed, or an instance turned dynamic
+	uint64_t StaticVersion() const {
+		uint64_t version = staticVersion;
+		for (const ModelInstances& batch : models) {
+			version = version * 31 + batch.model->StaticVersion();
+		}
+		return version;
+	}
+
+	bool HasDynamicCasters() const {
+		return dynamicInstances > 0;
+	}
+
+	// Each model's textures are streamed for its closest visible instance
+	void UpdateStreaming(const FrameTransforms& frame, float viewportHeight) {
+		glm::vec3 eye = glm::vec3(glm::inverse(frame.view)[3]);
+		for (ModelInstances& batch : models) {
+			if (batch.visible.empty())
+				continue;
+			unsigned int closest = batch.visible[0];
+			float closestDistance = INFINITY;
+			for (unsigned int instance : batch.visible) {
+				glm::vec3 offset = glm::vec3(worlds[instance][3]) - eye;
+				float distance = glm::dot(offset, offset);
+				if (distance < closestDistance) {
+					closestDistance = distance;
+					closest = instance;
+				}
+			}
+			batch.model->UpdateStreaming(frame, viewportHeight, worlds[closest]);
+		}
+	}
+
+	void RequestShaders(ShaderPermutations& shaders) {
+		for (ModelInstances& batch : models) {
+			batch.model->RequestShaders(shaders, FEATURE_INSTANCED);
+		}
+	}
+
+	// Must come after PrepareFrame (and the frame's upload) for the same frame
+	void Draw(ShaderPermutations& shaders, const FrameTransforms& frame) {
+		PROFILE_SCOPE("Scene::Draw");
+		for (ModelInstances& batch : models) {
+			if (!batch.visible.empty())
+				batch.model->DrawInstanced(shaders, batch.drawWorlds, batch.firstInstance, (unsigned int)batch.visible.size());
+		}
+	}
+
+private:
+	static constexpr unsigned int NO_HANDLE = (unsigned int)-1;
+
+	struct ModelInstances
+	{
+		std::shared_ptr<Model> model;
+		std::vector<unsigned int> instances; // into worlds
+		std::vector<unsigned int> visible;   // the ones drawn this frame
+		bool indexed = false;
+		glm::vec3 boundsMin = glm::vec3(0.0f); // model space
+		glm::vec3 boundsMax = glm::vec3(0.0f);
+		unsigned int firstInstance = 0; // this frame's MVP slot of visible[0]
+		StreamAllocation<glm::mat4> drawWorlds; // this frame's node transforms of the model's draws
+	};
+	std::vector<ModelInstances> models;
+	std::vector<unsigned int> instanceModel; // model of every instance
+	std::vector<unsigned int> handles;       // index entry of every instance, NO_HANDLE until its model has loaded
+	std::vector<unsigned char> dynamic;      // moved at some point, see MoveInstance
+	unsigned int dynamicInstances = 0;
+	uint64_t staticVersion = 0;
+	std::vector<unsigned int> visible;
+
+	void instanceBounds(unsigned int instance, glm::vec3& min, glm::vec3& max) {
+		const ModelInstances& batch = models[instanceModel[instance]];
+		transformBounds(worlds[instance], batch.boundsMin, batch.boundsMax, min, max);
+	}
+
+	// Adds the instances of models that finished loading since the last call
+	void indexLoadedModels() {
+		for (ModelInstances& batch : models) {
+			if (batch.indexed || !batch.model->IsLoaded())
+				continue;
+			batch.indexed = true;
+			staticVersion++;
+			if (!batch.model->Bounds(batch.boundsMin, batch.boundsMax))
+				continue; // nothing to draw (failed load or an empty file)
+			PROFILE_SCOPE("index instances");
+			for (unsigned int instance : batch.instances) {
+				glm::vec3 min, max;
+				instanceBounds(instance, min, max);
+				handles[instance] = index.insert(instance, min, max);
+			}
+		}
+	}
+};
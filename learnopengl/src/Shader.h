@@ -7,11 +7,69 @@
 #include<fstream>
 #include<sstream>
 #include<iostream>
-
+#include "ProgramCache.h"
+
+// Uniforms every mesh shader declares with an explicit layout(location = ...), so the draw loop sets them without
+// looking anything up by name
+const int UNIFORM_FIRST_DRAW = 0; // where the model's MVPs start in the frame's transform buffer
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC_)(GLuint count);
+
+// Set by enableParallelShaderCompile, when true programs can be polled with GL_COMPLETION_STATUS_KHR
+inline bool& parallelShaderCompile() {
+	static bool supported = false;
+	return supported;
+}
+
+// Replaces the #version line of every shader when non-empty, see detectShaderVersion
+inline std::string& shaderVersionHeader() {
+	static std::string header;
+	return header;
+}
+
+// Shaders are written for GLSL 460. On a 4.5 context (Mesa's llvmpipe, which headless runs use) they're compiled as
+// 450 with ARB_shader_draw_parameters instead, gl_BaseInstance being the only 4.6 feature they need. Needs a current context.
+inline void detectShaderVersion() {
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (major == 4 && minor < 6) {
+		shaderVersionHeader() = "#version 450 core\n#extension GL_ARB_shader_draw_parameters : require\n#define gl_BaseInstance gl_BaseInstanceARB\n";
+		std::cout << "OpenGL 4." << minor << " context, compiling shaders as GLSL 450" << std::endl;
+	}
+}
+
+// Turn on driver-side parallel compilation if GL_KHR/ARB_parallel_shader_compile is there. Needs a current context;
+// the loader is whatever glad was initialized with, since glad may not have been generated with the extension.
+inline bool enableParallelShaderCompile(GLADloadproc load) {
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	const char* names[] = { "GL_KHR_parallel_shader_compile", "GL_ARB_parallel_shader_compile" };
+	const char* procs[] = { "glMaxShaderCompilerThreadsKHR", "glMaxShaderCompilerThreadsARB" };
+	for (int e = 0; e < 2; e++) {
+		for (GLint i = 0; i < count; i++) {
+			if (std::string((const char*)glGetStringi(GL_EXTENSIONS, i)) != names[e])
+				continue;
+			PFNGLMAXSHADERCOMPILERTHREADSKHRPROC_ maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC_)load(procs[e]);
+			if (maxThreads)
+				maxThreads(0xFFFFFFFF); // let the driver pick
+			parallelShaderCompile() = true;
+			return true;
+		}
+	}
+	return false;
+}
 
 class Shader {
 public:
-	unsigned int ID;
+	unsigned int ID = 0;
+
+	// empty program, fill it with compile()
+	Shader() {}
 
 	Shader(const char* vertexPath, const char* fragmentPath) {
 		std::string vertexCode;
@@ -38,57 +96,115 @@ public:
 		catch(std::ifstream::failure e) {
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ\n";
 		}
+		build(vertexCode, fragmentCode, "");
+	}
+
+	void use() {
+		glUseProgram(ID);
+	}
+
+	void setBool(const std::string& name, bool value) const {
+		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+	}
+
+	void setInt(const std::string& name, int value) const {
+		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+	}
+
+	void setFloat(const std::string& name, float value) const {
+		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+	}
+
+	void setMat4(const std::string& name, const glm::mat4& value) const {
+		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &value[0][0]);
+	}
+
+	// by location, for the per-draw uniforms
+	void setUint(int location, unsigned int value) const {
+		glUniform1ui(location, value);
+	}
+
+	void setMat4(int location, const glm::mat4& value) const {
+		glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]);
+	}
+
+	// Start compiling and linking from sources without waiting for the driver. defines only feed the cache key
+	// here, they're expected to be in the sources already. Finish with isReady() or wait().
+	void compile(const std::string& vertexCode, const std::string& fragmentCode, const std::string& defines) {
+		ID = glCreateProgram();
+		cacheKey = programCache().key(vertexCode, fragmentCode, defines);
+		if (programCache().load(cacheKey, ID))
+			return;
+
 		const char* vShaderCode = vertexCode.c_str();
 		const char* fShaderCode = fragmentCode.c_str();
 
 		// Create and dynamically compile vertex shader
-		unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
+		vertex = glCreateShader(GL_VERTEX_SHADER);
 		glShaderSource(vertex, 1, &vShaderCode, NULL);
 		glCompileShader(vertex);
 
 		// Same for fragment shader
-		unsigned int fragment = glCreateShader(GL_FRAGMENT_SHADER);
+		fragment = glCreateShader(GL_FRAGMENT_SHADER);
 		glShaderSource(fragment, 1, &fShaderCode, NULL);
 		glCompileShader(fragment);
 
-		// Check for compile errors
-		checkCompilation(vertex, "VERTEX");
-		checkCompilation(fragment, "FRAGMENT");
-
-		// Create shader program (link shaders)
-		ID = glCreateProgram();
+		// Link shaders (a rejected binary leaves the program object usable for a normal link). Status checks wait
+		// for the compiler, so they're deferred to finish()
 		glAttachShader(ID, vertex);
 		glAttachShader(ID, fragment);
+		programCache().prepare(ID);
 		glLinkProgram(ID);
-		checkCompilation(ID, "LINKING");
-
-		// Delete shader objects after linking
-		glDeleteShader(vertex);
-		glDeleteShader(fragment);
+		pending = true;
 	}
 
-	void use() {
-		glUseProgram(ID);
+	// Non-blocking when the driver compiles in parallel (GL_KHR_parallel_shader_compile), otherwise same as wait()
+	bool isReady() {
+		if (!pending)
+			return true;
+		if (parallelShaderCompile()) {
+			GLint done = GL_FALSE;
+			glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+			if (!done)
+				return false;
+		}
+		finish();
+		return true;
 	}
 
-	void setBool(const std::string& name, bool value) const {
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+	void wait() {
+		if (pending)
+			finish();
 	}
 
-	void setInt(const std::string& name, int value) const {
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+private:
+	uint64_t cacheKey = 0;
+	unsigned int vertex = 0;
+	unsigned int fragment = 0;
+	bool pending = false;
+
+	void build(const std::string& vertexCode, const std::string& fragmentCode, const std::string& defines) {
+		compile(vertexCode, fragmentCode, defines);
+		wait();
 	}
 
-	void setFloat(const std::string& name, float value) const {
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
-	}
+	void finish() {
+		// Check for compile errors
+		checkCompilation(vertex, "VERTEX");
+		checkCompilation(fragment, "FRAGMENT");
+		if (checkCompilation(ID, "LINKING"))
+			programCache().store(cacheKey, ID);
 
-	void setMat4(const std::string& name, const glm::mat4& value) const {
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &value[0][0]);
+		// Delete shader objects after linking
+		glDetachShader(ID, vertex);
+		glDetachShader(ID, fragment);
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+		vertex = fragment = 0;
+		pending = false;
 	}
 
-private:
-	void checkCompilation(unsigned int shader, std::string type) {
+	bool checkCompilation(unsigned int shader, std::string type) {
 		// Check for compilation errors
 		int success;
 		char infoLog[1024];
@@ -106,6 +222,7 @@ private:
 				std::cout << "ERROR::PROGRAM_LINKING_ERROR\n"  << infoLog << std::endl;
 			}
 		}
+		return success;
 	}
 };
 
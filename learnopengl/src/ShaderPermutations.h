@@ -0,0 +1,191 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include "Shader.h"
+#include "Material.h"
+#include "Hash.h"
+
+// Feature bits a material can ask for, each one maps to a #define in the shader source
+enum ShaderFeature {
+	FEATURE_BASE_COLOR_MAP = 1 << 0,
+	FEATURE_NORMAL_MAP = 1 << 1,
+	FEATURE_EMISSIVE_MAP = 1 << 2,
+	FEATURE_ALPHA_TEST = 1 << 3,
+	FEATURE_DEBUG_NORMALS = 1 << 4,
+	FEATURE_INSTANCED = 1 << 5, // drawn through Model::DrawInstanced
+	FEATURE_METALLIC_ROUGHNESS_MAP = 1 << 6,
+	FEATURE_OCCLUSION_MAP = 1 << 7,
+	FEATURE_COUNT = 8
+};
+
+const char* const FEATURE_DEFINES[FEATURE_COUNT] = {
+	"HAS_BASE_COLOR_MAP",
+	"HAS_NORMAL_MAP",
+	"HAS_EMISSIVE_MAP",
+	"ALPHA_TEST",
+	"DEBUG_NORMALS",
+	"INSTANCED",
+	"HAS_METALLIC_ROUGHNESS_MAP",
+	"HAS_OCCLUSION_MAP"
+};
+
+/* All variants of one vertex/fragment source pair. #include "..." is expanded once up front, and each feature mask
+becomes a copy of the sources with the matching #defines inserted after #version. Defines the sources never mention are
+left out, so masks that only differ in irrelevant bits hash the same and share one program.
+
+request() only starts compiling (the driver works in parallel when GL_KHR_parallel_shader_compile is on), and get()
+blocks on that one variant, so a frame only ever waits for the programs it actually draws with. */
+class ShaderPermutations
+{
+public:
+	// features added to every variant, e.g. FEATURE_DEBUG_NORMALS
+	unsigned int globalFeatures = 0;
+
+	ShaderPermutations(const char* vertexPath, const char* fragmentPath) {
+		std::set<std::string> included;
+		vertexSource = expandIncludes(vertexPath, included);
+		included.clear();
+		fragmentSource = expandIncludes(fragmentPath, included);
+
+		// only features the sources reference take part in a variant
+		for (unsigned int i = 0; i < FEATURE_COUNT; i++) {
+			if (vertexSource.find(FEATURE_DEFINES[i]) != std::string::npos || fragmentSource.find(FEATURE_DEFINES[i]) != std::string::npos)
+				usedFeatures |= 1u << i;
+		}
+	}
+
+	// Features a material needs, derived from its textures and alpha mode
+	static unsigned int featuresFor(const Material& material) {
+		unsigned int features = 0;
+		if (material.hasTexture(SLOT_BASE_COLOR)) features |= FEATURE_BASE_COLOR_MAP;
+		if (material.hasTexture(SLOT_NORMAL)) features |= FEATURE_NORMAL_MAP;
+		if (material.hasTexture(SLOT_EMISSIVE)) features |= FEATURE_EMISSIVE_MAP;
+		if (material.hasTexture(SLOT_METALLIC_ROUGHNESS)) features |= FEATURE_METALLIC_ROUGHNESS_MAP;
+		if (material.hasTexture(SLOT_OCCLUSION)) features |= FEATURE_OCCLUSION_MAP;
+		if (material.alphaTest) features |= FEATURE_ALPHA_TEST;
+		return features;
+	}
+
+	// Kick off compilation of a variant if it isn't known yet, doesn't wait for it
+	void request(unsigned int features) {
+		find(features);
+	}
+
+	// nullptr while the variant is still compiling
+	Shader* tryGet(unsigned int features) {
+		Shader* shader = find(features);
+		return shader->isReady() ? shader : nullptr;
+	}
+
+	// Blocks until this variant (and only this one) is linked
+	Shader& get(unsigned int features) {
+		Shader* shader = find(features);
+		shader->wait();
+		return *shader;
+	}
+
+	unsigned int programCount() const {
+		return (unsigned int)programs.size();
+	}
+
+	// Variants requested but not linked yet
+	unsigned int pendingCount() {
+		unsigned int pending = 0;
+		for (const std::unique_ptr<Shader>& program : programs) {
+			pending += !program->isReady();
+		}
+		return pending;
+	}
+
+private:
+	std::string vertexSource;
+	std::string fragmentSource;
+	unsigned int usedFeatures = 0;
+	std::vector<std::unique_ptr<Shader>> programs;
+	std::unordered_map<unsigned int, Shader*> byFeatures;
+	std::unordered_map<uint64_t, Shader*> byHash;
+
+	Shader* find(unsigned int features) {
+		features = (features | globalFeatures) & usedFeatures;
+		auto found = byFeatures.find(features);
+		if (found != byFeatures.end())
+			return found->second;
+
+		std::string defines;
+		for (unsigned int i = 0; i < FEATURE_COUNT; i++) {
+			if (features & (1u << i))
+				defines += std::string("#define ") + FEATURE_DEFINES[i] + " 1\n";
+		}
+		std::string vertexCode = injectDefines(vertexSource, defines);
+		std::string fragmentCode = injectDefines(fragmentSource, defines);
+
+		// identical sources -> same program
+		uint64_t hash = hashString(fragmentCode, hashString(vertexCode));
+		auto same = byHash.find(hash);
+		if (same != byHash.end()) {
+			byFeatures[features] = same->second;
+			return same->second;
+		}
+
+		programs.push_back(std::make_unique<Shader>());
+		Shader* shader = programs.back().get();
+		shader->compile(vertexCode, fragmentCode, defines);
+		byHash[hash] = shader;
+		byFeatures[features] = shader;
+		return shader;
+	}
+
+	// Defines go right after the #version line (which has to stay first, and may get swapped, see detectShaderVersion)
+	static std::string injectDefines(const std::string& source, const std::string& defines) {
+		size_t version = source.find("#version");
+		if (version == std::string::npos)
+			return defines + source;
+		size_t lineEnd = source.find('\n', version);
+		if (lineEnd == std::string::npos)
+			lineEnd = source.size();
+		std::string versionLine = shaderVersionHeader().empty() ? source.substr(0, std::min(lineEnd + 1, source.size())) : source.substr(0, version) + shaderVersionHeader();
+		if (versionLine.back() != '\n')
+			versionLine += '\n';
+		return versionLine + defines + (lineEnd < source.size() ? source.substr(lineEnd + 1) : std::string());
+	}
+
+	// Replace every #include "file" (relative to the including file) with its contents, each file at most once
+	static std::string expandIncludes(const std::filesystem::path& path, std::set<std::string>& included) {
+		std::string key = path.lexically_normal().generic_string();
+		if (included.count(key))
+			return "";
+		included.insert(key);
+
+		std::ifstream file(path);
+		if (!file) {
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ " << key << std::endl;
+			return "";
+		}
+
+		std::stringstream out;
+		std::string line;
+		while (std::getline(file, line)) {
+			size_t directive = line.find_first_not_of(" \t");
+			if (directive != std::string::npos && line.compare(directive, 8, "#include") == 0) {
+				size_t open = line.find('"', directive);
+				size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+				if (close == std::string::npos) {
+					std::cout << "ERROR::SHADER::BAD_INCLUDE in " << key << ": " << line << std::endl;
+					continue;
+				}
+				out << expandIncludes(path.parent_path() / line.substr(open + 1, close - open - 1), included);
+				continue;
+			}
+			out << line << '\n';
+		}
+		return out.str();
+	}
+};
@@ -0,0 +1,271 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include "FrameTransforms.h"
+#include "ShaderPermutations.h"
+#include "StreamingBuffer.h"
+#include "Profiler.h"
+
+// the shaders keep per-cascade values in vec4s
+const unsigned int SHADOW_CASCADES = 4;
+// uniform block binding of ShadowParams, and the shadow map's texture unit (right after the material slots)
+const unsigned int SHADOW_BINDING = 1;
+const unsigned int SHADOW_TEXTURE_UNIT = 10;
+// how far from the camera shadows reach (the far plane if that's nearer)
+const float SHADOW_DISTANCE = 150.0f;
+// cascade splits between logarithmic (1) and even (0)
+const float SHADOW_SPLIT_LAMBDA = 0.8f;
+// cascades cover this much more than their slice of the view, so small camera moves don't move (and redraw) them
+const float SHADOW_CASCADE_MARGIN = 1.25f;
+
+// Shadow map size from LEARNOPENGL_SHADOW_SIZE (2048 if unset, 0 turns shadows off)
+inline unsigned int shadowMapSize() {
+	static unsigned int size = [] {
+		const char* env = std::getenv("LEARNOPENGL_SHADOW_SIZE");
+		return env ? (unsigned int)std::strtoul(env, nullptr, 10) : 2048u;
+	}();
+	return size;
+}
+
+struct ShadowParams // std140, keep in sync with common/shadows.glsl
+{
+	glm::mat4 cascades[SHADOW_CASCADES]; // view space to shadow map space ([0, 1] uv and depth)
+	glm::vec4 splits;    // far view depth of every cascade
+	glm::vec4 texelSize; // world size of a shadow map texel per cascade, for the normal offset
+	glm::vec4 settings;  // x: 1 when there are shadows, y: 1 / map size
+};
+
+/* Cascaded shadow maps for the sun, with the static casters cached.
+
+The cascades split [near, min(far, SHADOW_DISTANCE)] somewhere between logarithmically and evenly. Each one is an
+orthographic box around the bounding sphere of its slice of the view (SHADOW_CASCADE_MARGIN larger), so its size only
+depends on the projection and not on where the camera looks. Boxes sit at texel-snapped spots in light space and only
+move once their slice doesn't fit anymore: the texel grid stays put in world space (no shimmering edges) and a cascade
+keeps its contents while the camera stays inside it.
+
+Static casters are drawn into staticMap, per cascade, only when the cascade moved or the drawable's StaticVersion(),
+the sun or the map size changed. Dynamic casters (drawable.HasDynamicCasters()) are drawn every frame on top of a copy
+of the static layers in dynamicMap. A still camera over a static scene doesn't draw any shadows at all, a moving one
+redraws only the cascades it walked out of. */
+class ShadowCascades
+{
+public:
+	// depth-only variants for the caster draws
+	ShaderPermutations shaders{ "shaders/shadow.vert", "shaders/shadow.frag" };
+	ShadowParams params;
+	unsigned int staticPasses = 0; // cascades redrawn with their static casters last frame
+	unsigned int dynamicPasses = 0;
+
+	// GL thread, before the frame's own PrepareFrame (the passes reuse the drawable's per-frame state and transforms).
+	// Binds the shadow map and this frame's ShadowParams either way.
+	template <typename Drawable>
+	void render(Drawable& drawable, FrameTransforms& transforms, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& sunDirection) {
+		PROFILE_SCOPE("shadows");
+		PROFILE_GPU_SCOPE("shadows");
+		staticPasses = dynamicPasses = 0;
+		params.settings = glm::vec4(0.0f);
+		unsigned int size = shadowMapSize();
+		if (size > 0 && placeCascades(drawable, view, projection, sunDirection, size))
+			drawCascades(drawable, transforms);
+		renderCounters().shadowPasses += staticPasses + dynamicPasses;
+
+		StreamAllocation<ShadowParams> block = streamingBuffer().allocate<ShadowParams>(1);
+		block.data[0] = params;
+		glBindBufferRange(GL_UNIFORM_BUFFER, SHADOW_BINDING, block.buffer, block.offset, sizeof(ShadowParams));
+	}
+
+	void release() {
+		unsigned int textures[2] = { staticMap, dynamicMap };
+		glDeleteTextures(2, textures);
+		glDeleteFramebuffers(1, &framebuffer);
+		staticMap = dynamicMap = framebuffer = 0;
+		mapSize = 0;
+	}
+
+private:
+	struct Cascade
+	{
+		glm::mat4 projection = glm::mat4(1.0f);
+		float x = 0.0f, y = 0.0f; // light-space center, a multiple of texel
+		float halfExtent = 0.0f;
+		float texel = 0.0f;
+		bool placed = false;
+		bool current = false; // staticMap's layer has this placement's static casters
+	};
+
+	Cascade cascades[SHADOW_CASCADES];
+	unsigned int staticMap = 0, dynamicMap = 0, framebuffer = 0;
+	unsigned int mapSize = 0;
+	// what every static layer was drawn with
+	uint64_t staticVersion = 0;
+	glm::vec3 lightDirection = glm::vec3(0.0f);
+	glm::mat4 lightView = glm::mat4(1.0f); // rotation only, cascades are placed in this space
+	float depthNear = 0.0f, depthFar = 0.0f; // light-space depth range of the drawable's bounds
+
+	// Fills params and moves cascades that need it, false if there's nothing to cast shadows yet
+	template <typename Drawable>
+	bool placeCascades(Drawable& drawable, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& sunDirection, unsigned int size) {
+		uint64_t version = drawable.StaticVersion();
+		if (size != mapSize || version != staticVersion || sunDirection != lightDirection) {
+			glm::vec3 min, max;
+			if (!drawable.Bounds(min, max))
+				return false;
+			if (size != mapSize)
+				createMaps(size);
+			staticVersion = version;
+			lightDirection = sunDirection;
+			glm::vec3 up = std::abs(sunDirection.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+			lightView = glm::lookAt(glm::vec3(0.0f), sunDirection, up);
+
+			// every caster and receiver is inside the bounds, anything moving out of them gets clamped (GL_DEPTH_CLAMP)
+			float nearest = INFINITY, farthest = -INFINITY;
+			for (unsigned int corner = 0; corner < 8; corner++) {
+				glm::vec3 point(corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y, corner & 4 ? max.z : min.z);
+				float depth = -glm::vec3(lightView * glm::vec4(point, 1.0f)).z;
+				nearest = std::min(nearest, depth);
+				farthest = std::max(farthest, depth);
+			}
+			float margin = (farthest - nearest) * 0.01f + 0.01f;
+			depthNear = nearest - margin;
+			depthFar = farthest + margin;
+			for (Cascade& cascade : cascades) {
+				cascade.placed = cascade.current = false;
+			}
+		}
+
+		float zNear = projection[3][2] / (projection[2][2] - 1.0f);
+		float zFar = projection[3][2] / (projection[2][2] + 1.0f);
+		float range = std::min(zFar, SHADOW_DISTANCE);
+		// the view slice's corners are at (+-depth / projection[0][0], +-depth / projection[1][1], -depth)
+		float spread = 1.0f / (projection[0][0] * projection[0][0]) + 1.0f / (projection[1][1] * projection[1][1]);
+		glm::mat4 inverseView = glm::inverse(view);
+		glm::mat4 bias(0.5f);
+		bias[3] = glm::vec4(0.5f, 0.5f, 0.5f, 1.0f);
+
+		float sliceNear = zNear;
+		for (unsigned int i = 0; i < SHADOW_CASCADES; i++) {
+			float t = (float)(i + 1) / SHADOW_CASCADES;
+			float split = SHADOW_SPLIT_LAMBDA * zNear * std::pow(range / zNear, t) + (1.0f - SHADOW_SPLIT_LAMBDA) * (zNear + (range - zNear) * t);
+			// smallest sphere around the slice that's centered on the view axis, rounded so float noise can't resize it
+			float center = std::min((sliceNear + split) * (1.0f + spread) * 0.5f, split);
+			float radius = std::sqrt(std::max(spread * split * split + (split - center) * (split - center),
+				spread * sliceNear * sliceNear + (center - sliceNear) * (center - sliceNear)));
+			radius = std::ceil(radius * 16.0f) / 16.0f;
+			glm::vec3 lightCenter = glm::vec3(lightView * (inverseView * glm::vec4(0.0f, 0.0f, -center, 1.0f)));
+
+			Cascade& cascade = cascades[i];
+			float halfExtent = radius * SHADOW_CASCADE_MARGIN;
+			bool fits = cascade.placed && halfExtent == cascade.halfExtent
+				&& std::abs(lightCenter.x - cascade.x) + radius <= halfExtent && std::abs(lightCenter.y - cascade.y) + radius <= halfExtent;
+			if (!fits) {
+				cascade.halfExtent = halfExtent;
+				cascade.texel = 2.0f * halfExtent / mapSize;
+				cascade.x = std::floor(lightCenter.x / cascade.texel + 0.5f) * cascade.texel;
+				cascade.y = std::floor(lightCenter.y / cascade.texel + 0.5f) * cascade.texel;
+				cascade.projection = glm::ortho(cascade.x - halfExtent, cascade.x + halfExtent, cascade.y - halfExtent, cascade.y + halfExtent, depthNear, depthFar);
+				cascade.placed = true;
+				cascade.current = false;
+			}
+			params.cascades[i] = bias * cascade.projection * lightView * inverseView;
+			params.splits[i] = split;
+			params.texelSize[i] = cascade.texel;
+			sliceNear = split;
+		}
+		params.settings = glm::vec4(1.0f, 1.0f / mapSize, 0.0f, 0.0f);
+		return true;
+	}
+
+	template <typename Drawable>
+	void drawCascades(Drawable& drawable, FrameTransforms& transforms) {
+		bool dynamic = drawable.HasDynamicCasters();
+		bool anyStatic = false;
+		for (const Cascade& cascade : cascades) {
+			anyStatic |= !cascade.current;
+		}
+		if (anyStatic || dynamic) {
+			GLint previousFramebuffer = 0, viewport[4];
+			glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+			glGetIntegerv(GL_VIEWPORT, viewport);
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glViewport(0, 0, mapSize, mapSize);
+			glEnable(GL_DEPTH_CLAMP);
+			glEnable(GL_POLYGON_OFFSET_FILL);
+			glPolygonOffset(1.5f, 2.0f);
+
+			for (unsigned int i = 0; i < SHADOW_CASCADES; i++) {
+				if (cascades[i].current)
+					continue;
+				PROFILE_SCOPE("static shadow casters");
+				drawLayer(drawable, transforms, staticMap, i, DRAW_STATIC);
+				// variants still compiling got skipped, so this layer has to be drawn again
+				cascades[i].current = shaders.pendingCount() == 0;
+				staticPasses++;
+			}
+			if (dynamic) {
+				PROFILE_SCOPE("dynamic shadow casters");
+				if (dynamicMap == 0)
+					dynamicMap = createMap(mapSize);
+				for (unsigned int i = 0; i < SHADOW_CASCADES; i++) {
+					glCopyImageSubData(staticMap, GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, dynamicMap, GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, mapSize, mapSize, 1);
+					drawLayer(drawable, transforms, dynamicMap, i, DRAW_DYNAMIC);
+					dynamicPasses++;
+				}
+			}
+
+			glDisable(GL_POLYGON_OFFSET_FILL);
+			glDisable(GL_DEPTH_CLAMP);
+			glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+			glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		}
+		glActiveTexture(GL_TEXTURE0 + SHADOW_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, dynamic ? dynamicMap : staticMap);
+	}
+
+	// One cascade's casters of the subset into a layer of map, the static pass starts from a cleared layer
+	template <typename Drawable>
+	void drawLayer(Drawable& drawable, FrameTransforms& transforms, unsigned int map, unsigned int layer, DrawSubset subset) {
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, map, 0, layer);
+		if (subset == DRAW_STATIC)
+			glClear(GL_DEPTH_BUFFER_BIT);
+		transforms.begin(lightView, cascades[layer].projection, false); // depth only, no model-view matrices
+		drawable.PrepareFrame(transforms, subset);
+		transforms.upload();
+		drawable.Draw(shaders, transforms);
+	}
+
+	void createMaps(unsigned int size) {
+		release();
+		mapSize = size;
+		staticMap = createMap(size);
+		GLint previousFramebuffer = 0;
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+	}
+
+	// Depth array with a layer per cascade, sampled with hardware comparison. Outside the map counts as lit.
+	static unsigned int createMap(unsigned int size) {
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, size, size, SHADOW_CASCADES);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		float border[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		return texture;
+	}
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstddef>
+
+// SSE is always there on x64 (MSVC doesn't define __SSE__, hence the _M_X64 check)
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SIMD_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace simd {
+	// out = a * b for column-major 4x4 matrices. Both inputs are fully read before a column of out is written,
+	// so out can alias either of them.
+	inline void mulMat4(const glm::mat4& a, const glm::mat4& b, glm::mat4& out) {
+#ifdef SIMD_SSE
+		const __m128 a0 = _mm_loadu_ps(&a[0][0]);
+		const __m128 a1 = _mm_loadu_ps(&a[1][0]);
+		const __m128 a2 = _mm_loadu_ps(&a[2][0]);
+		const __m128 a3 = _mm_loadu_ps(&a[3][0]);
+		__m128 cols[4];
+		for (int i = 0; i < 4; i++) {
+			const float* col = &b[i][0];
+			__m128 r = _mm_mul_ps(a0, _mm_set1_ps(col[0]));
+			r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(col[1])));
+			r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(col[2])));
+			r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(col[3])));
+			cols[i] = r;
+		}
+		for (int i = 0; i < 4; i++) {
+			_mm_storeu_ps(&out[i][0], cols[i]);
+		}
+#else
+		out = a * b;
+#endif
+	}
+
+	// out[i] = a * b[index[i]] for count matrices. a stays in registers for the whole loop and out is written
+	// contiguously; pass index = nullptr to read b contiguously too.
+	inline void mulMat4Batch(const glm::mat4& a, const glm::mat4* b, const unsigned int* index, glm::mat4* out, size_t count) {
+#ifdef SIMD_SSE
+		const __m128 a0 = _mm_loadu_ps(&a[0][0]);
+		const __m128 a1 = _mm_loadu_ps(&a[1][0]);
+		const __m128 a2 = _mm_loadu_ps(&a[2][0]);
+		const __m128 a3 = _mm_loadu_ps(&a[3][0]);
+		for (size_t n = 0; n < count; n++) {
+			const float* src = &b[index ? index[n] : n][0][0];
+			float* dst = &out[n][0][0];
+			for (int i = 0; i < 4; i++) {
+				const float* col = src + i * 4;
+				__m128 r = _mm_mul_ps(a0, _mm_set1_ps(col[0]));
+				r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(col[1])));
+				r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(col[2])));
+				r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(col[3])));
+				_mm_storeu_ps(dst + i * 4, r);
+			}
+		}
+#else
+		for (size_t n = 0; n < count; n++) {
+			out[n] = a * b[index ? index[n] : n];
+		}
+#endif
+	}
+}
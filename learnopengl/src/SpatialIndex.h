@@ -0,0 +1,377 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+
+// how an index places its items, stored per scene (see Scene.h)
+enum SpatialPartition : uint32_t {
+	PARTITION_GRID = 0,  // hashed loose grid, one level of cells
+	PARTITION_OCTREE = 1 // loose octree, items go as deep as their size allows
+};
+
+// deepest octree level, a cell there is root size / 2^MAX_OCTREE_DEPTH
+const unsigned int MAX_OCTREE_DEPTH = 12;
+
+// The six planes of a view-projection matrix (normals point inwards)
+struct Frustum
+{
+	glm::vec4 planes[6];
+
+	explicit Frustum(const glm::mat4& viewProjection) {
+		for (unsigned int i = 0; i < 3; i++) {
+			for (unsigned int side = 0; side < 2; side++) {
+				glm::vec4& plane = planes[i * 2 + side];
+				for (unsigned int c = 0; c < 4; c++) {
+					float row = viewProjection[c][i];
+					plane[c] = viewProjection[c][3] + (side ? -row : row);
+				}
+				plane /= glm::length(glm::vec3(plane));
+			}
+		}
+	}
+
+	// false only if the box is completely outside one plane (may keep a few boxes that are just outside a corner)
+	bool overlaps(const glm::vec3& min, const glm::vec3& max) const {
+		for (const glm::vec4& plane : planes) {
+			glm::vec3 far(plane.x >= 0.0f ? max.x : min.x, plane.y >= 0.0f ? max.y : min.y, plane.z >= 0.0f ? max.z : min.z);
+			if (glm::dot(glm::vec3(plane), far) + plane.w < 0.0f)
+				return false;
+		}
+		return true;
+	}
+};
+
+// Axis-aligned box around the box min/max after transform (exact for the box, no corner loop)
+inline void transformBounds(const glm::mat4& transform, const glm::vec3& min, const glm::vec3& max, glm::vec3& outMin, glm::vec3& outMax) {
+	glm::vec3 center = glm::vec3(transform * glm::vec4((min + max) * 0.5f, 1.0f));
+	glm::vec3 half = (max - min) * 0.5f;
+	glm::vec3 extent(0.0f);
+	for (unsigned int column = 0; column < 3; column++) {
+		extent += glm::abs(glm::vec3(transform[column])) * half[column];
+	}
+	outMin = center - extent;
+	outMax = center + extent;
+}
+
+struct SpatialHit
+{
+	unsigned int id;
+	float distance; // along the ray to where it enters the bounds
+};
+
+/* Bounds of dynamic objects (scene instances) for frustum, sphere and ray queries, kept up to date incrementally:
+insert, remove and move are O(1) (a bounded number of hash lookups and swap-removes), and a move that stays in the
+same cell only updates the bounds. So nothing is rebuilt per frame, maintenance is proportional to what moved.
+
+Both partitions are loose: a cell owns the items whose bounds' center lies in it, and its bounds for queries are
+twice its size, which holds any item up to the cell size. Items never straddle cells, so placing one is a lookup.
+- PARTITION_GRID: one level of cellSize cells in a hash map, unbounded. Items bigger than a cell are kept in a list
+  tested by every query. Queries test every occupied cell (kept in a list), cells are recycled once they empty.
+- PARTITION_OCTREE: cells from the root (the bounds passed in) down to about cellSize, items go to the level matching
+  their size. Nodes are hashed by level and coordinates too, so inserts don't walk the tree, but queries descend it
+  and skip whole subtrees. Items outside the root go in the oversized list.
+
+Handles are what insert() returns, ids are the caller's (e.g. instance index) and what queries return. */
+class SpatialIndex
+{
+public:
+	SpatialPartition partition = PARTITION_GRID;
+	unsigned int nodesVisited = 0; // by the last query
+	unsigned int relinks = 0;      // moves that changed cell
+
+	SpatialIndex() {}
+
+	// cellSize: grid cell size, or the smallest octree cell. rootMin/rootMax: region the octree covers.
+	SpatialIndex(SpatialPartition partition, float cellSize, const glm::vec3& rootMin = glm::vec3(0.0f), const glm::vec3& rootMax = glm::vec3(0.0f)) {
+		this->partition = partition;
+		this->cellSize = cellSize;
+		if (partition == PARTITION_OCTREE) {
+			float extent = std::max(std::max(rootMax.x - rootMin.x, rootMax.y - rootMin.y), std::max(rootMax.z - rootMin.z, cellSize));
+			depth = 0;
+			rootSize = cellSize;
+			while (rootSize < extent && depth < MAX_OCTREE_DEPTH) {
+				rootSize *= 2.0f;
+				depth++;
+			}
+			this->rootMin = (rootMin + rootMax) * 0.5f - glm::vec3(rootSize * 0.5f);
+			findNode(0, glm::ivec3(0), this->rootMin, rootSize); // node 0, where queries start
+		}
+	}
+
+	unsigned int insert(unsigned int id, const glm::vec3& min, const glm::vec3& max) {
+		unsigned int handle;
+		if (!freeHandles.empty()) {
+			handle = freeHandles.back();
+			freeHandles.pop_back();
+		}
+		else {
+			handle = (unsigned int)items.size();
+			items.push_back(Item());
+		}
+		Item& item = items[handle];
+		item.id = id;
+		item.min = min;
+		item.max = max;
+		link(handle, place(min, max));
+		count++;
+		return handle;
+	}
+
+	void remove(unsigned int handle) {
+		unlink(handle);
+		items[handle].node = FREE_HANDLE;
+		freeHandles.push_back(handle);
+		count--;
+	}
+
+	void move(unsigned int handle, const glm::vec3& min, const glm::vec3& max) {
+		Item& item = items[handle];
+		item.min = min;
+		item.max = max;
+		int node = place(min, max);
+		if (node == item.node)
+			return;
+		relinks++;
+		unlink(handle);
+		link(handle, node);
+	}
+
+	unsigned int size() const {
+		return count;
+	}
+
+	// Appends the ids of everything whose bounds may be visible
+	void queryFrustum(const Frustum& frustum, std::vector<unsigned int>& ids) {
+		query([&](const glm::vec3& min, const glm::vec3& max) { return frustum.overlaps(min, max); }, ids);
+	}
+
+	// Appends the ids of everything whose bounds touch the sphere
+	void querySphere(const glm::vec3& center, float radius, std::vector<unsigned int>& ids) {
+		query([&](const glm::vec3& min, const glm::vec3& max) {
+			glm::vec3 closest = glm::clamp(center, min, max);
+			glm::vec3 offset = closest - center;
+			return glm::dot(offset, offset) <= radius * radius;
+		}, ids);
+	}
+
+	// Everything whose bounds the ray enters within maxDistance, nearest first. direction doesn't need to be normalized,
+	// distances are in multiples of it.
+	void raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, std::vector<SpatialHit>& hits) {
+		glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+		auto enter = [&](const glm::vec3& min, const glm::vec3& max, float& distance) {
+			float near = 0.0f, far = maxDistance;
+			for (unsigned int axis = 0; axis < 3; axis++) {
+				float t0 = (min[axis] - origin[axis]) * inverse[axis];
+				float t1 = (max[axis] - origin[axis]) * inverse[axis];
+				if (t0 > t1)
+					std::swap(t0, t1);
+				near = std::max(near, t0);
+				far = std::min(far, t1);
+				if (near > far) // also false for NaN from a zero direction on an axis where the ray lies on the slab
+					return false;
+			}
+			distance = near;
+			return true;
+		};
+
+		size_t first = hits.size();
+		scratch.clear();
+		float unused;
+		query([&](const glm::vec3& min, const glm::vec3& max) { return enter(min, max, unused); }, scratch);
+		for (unsigned int handle : queryHandles) {
+			float distance;
+			if (enter(items[handle].min, items[handle].max, distance))
+				hits.push_back({ items[handle].id, distance });
+		}
+		std::sort(hits.begin() + first, hits.end(), [](const SpatialHit& a, const SpatialHit& b) { return a.distance < b.distance; });
+	}
+
+private:
+	static const int OVERSIZED = -1;
+	static const int FREE_HANDLE = -2;
+
+	struct Item
+	{
+		unsigned int id = 0;
+		glm::vec3 min;
+		glm::vec3 max;
+		int node = FREE_HANDLE; // or OVERSIZED
+		unsigned int slot = 0;  // position in the node's (or the oversized) item list
+	};
+
+	struct Node
+	{
+		glm::vec3 looseMin; // cell grown by half its size on every side
+		glm::vec3 looseMax;
+		std::vector<unsigned int> items;
+		unsigned int count = 0; // items here and in every node below
+		uint64_t key = 0;
+		unsigned int occupiedSlot = 0; // grid: position in occupied while count > 0
+		int parent = -1;
+		int children[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+	};
+
+	float cellSize = 1.0f;
+	glm::vec3 rootMin = glm::vec3(0.0f);
+	float rootSize = 1.0f;
+	unsigned int depth = 0;
+	unsigned int count = 0;
+	std::vector<Item> items;
+	std::vector<unsigned int> freeHandles;
+	std::vector<Node> nodes;
+	std::unordered_map<uint64_t, int> nodeLookup; // packed level and cell coordinates -> node
+	std::vector<int> occupied;  // grid cells with items, what queries go through
+	std::vector<int> freeNodes; // emptied grid cells, reused by findNode
+	std::vector<unsigned int> oversized;
+	std::vector<unsigned int> queryHandles; // handles the last query returned
+	std::vector<unsigned int> scratch;
+	std::vector<int> nodeStack;
+
+	// 4 bits of level and 20 bits per coordinate (cells within +-512k of the origin, plenty at any sane cell size)
+	static uint64_t nodeKey(unsigned int level, const glm::ivec3& cell) {
+		const int64_t bias = 1 << 19;
+		return ((uint64_t)level << 60) | ((uint64_t)((cell.x + bias) & 0xFFFFF) << 40) | ((uint64_t)((cell.y + bias) & 0xFFFFF) << 20) | (uint64_t)((cell.z + bias) & 0xFFFFF);
+	}
+
+	// Node the bounds belong to (created if needed), or OVERSIZED
+	int place(const glm::vec3& min, const glm::vec3& max) {
+		glm::vec3 center = (min + max) * 0.5f;
+		glm::vec3 half = (max - min) * 0.5f;
+		float extent = std::max(half.x, std::max(half.y, half.z));
+
+		if (partition == PARTITION_GRID) {
+			if (extent > cellSize * 0.5f)
+				return OVERSIZED;
+			glm::ivec3 cell(glm::floor(center / cellSize));
+			return findNode(0, cell, glm::vec3(cell) * cellSize, cellSize);
+		}
+
+		glm::vec3 local = center - rootMin;
+		if (extent > rootSize * 0.5f || glm::any(glm::lessThan(local, glm::vec3(0.0f))) || glm::any(glm::greaterThanEqual(local, glm::vec3(rootSize))))
+			return OVERSIZED;
+		// deepest level whose cells are still at least as big as the item
+		unsigned int level = 0;
+		float size = rootSize;
+		while (level < depth && size * 0.5f >= extent * 2.0f) {
+			size *= 0.5f;
+			level++;
+		}
+		glm::ivec3 cell(glm::floor(local / size));
+		return findNode(level, cell, rootMin + glm::vec3(cell) * size, size);
+	}
+
+	int findNode(unsigned int level, const glm::ivec3& cell, const glm::vec3& cellMin, float size) {
+		uint64_t key = nodeKey(level, cell);
+		auto found = nodeLookup.find(key);
+		if (found != nodeLookup.end())
+			return found->second;
+
+		int index;
+		if (!freeNodes.empty()) {
+			index = freeNodes.back();
+			freeNodes.pop_back();
+			nodes[index] = Node();
+		}
+		else {
+			index = (int)nodes.size();
+			nodes.push_back(Node());
+		}
+		nodes[index].key = key;
+		nodes[index].looseMin = cellMin - glm::vec3(size * 0.5f);
+		nodes[index].looseMax = cellMin + glm::vec3(size * 1.5f);
+		nodeLookup[key] = index;
+
+		// octree nodes hang off their parent (created the same way), so queries can descend from the root
+		if (partition == PARTITION_OCTREE && level > 0) {
+			glm::ivec3 parentCell(cell.x >> 1, cell.y >> 1, cell.z >> 1);
+			int parent = findNode(level - 1, parentCell, rootMin + glm::vec3(parentCell) * (size * 2.0f), size * 2.0f);
+			unsigned int child = (cell.x & 1) | ((cell.y & 1) << 1) | ((cell.z & 1) << 2);
+			nodes[index].parent = parent;
+			nodes[parent].children[child] = index;
+		}
+		return index;
+	}
+
+	void link(unsigned int handle, int node) {
+		Item& item = items[handle];
+		item.node = node;
+		std::vector<unsigned int>& list = node == OVERSIZED ? oversized : nodes[node].items;
+		item.slot = (unsigned int)list.size();
+		list.push_back(handle);
+		if (partition == PARTITION_GRID && node != OVERSIZED && nodes[node].count == 0) {
+			nodes[node].occupiedSlot = (unsigned int)occupied.size();
+			occupied.push_back(node);
+		}
+		for (int n = node; n >= 0; n = nodes[n].parent) {
+			nodes[n].count++;
+		}
+	}
+
+	void unlink(unsigned int handle) {
+		Item& item = items[handle];
+		std::vector<unsigned int>& list = item.node == OVERSIZED ? oversized : nodes[item.node].items;
+		list[item.slot] = list.back();
+		items[list[item.slot]].slot = item.slot;
+		list.pop_back();
+		for (int n = item.node; n >= 0; n = nodes[n].parent) {
+			nodes[n].count--;
+		}
+		// an empty grid cell leaves the occupied list and goes back for reuse, so neither queries nor memory grow
+		// with every cell something has passed through
+		if (partition == PARTITION_GRID && item.node != OVERSIZED && nodes[item.node].count == 0) {
+			Node& node = nodes[item.node];
+			occupied[node.occupiedSlot] = occupied.back();
+			nodes[occupied[node.occupiedSlot]].occupiedSlot = node.occupiedSlot;
+			occupied.pop_back();
+			nodeLookup.erase(node.key);
+			freeNodes.push_back(item.node);
+		}
+	}
+
+	// Items whose bounds pass overlaps(), only looking into cells whose loose bounds pass it too
+	template <typename Test>
+	void query(Test overlaps, std::vector<unsigned int>& ids) {
+		queryHandles.clear();
+		nodesVisited = 0;
+		auto testItems = [&](const std::vector<unsigned int>& list) {
+			for (unsigned int handle : list) {
+				if (overlaps(items[handle].min, items[handle].max))
+					queryHandles.push_back(handle);
+			}
+		};
+		testItems(oversized);
+
+		if (partition == PARTITION_GRID) {
+			for (int index : occupied) {
+				Node& node = nodes[index];
+				nodesVisited++;
+				if (overlaps(node.looseMin, node.looseMax))
+					testItems(node.items);
+			}
+		}
+		else if (!nodes.empty()) {
+			std::vector<int>& stack = nodeStack;
+			stack.assign(1, 0); // the root
+			while (!stack.empty()) {
+				Node& node = nodes[stack.back()];
+				stack.pop_back();
+				nodesVisited++;
+				if (node.count == 0 || !overlaps(node.looseMin, node.looseMax))
+					continue;
+				testItems(node.items);
+				for (int child : node.children) {
+					if (child >= 0)
+						stack.push_back(child);
+				}
+			}
+		}
+
+		for (unsigned int handle : queryHandles) {
+			ids.push_back(items[handle].id);
+		}
+	}
+};
@@ -0,0 +1,176 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+#include "Arena.h"
+
+// frames the ring is split into: the CPU writes one while the GPU may still read the other two
+const unsigned int STREAMING_SEGMENTS = 3;
+// bytes per segment to start with, it grows if a frame needs more
+const size_t STREAMING_SEGMENT_SIZE = 4 * 1024 * 1024;
+
+// Where an allocation went: CPU pointer to write through, plus buffer and byte offset to bind or source it from
+template <typename T>
+struct StreamAllocation
+{
+	Span<T> data;
+	unsigned int buffer = 0;
+	GLintptr offset = 0;
+};
+
+/* Persistently mapped ring for per-frame data (transforms, uniforms, anything rewritten every frame). One buffer
+created with glBufferStorage(PERSISTENT | COHERENT) and mapped once, split into STREAMING_SEGMENTS frame segments.
+Each frame allocates linearly from its segment and fences it at endFrame(); beginFrame() moves to the next segment and
+only waits if the GPU is still reading it, i.e. is STREAMING_SEGMENTS frames behind (stalls are counted). No
+glBufferData orphaning, no mapping per frame.
+
+If a frame needs more than a segment holds, the ring is replaced by one twice the size. The old buffer is kept
+until the GPU is done with this frame, since earlier allocations of it may still be bound. */
+class StreamingBuffer
+{
+public:
+	unsigned int stalls = 0; // beginFrame()s that had to wait for the GPU
+	unsigned int grows = 0;
+
+	// Once per frame on the GL thread, before anything is allocated
+	void beginFrame() {
+		if (buffer == 0)
+			create(STREAMING_SEGMENT_SIZE);
+		segment = (segment + 1) % STREAMING_SEGMENTS;
+		cursor = 0;
+		if (fences[segment]) {
+			if (glClientWaitSync(fences[segment], 0, 0) == GL_TIMEOUT_EXPIRED) {
+				stalls++;
+				while (glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+			}
+			glDeleteSync(fences[segment]);
+			fences[segment] = 0;
+		}
+		deleteRetired(false);
+	}
+
+	// After the frame's last draw that reads from this frame's allocations
+	void endFrame() {
+		if (buffer == 0)
+			return;
+		fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		for (Retired& retired : retiredBuffers) {
+			if (!retired.fence)
+				retired.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+	}
+
+	// Room for count Ts in this frame's segment. Offsets are aligned for any buffer binding (UBO/SSBO offset alignment).
+	template <typename T>
+	StreamAllocation<T> allocate(size_t count) {
+		if (buffer == 0)
+			create(STREAMING_SEGMENT_SIZE);
+		size_t bytes = count * sizeof(T);
+		size_t aligned = (cursor + alignment - 1) / alignment * alignment;
+		if (aligned + bytes > segmentSize) {
+			grow(std::max(segmentSize * 2, bytes + alignment));
+			aligned = 0;
+		}
+		cursor = aligned + bytes;
+
+		StreamAllocation<T> allocation;
+		allocation.offset = (GLintptr)(segment * segmentSize + aligned);
+		allocation.data = { (T*)(mapped + allocation.offset), count };
+		allocation.buffer = buffer;
+		return allocation;
+	}
+
+	// Frees the ring once the GPU is done with it (not done by the destructor, which runs after the context is gone)
+	void release() {
+		glFinish();
+		deleteRetired(true);
+		for (GLsync& fence : fences) {
+			if (fence)
+				glDeleteSync(fence);
+			fence = 0;
+		}
+		if (buffer) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			glDeleteBuffers(1, &buffer);
+		}
+		buffer = 0;
+		mapped = nullptr;
+	}
+
+	size_t capacity() const {
+		return segmentSize * STREAMING_SEGMENTS;
+	}
+
+private:
+	struct Retired
+	{
+		unsigned int buffer;
+		GLsync fence; // set at the endFrame() of the frame that replaced it
+	};
+
+	unsigned int buffer = 0;
+	unsigned char* mapped = nullptr;
+	size_t segmentSize = 0;
+	size_t alignment = 256;
+	unsigned int segment = 0;
+	size_t cursor = 0; // bytes used in the current segment
+	GLsync fences[STREAMING_SEGMENTS] = {};
+	std::vector<Retired> retiredBuffers;
+
+	void create(size_t size) {
+		GLint uniformAlignment = 0, storageAlignment = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+		alignment = (size_t)std::max({ uniformAlignment, storageAlignment, 64 });
+		segmentSize = (size + alignment - 1) / alignment * alignment;
+
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferStorage(GL_COPY_WRITE_BUFFER, segmentSize * STREAMING_SEGMENTS, nullptr, flags);
+		mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, segmentSize * STREAMING_SEGMENTS, flags);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		if (!mapped)
+			std::cout << "ERROR::STREAMING_BUFFER::MAP_FAILED" << std::endl;
+	}
+
+	// Swap in a bigger ring mid-frame. Segment fences belong to the old buffer, the new one is all free.
+	void grow(size_t size) {
+		grows++;
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		retiredBuffers.push_back({ buffer, 0 });
+		for (GLsync& fence : fences) {
+			if (fence)
+				glDeleteSync(fence);
+			fence = 0;
+		}
+		create(size);
+	}
+
+	void deleteRetired(bool all) {
+		for (size_t i = 0; i < retiredBuffers.size();) {
+			Retired& retired = retiredBuffers[i];
+			bool done = all || (retired.fence && glClientWaitSync(retired.fence, 0, 0) != GL_TIMEOUT_EXPIRED);
+			if (!done) {
+				i++;
+				continue;
+			}
+			if (retired.fence)
+				glDeleteSync(retired.fence);
+			glDeleteBuffers(1, &retired.buffer);
+			retiredBuffers.erase(retiredBuffers.begin() + i);
+		}
+	}
+};
+
+inline StreamingBuffer& streamingBuffer() {
+	static StreamingBuffer ring;
+	return ring;
+}
@@ -0,0 +1,277 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <algorithm>
+#include "Mesh.h"
+#include "Arena.h"
+#include "SimdMath.h"
+
+// triangles whose per-face terms are computed together (4 at a time with SSE) before they get added to their vertices
+const unsigned int TANGENT_BLOCK = 256;
+
+/* Normals and tangents for primitives that don't come with them, written into their assembled Vertex range in place.
+Each primitive is independent, Model::uploadBatch runs them on the worker pool.
+
+Normals are area-weighted face normals summed per vertex: smooth over shared vertices, flat when every triangle has
+vertices of its own (glTF asks for flat normals, Model::loadPrimitive unwelds primitives for that unless
+LEARNOPENGL_SMOOTH_NORMALS is set).
+
+Tangents follow MikkTSpace, the convention glTF and the usual bakers use, so their normal maps come out right: per
+corner, the face's direction of increasing u is projected into the vertex normal's plane and weighted by the corner
+angle, w holds the sign of the bitangent, and the shader rebuilds the bitangent as w * cross(N, T) per pixel from the
+unnormalized interpolated vectors. Unlike the reference implementation, vertices shared between mirrored UV islands
+aren't split, they get the handedness the bigger angle sum asks for. */
+
+// LEARNOPENGL_SMOOTH_NORMALS: generate smooth normals over the vertices a primitive shares instead of flat ones
+inline bool smoothGeneratedNormals() {
+	static bool smooth = std::getenv("LEARNOPENGL_SMOOTH_NORMALS") != nullptr;
+	return smooth;
+}
+
+// Per-face terms of one block, structure of arrays so the SSE path can store lanes directly
+struct FaceBlock
+{
+	float nx[TANGENT_BLOCK], ny[TANGENT_BLOCK], nz[TANGENT_BLOCK]; // normals: cross(e1, e2), length is twice the area
+	float sx[TANGENT_BLOCK], sy[TANGENT_BLOCK], sz[TANGENT_BLOCK]; // tangents: direction of increasing u
+	float tx[TANGENT_BLOCK], ty[TANGENT_BLOCK], tz[TANGENT_BLOCK]; // direction of increasing v
+	float angle[3][TANGENT_BLOCK];                                   // at each corner, in radians
+};
+
+#ifdef SIMD_SSE
+namespace simd {
+	// x, y and z of four triangles, one per lane
+	struct Lanes3
+	{
+		__m128 x, y, z;
+	};
+
+	inline Lanes3 sub(const Lanes3& a, const Lanes3& b) {
+		return { _mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z) };
+	}
+
+	inline __m128 dot(const Lanes3& a, const Lanes3& b) {
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+	}
+
+	inline Lanes3 cross(const Lanes3& a, const Lanes3& b) {
+		return {
+			_mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+			_mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(a.x, b.z)),
+			_mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x)),
+		};
+	}
+
+	// a * s - b * t
+	inline Lanes3 mulSub(const Lanes3& a, __m128 s, const Lanes3& b, __m128 t) {
+		return {
+			_mm_sub_ps(_mm_mul_ps(a.x, s), _mm_mul_ps(b.x, t)),
+			_mm_sub_ps(_mm_mul_ps(a.y, s), _mm_mul_ps(b.y, t)),
+			_mm_sub_ps(_mm_mul_ps(a.z, s), _mm_mul_ps(b.z, t)),
+		};
+	}
+
+	inline void store(const Lanes3& a, float* x, float* y, float* z) {
+		_mm_storeu_ps(x, a.x);
+		_mm_storeu_ps(y, a.y);
+		_mm_storeu_ps(z, a.z);
+	}
+
+	// Float at byte offset of the corner's vertex of each of four consecutive triangles
+	inline __m128 gather(const Vertex* vertices, const unsigned int* triangles, unsigned int corner, size_t offset) {
+		auto at = [&](unsigned int lane) {
+			return *(const float*)((const char*)&vertices[triangles[lane * 3 + corner]] + offset);
+		};
+		return _mm_setr_ps(at(0), at(1), at(2), at(3));
+	}
+
+	inline Lanes3 gatherPosition(const Vertex* vertices, const unsigned int* triangles, unsigned int corner) {
+		size_t offset = offsetof(Vertex, Position);
+		return {
+			gather(vertices, triangles, corner, offset),
+			gather(vertices, triangles, corner, offset + sizeof(float)),
+			gather(vertices, triangles, corner, offset + 2 * sizeof(float)),
+		};
+	}
+
+	// acos to within 7e-5 rad (Abramowitz & Stegun 4.4.45), x in [-1, 1]
+	inline __m128 acos(__m128 x) {
+		const __m128 sign = _mm_set1_ps(-0.0f);
+		__m128 a = _mm_andnot_ps(sign, x);
+		__m128 p = _mm_set1_ps(-0.0187293f);
+		p = _mm_add_ps(_mm_mul_ps(p, a), _mm_set1_ps(0.0742610f));
+		p = _mm_add_ps(_mm_mul_ps(p, a), _mm_set1_ps(-0.2121144f));
+		p = _mm_add_ps(_mm_mul_ps(p, a), _mm_set1_ps(1.5707288f));
+		p = _mm_mul_ps(p, _mm_sqrt_ps(_mm_sub_ps(_mm_set1_ps(1.0f), a)));
+		__m128 negative = _mm_cmplt_ps(x, _mm_setzero_ps());
+		return _mm_or_ps(_mm_and_ps(negative, _mm_sub_ps(_mm_set1_ps(3.14159265f), p)), _mm_andnot_ps(negative, p));
+	}
+
+	// Angle between a and b (lengths la and lb), 0 when either is degenerate
+	inline __m128 angleBetween(__m128 dot, __m128 la, __m128 lb) {
+		__m128 lengths = _mm_mul_ps(la, lb);
+		__m128 valid = _mm_cmpgt_ps(lengths, _mm_set1_ps(1e-30f));
+		__m128 c = _mm_div_ps(dot, _mm_max_ps(lengths, _mm_set1_ps(1e-30f)));
+		c = _mm_min_ps(_mm_max_ps(c, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+		return _mm_and_ps(valid, acos(c));
+	}
+}
+#endif
+
+// Face normals of triangles [0, count) of indices (count <= TANGENT_BLOCK)
+inline void faceNormals(const Vertex* vertices, const unsigned int* indices, unsigned int count, FaceBlock& out) {
+	unsigned int t = 0;
+#ifdef SIMD_SSE
+	for (; t + 4 <= count; t += 4) {
+		const unsigned int* triangles = indices + t * 3;
+		simd::Lanes3 p0 = simd::gatherPosition(vertices, triangles, 0);
+		simd::Lanes3 n = simd::cross(simd::sub(simd::gatherPosition(vertices, triangles, 1), p0), simd::sub(simd::gatherPosition(vertices, triangles, 2), p0));
+		simd::store(n, out.nx + t, out.ny + t, out.nz + t);
+	}
+#endif
+	for (; t < count; t++) {
+		const unsigned int* triangle = indices + t * 3;
+		const glm::vec3& p0 = vertices[triangle[0]].Position;
+		glm::vec3 n = glm::cross(vertices[triangle[1]].Position - p0, vertices[triangle[2]].Position - p0);
+		out.nx[t] = n.x;
+		out.ny[t] = n.y;
+		out.nz[t] = n.z;
+	}
+}
+
+// UV-aligned directions and corner angles of triangles [0, count) of indices (count <= TANGENT_BLOCK). Triangles
+// with degenerate UVs get zero directions, so they don't pull on their vertices.
+inline void faceTangents(const Vertex* vertices, const unsigned int* indices, unsigned int count, FaceBlock& out) {
+	unsigned int t = 0;
+#ifdef SIMD_SSE
+	for (; t + 4 <= count; t += 4) {
+		const unsigned int* triangles = indices + t * 3;
+		simd::Lanes3 p0 = simd::gatherPosition(vertices, triangles, 0);
+		simd::Lanes3 p1 = simd::gatherPosition(vertices, triangles, 1);
+		simd::Lanes3 p2 = simd::gatherPosition(vertices, triangles, 2);
+		size_t u = offsetof(Vertex, TexCoords), v = u + sizeof(float);
+		__m128 u0 = simd::gather(vertices, triangles, 0, u), v0 = simd::gather(vertices, triangles, 0, v);
+		__m128 du1 = _mm_sub_ps(simd::gather(vertices, triangles, 1, u), u0);
+		__m128 dv1 = _mm_sub_ps(simd::gather(vertices, triangles, 1, v), v0);
+		__m128 du2 = _mm_sub_ps(simd::gather(vertices, triangles, 2, u), u0);
+		__m128 dv2 = _mm_sub_ps(simd::gather(vertices, triangles, 2, v), v0);
+
+		simd::Lanes3 e1 = simd::sub(p1, p0), e2 = simd::sub(p2, p0), e3 = simd::sub(p2, p1);
+		__m128 r = _mm_sub_ps(_mm_mul_ps(du1, dv2), _mm_mul_ps(du2, dv1));
+		__m128 valid = _mm_cmpgt_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), r), _mm_set1_ps(1e-20f));
+		__m128 inverse = _mm_and_ps(valid, _mm_div_ps(_mm_set1_ps(1.0f), r));
+		simd::Lanes3 s = simd::mulSub(e1, _mm_mul_ps(dv2, inverse), e2, _mm_mul_ps(dv1, inverse));
+		simd::Lanes3 b = simd::mulSub(e2, _mm_mul_ps(du1, inverse), e1, _mm_mul_ps(du2, inverse));
+		simd::store(s, out.sx + t, out.sy + t, out.sz + t);
+		simd::store(b, out.tx + t, out.ty + t, out.tz + t);
+
+		__m128 l1 = _mm_sqrt_ps(simd::dot(e1, e1)), l2 = _mm_sqrt_ps(simd::dot(e2, e2)), l3 = _mm_sqrt_ps(simd::dot(e3, e3));
+		__m128 negate = _mm_set1_ps(-0.0f);
+		_mm_storeu_ps(out.angle[0] + t, simd::angleBetween(simd::dot(e1, e2), l1, l2));
+		_mm_storeu_ps(out.angle[1] + t, simd::angleBetween(_mm_xor_ps(simd::dot(e1, e3), negate), l1, l3));
+		_mm_storeu_ps(out.angle[2] + t, simd::angleBetween(simd::dot(e2, e3), l2, l3));
+	}
+#endif
+	for (; t < count; t++) {
+		const unsigned int* triangle = indices + t * 3;
+		const Vertex& a = vertices[triangle[0]];
+		const Vertex& b = vertices[triangle[1]];
+		const Vertex& c = vertices[triangle[2]];
+		glm::vec3 e1 = b.Position - a.Position, e2 = c.Position - a.Position, e3 = c.Position - b.Position;
+		glm::vec2 d1 = b.TexCoords - a.TexCoords, d2 = c.TexCoords - a.TexCoords;
+		float r = d1.x * d2.y - d2.x * d1.y;
+		float inverse = std::abs(r) > 1e-20f ? 1.0f / r : 0.0f;
+		glm::vec3 s = (e1 * d2.y - e2 * d1.y) * inverse;
+		glm::vec3 v = (e2 * d1.x - e1 * d2.x) * inverse;
+		out.sx[t] = s.x; out.sy[t] = s.y; out.sz[t] = s.z;
+		out.tx[t] = v.x; out.ty[t] = v.y; out.tz[t] = v.z;
+
+		float l1 = glm::length(e1), l2 = glm::length(e2), l3 = glm::length(e3);
+		auto angle = [](float dot, float la, float lb) {
+			return la * lb > 1e-30f ? std::acos(std::min(std::max(dot / (la * lb), -1.0f), 1.0f)) : 0.0f;
+		};
+		out.angle[0][t] = angle(glm::dot(e1, e2), l1, l2);
+		out.angle[1][t] = angle(-glm::dot(e1, e3), l1, l3);
+		out.angle[2][t] = angle(glm::dot(e2, e3), l2, l3);
+	}
+}
+
+// Normal of vertices [0, vertexCount) from the triangles in indices, which have to be in range
+inline void generateNormals(Vertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount) {
+	for (unsigned int i = 0; i < vertexCount; i++) {
+		vertices[i].Normal = glm::vec3(0.0f);
+	}
+	FaceBlock block;
+	unsigned int triangles = indexCount / 3;
+	for (unsigned int first = 0; first < triangles; first += TANGENT_BLOCK) {
+		unsigned int count = std::min(TANGENT_BLOCK, triangles - first);
+		const unsigned int* triangle = indices + first * 3;
+		faceNormals(vertices, triangle, count, block);
+		for (unsigned int t = 0; t < count; t++) {
+			glm::vec3 n(block.nx[t], block.ny[t], block.nz[t]);
+			for (unsigned int c = 0; c < 3; c++) {
+				vertices[triangle[t * 3 + c]].Normal += n;
+			}
+		}
+	}
+	// vertices without (non-degenerate) triangles still need a unit normal
+	for (unsigned int i = 0; i < vertexCount; i++) {
+		float length = glm::length(vertices[i].Normal);
+		vertices[i].Normal = length > 0.0f ? vertices[i].Normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+	}
+}
+
+// Tangent of vertices [0, vertexCount) from their (unit) normals, texture coordinates and the triangles in indices,
+// which have to be in range. Scratch comes from the calling thread's load arena.
+inline void generateTangents(Vertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount) {
+	LinearArena& arena = loadArena();
+	LinearArena::Marker marker = arena.mark();
+	Span<glm::vec3> tangents = arena.allocate<glm::vec3>(vertexCount);
+	Span<glm::vec3> bitangents = arena.allocate<glm::vec3>(vertexCount);
+	std::fill(tangents.begin(), tangents.end(), glm::vec3(0.0f));
+	std::fill(bitangents.begin(), bitangents.end(), glm::vec3(0.0f));
+
+	FaceBlock block;
+	unsigned int triangles = indexCount / 3;
+	for (unsigned int first = 0; first < triangles; first += TANGENT_BLOCK) {
+		unsigned int count = std::min(TANGENT_BLOCK, triangles - first);
+		const unsigned int* triangle = indices + first * 3;
+		faceTangents(vertices, triangle, count, block);
+		for (unsigned int t = 0; t < count; t++) {
+			glm::vec3 s(block.sx[t], block.sy[t], block.sz[t]);
+			// only the bitangent's side matters, so every face gets the same say however dense its UVs are
+			glm::vec3 b(block.tx[t], block.ty[t], block.tz[t]);
+			float bLength = glm::length(b);
+			if (bLength > 0.0f)
+				b /= bLength;
+			for (unsigned int c = 0; c < 3; c++) {
+				unsigned int v = triangle[t * 3 + c];
+				float angle = block.angle[c][t];
+				const glm::vec3& n = vertices[v].Normal;
+				glm::vec3 projected = s - n * glm::dot(n, s);
+				float length = glm::length(projected);
+				if (length > 1e-20f)
+					tangents[v] += projected * (angle / length);
+				bitangents[v] += b * angle;
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < vertexCount; i++) {
+		const glm::vec3& n = vertices[i].Normal;
+		glm::vec3 t = tangents[i] - n * glm::dot(n, tangents[i]);
+		float length = glm::length(t);
+		if (length > 1e-20f) {
+			t /= length;
+		}
+		else {
+			// no usable UVs around this vertex: any unit vector in the normal's plane keeps the frame valid
+			t = glm::normalize(glm::cross(n, std::abs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f)));
+		}
+		float w = glm::dot(glm::cross(n, t), bitangents[i]) < 0.0f ? -1.0f : 1.0f;
+		vertices[i].Tangent = glm::vec4(t, w);
+	}
+	arena.rewind(marker);
+}
@@ -0,0 +1,298 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <map>
+#include <deque>
+#include <tuple>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+#include "KTX2.h"
+
+// textures up to this size (both sides) that repeat go into atlas pages instead of an array of their own size
+const unsigned int ATLAS_MAX_SIZE = 256;
+const unsigned int ATLAS_PAGE_SIZE = 2048;
+// gutter around every atlas entry, filled by wrapping the entry so bilinear filtering and repeat still work
+const unsigned int ATLAS_PADDING = 8;
+// mips an atlas page keeps: the last one still has a texel of gutter (and entries are aligned to match)
+const unsigned int ATLAS_LEVELS = 4;
+
+// Where a pooled texture ended up
+struct TextureLayer
+{
+	unsigned int array = 0; // GL_TEXTURE_2D_ARRAY name
+	unsigned int layer = 0;
+	glm::vec4 rect = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f); // atlas entries: uv scale (xy) and offset (zw) in the layer
+	bool atlas = false;
+};
+
+struct StagedTexture
+{
+	unsigned int width, height;
+	GLenum format; // GL_RGBA8 or one of the KTX2 block formats
+	std::vector<std::vector<unsigned char>> levels; // RGBA8 only stages level 0, mips are generated per array
+	GLenum wrapS, wrapT, minFilter, magFilter;
+	TextureLayer result;
+};
+
+/* Packs a model's textures into GL_TEXTURE_2D_ARRAYs so materials refer to (array, layer) instead of a texture of
+their own, and draws sharing arrays don't need any texture binds in between. Textures are staged while the model loads
+and build() (or plan(), then buildNext() once per array) creates the arrays with exact layer counts once everything
+is known:
+- same size, format, mip count and sampler -> layers of one array
+- small repeating RGBA8 textures -> shelf-packed into atlas pages (layers of a page array), the shader remaps the uv
+  with TextureLayer::rect and wraps it itself, so the sampler's repeat never crosses into a neighbour */
+class TextureArrayPool
+{
+public:
+	uint64_t gpuBytes = 0; // storage of the built arrays, mips included (RGBA8 mips estimated as a third extra)
+
+	// Takes a copy of width * height RGBA8 pixels, returns the entry to look up after build()
+	unsigned int stage(const unsigned char* rgba, unsigned int width, unsigned int height, GLenum wrapS, GLenum wrapT, GLenum minFilter, GLenum magFilter) {
+		StagedTexture texture = stagedWith(width, height, GL_RGBA8, wrapS, wrapT, minFilter, magFilter);
+		texture.levels.push_back(std::vector<unsigned char>(rgba, rgba + (size_t)width * height * 4));
+		staged.push_back(texture);
+		return (unsigned int)staged.size() - 1;
+	}
+
+	// A cooked texture with all its mips, false if a level can't be read
+	bool stage(const Ktx2File& file, GLenum wrapS, GLenum wrapT, GLenum minFilter, GLenum magFilter, unsigned int& entry) {
+		StagedTexture texture = stagedWith(file.width, file.height, ktx2GLFormat(file.vkFormat), wrapS, wrapT, minFilter, magFilter);
+		for (unsigned int level = 0; level < file.levels.size(); level++) {
+			texture.levels.push_back(file.readLevel(level));
+			if (texture.levels.back().empty())
+				return false;
+		}
+		staged.push_back(texture);
+		entry = (unsigned int)staged.size() - 1;
+		return true;
+	}
+
+	// Create and fill every array at once, see plan() and buildNext() for doing it one array at a time
+	void build() {
+		plan();
+		while (buildNext());
+	}
+
+	// Groups what's staged into arrays and atlases, returns how many buildNext() calls it takes to build them all
+	unsigned int plan() {
+		pending.clear();
+		if (staged.empty())
+			return 0;
+		GLint maxLayers = 256;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+		this->maxLayers = (unsigned int)maxLayers;
+
+		// group by everything an array has to share, atlas candidates only need the same filters
+		typedef std::tuple<unsigned int, unsigned int, GLenum, unsigned int, GLenum, GLenum, GLenum, GLenum> ArrayKey;
+		std::map<ArrayKey, std::vector<unsigned int>> arrayGroups;
+		std::map<std::pair<GLenum, GLenum>, std::vector<unsigned int>> atlasGroups;
+		for (unsigned int i = 0; i < staged.size(); i++) {
+			const StagedTexture& t = staged[i];
+			if (fitsAtlas(t)) {
+				atlasGroups[std::make_pair(t.minFilter, t.magFilter)].push_back(i);
+			}
+			else {
+				arrayGroups[ArrayKey(t.width, t.height, t.format, (unsigned int)t.levels.size(), t.wrapS, t.wrapT, t.minFilter, t.magFilter)].push_back(i);
+			}
+		}
+
+		for (auto& group : arrayGroups) {
+			for (size_t first = 0; first < group.second.size(); first += maxLayers) {
+				size_t last = std::min(group.second.size(), first + (size_t)maxLayers);
+				pending.push_back({ std::vector<unsigned int>(group.second.begin() + first, group.second.begin() + last), false });
+			}
+		}
+		for (auto& group : atlasGroups) {
+			pending.push_back({ group.second, true });
+		}
+		return (unsigned int)pending.size();
+	}
+
+	// Creates and fills the next planned array (or atlas) and drops its textures' staged pixels, false once none are left
+	bool buildNext() {
+		if (pending.empty())
+			return false;
+		PendingArray next = std::move(pending.front());
+		pending.pop_front();
+		if (next.atlas)
+			buildAtlas(next.members, maxLayers);
+		else
+			buildArray(next.members);
+		for (unsigned int entry : next.members) {
+			std::vector<std::vector<unsigned char>>().swap(staged[entry].levels);
+		}
+		return !pending.empty();
+	}
+
+	const TextureLayer& get(unsigned int entry) const {
+		return staged[entry].result;
+	}
+
+	unsigned int arrayCount() const {
+		return (unsigned int)arrays.size();
+	}
+
+	void release() {
+		glDeleteTextures((GLsizei)arrays.size(), arrays.data());
+		arrays.clear();
+		gpuBytes = 0;
+	}
+
+private:
+	std::vector<StagedTexture> staged;
+	std::vector<unsigned int> arrays;
+	unsigned int atlasPages = 0;
+
+	// arrays plan() grouped and buildNext() hasn't built yet
+	struct PendingArray {
+		std::vector<unsigned int> members;
+		bool atlas;
+	};
+	std::deque<PendingArray> pending;
+	unsigned int maxLayers = 256;
+
+	static StagedTexture stagedWith(unsigned int width, unsigned int height, GLenum format, GLenum wrapS, GLenum wrapT, GLenum minFilter, GLenum magFilter) {
+		StagedTexture texture;
+		texture.width = width;
+		texture.height = height;
+		texture.format = format;
+		texture.wrapS = wrapS;
+		texture.wrapT = wrapT;
+		texture.minFilter = minFilter;
+		texture.magFilter = magFilter;
+		return texture;
+	}
+
+	// clamped/mirrored textures keep their own array, the shader only does repeat by hand
+	static bool fitsAtlas(const StagedTexture& texture) {
+		return texture.format == GL_RGBA8 && texture.width <= ATLAS_MAX_SIZE && texture.height <= ATLAS_MAX_SIZE
+			&& texture.wrapS == GL_REPEAT && texture.wrapT == GL_REPEAT;
+	}
+
+	static unsigned int fullMipCount(unsigned int width, unsigned int height) {
+		unsigned int levels = 1;
+		while ((std::max(width, height) >> levels) > 0) {
+			levels++;
+		}
+		return levels;
+	}
+
+	static void setSampler(const StagedTexture& texture, GLenum wrapS, GLenum wrapT) {
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrapS);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrapT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, texture.minFilter);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, texture.magFilter);
+	}
+
+	// Textures that share size, format and sampler, one layer each
+	void buildArray(const std::vector<unsigned int>& members) {
+		const StagedTexture& first = staged[members[0]];
+		bool compressed = first.format != GL_RGBA8;
+		unsigned int levels = compressed ? (unsigned int)first.levels.size() : fullMipCount(first.width, first.height);
+
+		unsigned int id;
+		glGenTextures(1, &id);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, id);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, first.format, first.width, first.height, (GLsizei)members.size());
+		for (unsigned int layer = 0; layer < members.size(); layer++) {
+			StagedTexture& texture = staged[members[layer]];
+			for (unsigned int level = 0; level < texture.levels.size(); level++) {
+				unsigned int width = std::max(texture.width >> level, 1u);
+				unsigned int height = std::max(texture.height >> level, 1u);
+				const std::vector<unsigned char>& data = texture.levels[level];
+				if (compressed)
+					glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, texture.format, (GLsizei)data.size(), data.data());
+				else
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+				gpuBytes += compressed ? data.size() : data.size() * 4 / 3;
+			}
+			texture.result.array = id;
+			texture.result.layer = layer;
+		}
+		if (!compressed)
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		setSampler(first, first.wrapS, first.wrapT);
+		arrays.push_back(id);
+	}
+
+	/* Shelf packing, tallest first. Every entry gets ATLAS_PADDING texels of wrapped gutter on each side and starts on
+	a multiple of 2^(ATLAS_LEVELS - 1), so its edges stay on texel boundaries down to the last mip. */
+	void buildAtlas(std::vector<unsigned int> members, unsigned int maxLayers) {
+		const unsigned int align = 1u << (ATLAS_LEVELS - 1);
+		std::stable_sort(members.begin(), members.end(), [this](unsigned int a, unsigned int b) {
+			return staged[a].height > staged[b].height;
+		});
+
+		// place everything first, the layer count has to be known before allocating
+		struct Placement { unsigned int entry, page, x, y; };
+		std::vector<Placement> placements;
+		unsigned int page = 0, x = 0, y = 0, shelfHeight = 0;
+		for (unsigned int entry : members) {
+			const StagedTexture& texture = staged[entry];
+			unsigned int width = (texture.width + 2 * ATLAS_PADDING + align - 1) / align * align;
+			unsigned int height = (texture.height + 2 * ATLAS_PADDING + align - 1) / align * align;
+			if (x + width > ATLAS_PAGE_SIZE) { // next shelf
+				x = 0;
+				y += shelfHeight;
+				shelfHeight = 0;
+			}
+			if (y + height > ATLAS_PAGE_SIZE) { // next page
+				page++;
+				x = y = shelfHeight = 0;
+			}
+			placements.push_back({ entry, page, x, y });
+			x += width;
+			shelfHeight = std::max(shelfHeight, height);
+		}
+		unsigned int pageCount = std::min(page + 1, maxLayers);
+		if (page + 1 > maxLayers)
+			std::cout << "ERROR::TEXTURE_ARRAYS::TOO_MANY_ATLAS_PAGES " << page + 1 << std::endl;
+
+		unsigned int id;
+		glGenTextures(1, &id);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, id);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, ATLAS_LEVELS, GL_RGBA8, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, pageCount);
+		gpuBytes += (uint64_t)ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE * 4 * 4 / 3 * pageCount;
+
+		std::vector<unsigned char> pixels((size_t)ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE * 4);
+		for (unsigned int p = 0; p < pageCount; p++) {
+			std::fill(pixels.begin(), pixels.end(), (unsigned char)0);
+			for (const Placement& placement : placements) {
+				if (placement.page != p)
+					continue;
+				StagedTexture& texture = staged[placement.entry];
+				blitWrapped(texture, pixels, placement.x, placement.y);
+				texture.result.array = id;
+				texture.result.layer = p;
+				texture.result.atlas = true;
+				texture.result.rect = glm::vec4((float)texture.width, (float)texture.height,
+					(float)(placement.x + ATLAS_PADDING), (float)(placement.y + ATLAS_PADDING)) / (float)ATLAS_PAGE_SIZE;
+			}
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, p, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		}
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, ATLAS_LEVELS - 1);
+		// clamp: wrapping happens per entry in the shader
+		setSampler(staged[members[0]], GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+		arrays.push_back(id);
+		atlasPages += pageCount;
+	}
+
+	// Copy a texture into a page at (x, y) + padding, with the gutter taken from the opposite edges
+	static void blitWrapped(const StagedTexture& texture, std::vector<unsigned char>& page, unsigned int x, unsigned int y) {
+		const unsigned char* source = texture.levels[0].data();
+		int padding = (int)ATLAS_PADDING;
+		for (int row = -padding; row < (int)texture.height + padding; row++) {
+			unsigned int sourceRow = (unsigned int)((row % (int)texture.height + (int)texture.height) % (int)texture.height);
+			unsigned char* out = &page[(((size_t)y + padding + row) * ATLAS_PAGE_SIZE + x) * 4];
+			for (int column = -padding; column < (int)texture.width + padding; column++) {
+				unsigned int sourceColumn = (unsigned int)((column % (int)texture.width + (int)texture.width) % (int)texture.width);
+				std::memcpy(out + (size_t)(column + padding) * 4, source + ((size_t)sourceRow * texture.width + sourceColumn) * 4, 4);
+			}
+		}
+	}
+};
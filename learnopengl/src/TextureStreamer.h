@@ -0,0 +1,364 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include "KTX2.h"
+#include "Material.h"
+#include "ThreadPool.h"
+
+// levels up to this size are uploaded at load and never evicted
+const unsigned int STREAMING_TAIL_SIZE = 128;
+// at most this many residency changes hit the GPU per frame
+const unsigned int STREAMING_UPLOADS_PER_FRAME = 4;
+const uint64_t DEFAULT_TEXTURE_BUDGET_MB = 512;
+
+struct StreamingStats
+{
+	uint64_t budgetBytes = 0;
+	uint64_t residentBytes = 0;
+	uint64_t fullResolutionBytes = 0; // what everything would take fully resident
+	unsigned int textures = 0;
+	unsigned int fullyResident = 0;
+	unsigned int loading = 0;
+	unsigned int uploads = 0; // since start
+	unsigned int evictions = 0; // since start
+};
+
+struct StreamedTexture
+{
+	Ktx2File file;
+	GLenum format;
+	GLenum wrapS, wrapT, minFilter, magFilter;
+	unsigned int id = 0;
+	unsigned int residentTop; // finest level currently in VRAM
+	unsigned int tailTop; // finest level of the always-resident tail
+	unsigned int wantedTop; // finest level asked for last frame
+	unsigned int frameWanted; // being accumulated this frame
+	uint64_t lastUsed = 0; // frame of the last request
+	bool loading = false;
+	bool removed = false; // slot waiting for reuse (once its last load is back)
+};
+
+// levels [top, oldTop) of a texture, read from disk by a worker
+struct LoadedLevels
+{
+	unsigned int texture;
+	unsigned int top;
+	std::vector<std::vector<unsigned char>> levels;
+};
+
+/* Mip streaming for cooked (KTX2) textures. A texture starts with only its small mip tail in VRAM. Every frame the
+renderer reports how many pixels each texture covers on screen (requestPixels), update() turns that into the finest
+level worth having, reads missing levels from disk on the worker pool and swaps them in, evicting the least recently
+used textures' top levels whenever the resident total would go over budget.
+
+Changing residency reallocates the texture with exactly the resident levels (glTexStorage2D + glCopyImageSubData for
+the levels it already had), so evicted memory really is freed. That changes the GL name, so material tables holding
+it are registered as listeners and patched. Budget comes from LEARNOPENGL_TEXTURE_BUDGET_MB if set, 0 turns streaming off. */
+class TextureStreamer
+{
+public:
+	uint64_t budget;
+
+	TextureStreamer() {
+		const char* env = std::getenv("LEARNOPENGL_TEXTURE_BUDGET_MB");
+		uint64_t mb = env ? std::strtoull(env, nullptr, 10) : DEFAULT_TEXTURE_BUDGET_MB;
+		budget = mb * 1024 * 1024;
+	}
+
+	~TextureStreamer() {
+		// loads in flight point back at us
+		while (inFlight.load() > 0) {
+			if (!workerPool().runPendingJob())
+				std::this_thread::yield();
+		}
+	}
+
+	// Takes over a cooked texture, uploads its tail and returns the GL name (0 if the file can't be used)
+	unsigned int add(const std::string& ktxPath, GLenum wrapS, GLenum wrapT, GLenum minFilter, GLenum magFilter) {
+		StreamedTexture texture;
+		if (!texture.file.open(ktxPath))
+			return 0;
+		texture.format = ktx2GLFormat(texture.file.vkFormat);
+		texture.wrapS = wrapS;
+		texture.wrapT = wrapT;
+		texture.minFilter = minFilter;
+		texture.magFilter = magFilter;
+
+		unsigned int levelCount = (unsigned int)texture.file.levels.size();
+		texture.tailTop = levelCount - 1;
+		while (texture.tailTop > 0 && std::max(texture.file.levels[texture.tailTop - 1].width, texture.file.levels[texture.tailTop - 1].height) <= STREAMING_TAIL_SIZE) {
+			texture.tailTop--;
+		}
+		texture.residentTop = levelCount; // nothing yet
+		texture.wantedTop = texture.frameWanted = texture.tailTop;
+
+		LoadedLevels tail;
+		tail.top = texture.tailTop;
+		for (unsigned int level = tail.top; level < levelCount; level++) {
+			tail.levels.push_back(texture.file.readLevel(level));
+			if (tail.levels.back().empty())
+				return 0;
+		}
+
+		if (!freeSlots.empty()) {
+			tail.texture = freeSlots.back();
+			freeSlots.pop_back();
+			textures[tail.texture] = texture;
+		}
+		else {
+			tail.texture = (unsigned int)textures.size();
+			textures.push_back(texture);
+		}
+		applyLevels(tail);
+		return textures[tail.texture].id;
+	}
+
+	// Deletes a texture add() returned (by its current name), e.g. when its model is released. Unknown names are ignored.
+	void remove(unsigned int id) {
+		auto found = byId.find(id);
+		if (found == byId.end())
+			return;
+		unsigned int index = found->second;
+		byId.erase(found);
+		StreamedTexture& texture = textures[index];
+		residentBytes -= bytesFor(texture, texture.residentTop);
+		glDeleteTextures(1, &texture.id);
+		texture.id = 0;
+		texture.file = Ktx2File();
+		texture.residentTop = texture.tailTop = texture.wantedTop = texture.frameWanted = 0;
+		texture.removed = true;
+		// a load in flight still points at the slot, it's freed when that comes back
+		if (!texture.loading)
+			freeSlots.push_back(index);
+	}
+
+	// VRAM a texture (by its current name) holds right now
+	uint64_t residentSize(unsigned int id) const {
+		auto found = byId.find(id);
+		if (found == byId.end())
+			return 0;
+		const StreamedTexture& texture = textures[found->second];
+		return bytesFor(texture, texture.residentTop);
+	}
+
+	// The texture covers about `pixels` pixels across on screen this frame
+	void requestPixels(unsigned int id, float pixels) {
+		auto found = byId.find(id);
+		if (found == byId.end())
+			return;
+		StreamedTexture& texture = textures[found->second];
+		float size = (float)std::max(texture.file.width, texture.file.height);
+		float level = pixels > 1.0f ? std::floor(std::log2(size / pixels)) : (float)texture.tailTop;
+		unsigned int wanted = (unsigned int)std::min(std::max(level, 0.0f), (float)texture.tailTop);
+		texture.frameWanted = std::min(texture.frameWanted, wanted);
+		texture.lastUsed = frame;
+	}
+
+	// Material tables whose texture names get patched when a texture is reallocated
+	void addListener(MaterialTable* table) {
+		listeners.push_back(table);
+	}
+
+	void removeListener(MaterialTable* table) {
+		listeners.erase(std::remove(listeners.begin(), listeners.end(), table), listeners.end());
+	}
+
+	// Once per frame on the GL thread, after all requestPixels calls
+	void update() {
+		// this frame's requests become the targets
+		for (StreamedTexture& texture : textures) {
+			texture.wantedTop = texture.frameWanted;
+			texture.frameWanted = texture.tailTop;
+		}
+
+		// apply finished loads, making room first
+		std::vector<LoadedLevels> ready;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			while (!completed.empty() && ready.size() < STREAMING_UPLOADS_PER_FRAME) {
+				ready.push_back(std::move(completed.front()));
+				completed.pop_front();
+			}
+		}
+		for (LoadedLevels& loaded : ready) {
+			StreamedTexture& texture = textures[loaded.texture];
+			texture.loading = false;
+			if (texture.removed) {
+				freeSlots.push_back(loaded.texture);
+				continue;
+			}
+			bool complete = true;
+			for (const std::vector<unsigned char>& level : loaded.levels) {
+				complete &= !level.empty();
+			}
+			if (!complete) {
+				std::cout << "ERROR::TEXTURE_STREAMING::COULD_NOT_READ " << texture.file.path << std::endl;
+				continue;
+			}
+			uint64_t extra = bytesFor(texture, loaded.top) - bytesFor(texture, texture.residentTop);
+			if (!makeRoom(extra, loaded.texture))
+				continue; // everything else is in use, try again when it isn't
+			applyLevels(loaded);
+		}
+
+		// start loads for textures wanting more
+		for (unsigned int i = 0; i < textures.size(); i++) {
+			StreamedTexture& texture = textures[i];
+			if (texture.removed || texture.loading || texture.wantedTop >= texture.residentTop)
+				continue;
+			texture.loading = true;
+			Ktx2File file = texture.file;
+			unsigned int top = texture.wantedTop;
+			unsigned int end = texture.residentTop;
+			inFlight++;
+			workerPool().submit([this, file, i, top, end]() {
+				LoadedLevels loaded;
+				loaded.texture = i;
+				loaded.top = top;
+				for (unsigned int level = top; level < end; level++) {
+					loaded.levels.push_back(file.readLevel(level));
+				}
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					completed.push_back(std::move(loaded));
+				}
+				inFlight--;
+			});
+		}
+
+		frame++;
+	}
+
+	StreamingStats stats() const {
+		StreamingStats stats;
+		stats.budgetBytes = budget;
+		stats.residentBytes = residentBytes;
+		stats.textures = (unsigned int)byId.size();
+		stats.uploads = uploads;
+		stats.evictions = evictions;
+		for (const StreamedTexture& texture : textures) {
+			if (texture.removed)
+				continue;
+			stats.fullResolutionBytes += bytesFor(texture, 0);
+			stats.fullyResident += texture.residentTop == 0;
+			stats.loading += texture.loading;
+		}
+		return stats;
+	}
+
+	void printStats() const {
+		StreamingStats s = stats();
+		std::cout << "TEXTURE STREAMING: " << s.residentBytes / (1024.0 * 1024.0) << " / " << s.budgetBytes / (1024.0 * 1024.0)
+			<< " MB resident (" << s.fullResolutionBytes / (1024.0 * 1024.0) << " MB at full res), "
+			<< s.fullyResident << "/" << s.textures << " textures at full res, " << s.loading << " loading, "
+			<< s.uploads << " uploads, " << s.evictions << " evictions\n";
+	}
+
+private:
+	std::vector<StreamedTexture> textures;
+	std::unordered_map<unsigned int, unsigned int> byId; // GL name -> textures index
+	std::vector<unsigned int> freeSlots; // removed textures whose slots can be reused
+	std::vector<MaterialTable*> listeners;
+	std::deque<LoadedLevels> completed;
+	std::mutex mutex;
+	std::atomic<unsigned int> inFlight{ 0 };
+	uint64_t frame = 1;
+	uint64_t residentBytes = 0;
+	unsigned int uploads = 0;
+	unsigned int evictions = 0;
+
+	static uint64_t bytesFor(const StreamedTexture& texture, unsigned int top) {
+		uint64_t bytes = 0;
+		for (unsigned int level = top; level < texture.file.levels.size(); level++) {
+			bytes += texture.file.levels[level].size;
+		}
+		return bytes;
+	}
+
+	// Evict until `extra` more bytes fit: the least recently used texture holding more levels than it asked for last
+	// frame drops down to what it asked for (its tail if it wasn't drawn). Returns false if that isn't enough.
+	bool makeRoom(uint64_t extra, unsigned int keep) {
+		while (residentBytes + extra > budget) {
+			unsigned int victim = (unsigned int)textures.size();
+			for (unsigned int i = 0; i < textures.size(); i++) {
+				const StreamedTexture& texture = textures[i];
+				if (i == keep || texture.removed || texture.loading || texture.residentTop >= texture.wantedTop)
+					continue;
+				if (victim == textures.size() || texture.lastUsed < textures[victim].lastUsed)
+					victim = i;
+			}
+			if (victim == textures.size())
+				return false;
+			dropTo(victim, textures[victim].wantedTop);
+			evictions++;
+		}
+		return true;
+	}
+
+	void dropTo(unsigned int index, unsigned int top) {
+		LoadedLevels nothing;
+		nothing.texture = index;
+		nothing.top = top;
+		applyLevels(nothing);
+	}
+
+	// Reallocate a texture holding levels [loaded.top, end): levels it already had are copied on the GPU, the rest
+	// come from loaded.levels
+	void applyLevels(const LoadedLevels& loaded) {
+		StreamedTexture& texture = textures[loaded.texture];
+		unsigned int levelCount = (unsigned int)texture.file.levels.size();
+		unsigned int top = loaded.top;
+		const Ktx2Level& topLevel = texture.file.levels[top];
+
+		unsigned int id;
+		glGenTextures(1, &id);
+		glBindTexture(GL_TEXTURE_2D, id);
+		glTexStorage2D(GL_TEXTURE_2D, levelCount - top, texture.format, topLevel.width, topLevel.height);
+
+		for (unsigned int level = top; level < levelCount; level++) {
+			const Ktx2Level& info = texture.file.levels[level];
+			if (level >= texture.residentTop) {
+				glCopyImageSubData(texture.id, GL_TEXTURE_2D, level - texture.residentTop, 0, 0, 0,
+					id, GL_TEXTURE_2D, level - top, 0, 0, 0, info.width, info.height, 1);
+			}
+			else {
+				const std::vector<unsigned char>& data = loaded.levels[level - top];
+				glCompressedTexSubImage2D(GL_TEXTURE_2D, level - top, 0, 0, info.width, info.height, texture.format, (GLsizei)data.size(), data.data());
+			}
+		}
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texture.wrapS);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, texture.wrapT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture.minFilter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, texture.magFilter);
+
+		residentBytes += bytesFor(texture, top);
+		if (texture.id != 0) {
+			residentBytes -= bytesFor(texture, texture.residentTop);
+			glDeleteTextures(1, &texture.id);
+			byId.erase(texture.id);
+			for (MaterialTable* table : listeners) {
+				table->replaceTexture(texture.id, id);
+			}
+			uploads++;
+		}
+		texture.id = id;
+		texture.residentTop = top;
+		byId[id] = loaded.texture;
+	}
+};
+
+inline TextureStreamer& textureStreamer() {
+	static TextureStreamer streamer;
+	return streamer;
+}
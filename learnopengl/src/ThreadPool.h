@@ -0,0 +1,135 @@
+#pragma once
+#include <thread>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "Profiler.h"
+
+// Small persistent worker pool. Threads are created once and sleep until jobs are submitted, so it is cheap enough
+// to use from inside the frame (e.g. one parallelFor per hierarchy level).
+class ThreadPool
+{
+public:
+	ThreadPool(unsigned int threadCount = defaultThreadCount()) {
+		for (unsigned int i = 0; i < threadCount; i++) {
+			workers.emplace_back([this] { workerLoop(); });
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned int size() const {
+		return (unsigned int)workers.size();
+	}
+
+	void submit(std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+		}
+		wake.notify_one();
+	}
+
+	// Run a single queued job on the calling thread, returns false if there was nothing to do
+	bool runPendingJob() {
+		std::function<void()> job;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (jobs.empty())
+				return false;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		job();
+		return true;
+	}
+
+	// Calls fn(begin, end) over [0, count) in chunks of at least `grain` items. The calling thread takes part in the
+	// work and keeps draining the queue while it waits, so nested calls from worker threads can't deadlock.
+	template<typename F>
+	void parallelFor(unsigned int count, unsigned int grain, F&& fn) {
+		if (grain == 0)
+			grain = 1;
+		unsigned int chunks = (count + grain - 1) / grain;
+		if (chunks <= 1 || workers.empty()) {
+			if (count > 0)
+				fn(0u, count);
+			return;
+		}
+
+		std::atomic<unsigned int> nextChunk(0);
+		std::atomic<unsigned int> helpersDone(0);
+		auto work = [&]() {
+			unsigned int chunk;
+			while ((chunk = nextChunk.fetch_add(1)) < chunks) {
+				unsigned int begin = chunk * grain;
+				unsigned int end = begin + grain < count ? begin + grain : count;
+				fn(begin, end);
+			}
+		};
+
+		unsigned int helpers = chunks - 1 < size() ? chunks - 1 : size();
+		for (unsigned int i = 0; i < helpers; i++) {
+			submit([&]() {
+				work();
+				helpersDone.fetch_add(1, std::memory_order_release);
+			});
+		}
+		work();
+
+		// helpers reference this stack frame, so wait until all of them have left it
+		while (helpersDone.load(std::memory_order_acquire) < helpers) {
+			if (!runPendingJob())
+				std::this_thread::yield();
+		}
+	}
+
+	static unsigned int defaultThreadCount() {
+		unsigned int hw = std::thread::hardware_concurrency();
+		return hw > 1 ? hw - 1 : 0; // leave one core for the thread that owns the pool
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	void workerLoop() {
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (stopping && jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			PROFILE_SCOPE("job");
+			job();
+		}
+	}
+};
+
+// Shared pool used by the loader and the per-frame systems
+inline ThreadPool& workerPool() {
+	static ThreadPool pool;
+	return pool;
+}
@@ -0,0 +1,219 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "SimdMath.h"
+#include "ThreadPool.h"
+
+// below this many dirty nodes we only walk their subtrees instead of sweeping every level
+const unsigned int SPARSE_UPDATE_LIMIT = 64;
+// nodes per job when a level is split across the worker pool
+const unsigned int TRANSFORM_GRAIN = 2048;
+
+/* Node hierarchy flattened into separate arrays (SoA). Nodes have to be added in breadth-first order, which gives us:
+	- every parent comes before its children
+	- each depth level is one contiguous range (levelStart)
+	- the children of a node are contiguous in the next level, and so is a whole subtree at any given depth
+so a level can be updated in parallel, and a dirty subtree is just one index range per level. */
+class TransformHierarchy
+{
+public:
+	std::vector<int> parent; // -1 for roots
+	std::vector<unsigned int> firstChild;
+	std::vector<unsigned int> childCount;
+	std::vector<glm::vec3> translation;
+	std::vector<glm::quat> rotation;
+	std::vector<glm::vec3> scale;
+	std::vector<glm::mat4> matrix; // glTF nodes can give a matrix instead of TRS
+	std::vector<glm::mat4> local;
+	std::vector<glm::mat4> world;
+	std::vector<unsigned int> levelStart; // nodes in [levelStart[d], levelStart[d + 1]) have depth d
+	std::vector<std::string> names;
+	unsigned int version = 0; // goes up whenever a node is added or changed
+
+	unsigned int size() const {
+		return (unsigned int)parent.size();
+	}
+
+	unsigned int addNode(int parentIndex, const std::string& name, glm::vec3 t, glm::quat r, glm::vec3 s, glm::mat4 m = glm::mat4(1.0f)) {
+		unsigned int index = size();
+		if (parentIndex >= (int)index)
+			throw std::invalid_argument("ERROR::TRANSFORMS: parent must be added before its children\n");
+		unsigned int nodeDepth = parentIndex < 0 ? 0 : depth[parentIndex] + 1;
+		if (nodeDepth + 1 < levelStart.size() || nodeDepth > levelStart.size())
+			throw std::invalid_argument("ERROR::TRANSFORMS: nodes must be added in breadth-first order\n");
+
+		if (parentIndex >= 0) {
+			if (childCount[parentIndex] == 0)
+				firstChild[parentIndex] = index;
+			else if (firstChild[parentIndex] + childCount[parentIndex] != index)
+				throw std::invalid_argument("ERROR::TRANSFORMS: children of a node must be added together\n");
+			childCount[parentIndex]++;
+		}
+		if (nodeDepth == levelStart.size())
+			levelStart.push_back(index);
+
+		parent.push_back(parentIndex);
+		depth.push_back(nodeDepth);
+		firstChild.push_back(0);
+		childCount.push_back(0);
+		translation.push_back(t);
+		rotation.push_back(r);
+		scale.push_back(s);
+		matrix.push_back(m);
+		local.push_back(glm::mat4(1.0f));
+		world.push_back(glm::mat4(1.0f));
+		names.push_back(name);
+		localDirty.push_back(0);
+		changed.push_back(0);
+
+		markDirty(index);
+		return index;
+	}
+
+	int findNode(const std::string& name) const {
+		for (unsigned int i = 0; i < names.size(); i++) {
+			if (names[i] == name)
+				return i;
+		}
+		return -1;
+	}
+
+	void setTranslation(unsigned int node, glm::vec3 value) {
+		translation[node] = value;
+		markDirty(node);
+	}
+
+	void setRotation(unsigned int node, glm::quat value) {
+		rotation[node] = value;
+		markDirty(node);
+	}
+
+	void setScale(unsigned int node, glm::vec3 value) {
+		scale[node] = value;
+		markDirty(node);
+	}
+
+	void setMatrix(unsigned int node, const glm::mat4& value) {
+		matrix[node] = value;
+		markDirty(node);
+	}
+
+	bool isDirty() const {
+		return !dirtyNodes.empty();
+	}
+
+	// Recompute local/world matrices of every dirty node and everything below it
+	void update() {
+		if (dirtyNodes.empty())
+			return;
+
+		if (dirtyNodes.size() <= SPARSE_UPDATE_LIMIT)
+			updateSparse();
+		else
+			updateDense();
+
+		for (unsigned int node : dirtyNodes) {
+			localDirty[node] = 0;
+		}
+		dirtyNodes.clear();
+	}
+
+private:
+	std::vector<unsigned int> depth;
+	std::vector<unsigned char> localDirty;
+	std::vector<unsigned char> changed; // dense path: node or one of its ancestors was dirty
+	std::vector<unsigned int> dirtyNodes;
+
+	void markDirty(unsigned int node) {
+		version++;
+		if (!localDirty[node]) {
+			localDirty[node] = 1;
+			dirtyNodes.push_back(node);
+		}
+	}
+
+	void composeLocal(unsigned int i) {
+		// T * R * S without building the three matrices
+		glm::mat4 trs = glm::mat4_cast(rotation[i]);
+		trs[0] *= scale[i].x;
+		trs[1] *= scale[i].y;
+		trs[2] *= scale[i].z;
+		trs[3] = glm::vec4(translation[i], 1.0f);
+		simd::mulMat4(trs, matrix[i], local[i]);
+	}
+
+	void updateNode(unsigned int i) {
+		if (localDirty[i])
+			composeLocal(i);
+		if (parent[i] < 0)
+			world[i] = local[i];
+		else
+			simd::mulMat4(world[parent[i]], local[i], world[i]);
+	}
+
+	void updateRange(unsigned int begin, unsigned int end) {
+		workerPool().parallelFor(end - begin, TRANSFORM_GRAIN, [&](unsigned int b, unsigned int e) {
+			for (unsigned int i = begin + b; i < begin + e; i++) {
+				updateNode(i);
+			}
+		});
+	}
+
+	// Few dirty nodes: walk each dirty subtree level by level
+	void updateSparse() {
+		for (unsigned int node : dirtyNodes) {
+			// a dirty ancestor's sweep already covers this node (and picks up its local change)
+			bool covered = false;
+			for (int p = parent[node]; p >= 0; p = parent[p]) {
+				if (localDirty[p]) {
+					covered = true;
+					break;
+				}
+			}
+			if (covered)
+				continue;
+
+			unsigned int begin = node;
+			unsigned int end = node + 1;
+			while (begin < end) {
+				updateRange(begin, end);
+
+				// descendants at the next level are the children of the first..last node in this range that has any
+				unsigned int nextBegin = 0, nextEnd = 0;
+				for (unsigned int i = begin; i < end; i++) {
+					if (childCount[i] > 0) {
+						nextBegin = firstChild[i];
+						break;
+					}
+				}
+				for (unsigned int i = end; i > begin; i--) {
+					if (childCount[i - 1] > 0) {
+						nextEnd = firstChild[i - 1] + childCount[i - 1];
+						break;
+					}
+				}
+				begin = nextBegin;
+				end = nextEnd;
+			}
+		}
+	}
+
+	// Lots of dirty nodes: sweep every level, propagating the dirty flag down as we go
+	void updateDense() {
+		for (unsigned int level = 0; level < levelStart.size(); level++) {
+			unsigned int begin = levelStart[level];
+			unsigned int end = level + 1 < levelStart.size() ? levelStart[level + 1] : size();
+			workerPool().parallelFor(end - begin, TRANSFORM_GRAIN, [&](unsigned int b, unsigned int e) {
+				for (unsigned int i = begin + b; i < begin + e; i++) {
+					changed[i] = localDirty[i] | (parent[i] >= 0 ? changed[parent[i]] : 0);
+					if (changed[i])
+						updateNode(i);
+				}
+			});
+		}
+	}
+};
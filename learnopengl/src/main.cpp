@@ -6,23 +6,64 @@
 #include <stb_image.h>
 
 #include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory>
 #include "Shader.h"
 #include "Camera.h"
 #include "Model.h"
+#include "AssetManager.h"
+#include "Scene.h"
+#include "Headless.h"
+#include "Profiler.h"
+#include "FrameLoop.h"
+#include "RenderCommands.h"
+#include "Benchmark.h"
+#include "ClusteredLights.h"
+#include "ShadowCascades.h"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow* window);
+void simulate(GLFWwindow* window, float deltaTime);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void renderLoop(GLFWwindow* window, RenderQueue& queue);
+bool replay(const RenderCommandList& list, std::vector<std::shared_ptr<Model>>& models, Scene* scene, ShaderPermutations& shaders, FrameTransforms& frameTransforms, ClusteredLights& lights, ShadowCascades& shadows, unsigned int width, unsigned int height, bool repeat);
+void clearFrame(const glm::vec4& color);
+template <typename Drawable>
+void renderFrame(Drawable& drawable, ShaderPermutations& shaders, FrameTransforms& frameTransforms, ClusteredLights& lights, ShadowCascades& shadows, const glm::mat4& view, const glm::mat4& projection, float viewportHeight);
+int runHeadless(const HeadlessOptions& options);
+
+// Test models
+//const char* MODEL_PATH = "assets/gltf/real-time_bones_demo_phoenix_bird/";
+//const char* MODEL_PATH = "assets/gltf/dusty_old_bookshelf_free/";
+const char* MODEL_PATH = "assets/gltf/survival_guitar_backpack/";
+// scene file shown instead of MODEL_PATH when set (see "Scene Maker" for making one)
+const char* SCENE_PATH = std::getenv("LEARNOPENGL_SCENE");
+
+// how long the render thread waits for a new frame before checking whether a resize needs a redraw
+const std::chrono::milliseconds RENDER_IDLE_WAIT(16);
 
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
-unsigned int SCR_WIDTH = 800;
-unsigned int SCR_HEIGHT = 600;
+// written by the main thread's resize callback, read by the render thread
+std::atomic<unsigned int> SCR_WIDTH{ 800 };
+std::atomic<unsigned int> SCR_HEIGHT{ 600 };
 float lastX, lastY; // why even initialize?
 bool firstMouse = true;
 
-float lastFrame = 0.0f;
-float deltaTime = 0.0f;
+// --replay: camera path driving every frame instead of input (read-only once the render thread runs)
+std::vector<CameraKey> cameraPath;
+// --record: camera of every frame so far, written out at exit
+std::vector<CameraKey> recordedPath;
+
+// mouse movement since the last simulation step, applied by the next one
+float pendingMouseX = 0.0f;
+float pendingMouseY = 0.0f;
+// one-off requests from the key callback, recorded into the next frame's command list
+bool printStreamingStatsRequested = false;
+bool toggleProfileRequested = false;
 
 // Weird way (?) to force computer to use NVIDIA or AMD dedicated GPU
 extern "C"
@@ -31,7 +72,27 @@ extern "C"
 	__declspec(dllexport) int AmdPowerXpressRequestHighPerformance = 1;
 }
 
-int main() {
+int main(int argc, char** argv) {
+	profiler().setThreadName("main");
+	HeadlessOptions headless;
+	if (!headless.parse(argc, argv)) {
+		std::cout << "usage: learnopengl [--headless [--frames N] [--size WxH] [--out dir] [--format ppm|raw]] [--record path | --replay path [--frames N]]\n";
+		return -1;
+	}
+	if (!headless.replayPath.empty()) {
+		try {
+			cameraPath = readCameraPath(headless.replayPath);
+		}
+		catch (const std::exception& e) {
+			std::cout << e.what() << std::endl;
+			return -1;
+		}
+		if (!headless.framesGiven)
+			headless.frames = (unsigned int)cameraPath.size();
+	}
+	if (headless.enabled)
+		return runHeadless(headless);
+
 	// Initialize window object
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -44,69 +105,394 @@ int main() {
 		glfwTerminate();
 		return -1;
 	}
-	glfwMakeContextCurrent(window);
-
-	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-		std::cout << "FAILED TO INITIALIZE GLAD\n";
-			return -1;
-	}
 
 	// Actually open window
-	glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 	glfwSetCursorPosCallback(window, mouse_callback);
 	glfwSetScrollCallback(window, scroll_callback);
+	glfwSetKeyCallback(window, key_callback);
 
-	// OpenGL global parameters
-	glEnable(GL_DEPTH_TEST);
-
-	// Shader setup
-	Shader shaderProgram("shaders/texture.vert", "shaders/texture.frag");
+	// GL lives on the render thread from here on, this thread only does input, simulation and recording
+	RenderQueue renderQueue;
+	std::thread renderThread(renderLoop, window, std::ref(renderQueue));
 
-	// Test models
-	//Model ourModel("assets/gltf/real-time_bones_demo_phoenix_bird/");
-	//Model ourModel("assets/gltf/dusty_old_bookshelf_free/");
-	Model ourModel("assets/gltf/survival_guitar_backpack/");
+	// camera is simulated at a fixed rate, frames show it interpolated between the last two steps
+	FrameLoop loop;
+	Camera previousCamera = camera;
+	// a replay submits its warm-up and timed frames, then waits for the render thread to finish and close the queue
+	unsigned int replayFrames = cameraPath.empty() ? 0 : BENCHMARK_WARMUP_FRAMES + headless.frames;
+	unsigned int replayFrame = 0;
 				   
-	while (!glfwWindowShouldClose(window)) {
+	while (!glfwWindowShouldClose(window) && !renderQueue.isClosed()) {
+		PROFILE_SCOPE("frame");
+
 		// input   
-		float currentFrame = glfwGetTime();
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
 		processInput(window);
+		CameraKey key;
+		if (!cameraPath.empty()) {
+			if (replayFrame == replayFrames) {
+				glfwWaitEventsTimeout(0.01);
+				continue;
+			}
+			key = replayKey(cameraPath, replayFrame++);
+		}
+		else {
+			PROFILE_SCOPE("simulate");
+			for (unsigned int steps = loop.advance(); steps > 0; steps--) {
+				previousCamera = camera;
+				simulate(window, (float)loop.stepSeconds());
+			}
+			key = cameraKey(previousCamera, camera, loop.alpha());
+			if (!headless.recordPath.empty())
+				recordedPath.push_back(key);
+		}
 				   
-		// rendering
-		glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-				   
-		glm::mat4 view = camera.GetViewMatrix();
-		glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.10f, 10000.0f);
+		// record the frame, the render thread replays it while we simulate the next one
+		{
+			PROFILE_SCOPE("record");
+			RenderCommandList& list = renderQueue.beginRecording();
+			list.clear(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+			list.setCamera(cameraKeyView(key), 45.0f, 0.10f, 10000.0f);
+			if (SCENE_PATH)
+				list.drawScene();
+			else
+				list.drawModel(0);
+			if (printStreamingStatsRequested)
+				list.printStreamingStats();
+			if (toggleProfileRequested)
+				list.toggleProfileCapture();
+			if (replayFrames > 0 && replayFrame == replayFrames)
+				list.endBenchmark();
+			printStreamingStatsRequested = toggleProfileRequested = false;
+			renderQueue.submit();
+		}
 
-		ourModel.Draw(shaderProgram, view, projection);
-		// swap buffers and check and call events
-		glfwSwapBuffers(window);
+		// check and call events
 		glfwPollEvents();
+		loop.waitForNextFrame();
 	}
 
+	renderQueue.close();
+	renderThread.join();
+	if (!headless.recordPath.empty() && writeCameraPath(headless.recordPath, recordedPath))
+		std::cout << "recorded " << recordedPath.size() << " frames to " << headless.recordPath << std::endl;
+	profiler().shutdown();
 	glfwTerminate();
 	return 0;
 }
 
-void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
-	glViewport(0, 0, width, height);
+// Owns the GL context: loads everything that needs GL, then replays the command lists the main thread submits and
+// presents them. Redraws the last list when the window got resized but no new frame came (the main thread is stuck
+// in the OS's resize loop on some platforms). Times every new frame when replaying a camera path and reports at exit.
+void renderLoop(GLFWwindow* window, RenderQueue& queue) {
+	profiler().setThreadName("render");
+	glfwMakeContextCurrent(window);
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+		std::cout << "FAILED TO INITIALIZE GLAD\n";
+		queue.close();
+		return;
+	}
+
+	// OpenGL global parameters
+	glEnable(GL_DEPTH_TEST);
+
+	// Shader setup, variants are compiled on demand from one source
+	detectShaderVersion();
+	enableParallelShaderCompile((GLADloadproc)glfwGetProcAddress);
+	ShaderPermutations meshShaders("shaders/mesh.vert", "shaders/mesh.frag");
+	ShadowCascades shadows;
+
+	// draw commands refer to models by index, the asset manager makes sure each is only loaded once. Models load in
+	// over the first frames (within the load scheduler's per-frame budget) and draw whatever is ready meanwhile, except
+	// for a benchmark, which loads everything before its first frame so loading doesn't show up in its frame times.
+	bool benchmark = !cameraPath.empty();
+	std::vector<std::shared_ptr<Model>> models;
+	std::unique_ptr<Scene> scene;
+	if (SCENE_PATH) {
+		try {
+			scene = std::make_unique<Scene>(SCENE_PATH, !benchmark);
+			if (benchmark) {
+				scene->RequestShaders(meshShaders);
+				scene->RequestShaders(shadows.shaders);
+			}
+		}
+		catch (const std::exception& e) {
+			std::cout << e.what() << std::endl;
+		}
+	}
+	else if (benchmark) {
+		models.push_back(assetManager().acquire(MODEL_PATH));
+		models.back()->RequestShaders(meshShaders);
+		models.back()->RequestShaders(shadows.shaders);
+	}
+	else {
+		models.push_back(assetManager().acquireAsync(MODEL_PATH));
+	}
+
+	// per-frame MVP buffer, shared by every model
+	FrameTransforms frameTransforms;
+	ClusteredLights lights;
+
+	FrameStats stats;
+	const RenderCommandList* last = nullptr;
+	unsigned int width = 0, height = 0;
+	while (true) {
+		const RenderCommandList* list = queue.acquire(RENDER_IDLE_WAIT);
+		if (queue.isClosed())
+			break;
+		bool resized = width != SCR_WIDTH || height != SCR_HEIGHT;
+		width = SCR_WIDTH;
+		height = SCR_HEIGHT;
+		if (resized)
+			glViewport(0, 0, width, height);
+		if (list)
+			last = list;
+		else if (!resized || !last)
+			continue;
+		if (width == 0 || height == 0)
+			continue; // minimized
+
+		// redraws of the same list aren't part of the path
+		bool timed = benchmark && list;
+		if (timed)
+			stats.begin();
+		profiler().beginFrame();
+		PROFILE_SCOPE("render frame");
+		loadScheduler().update(&meshShaders);
+		streamingBuffer().beginFrame();
+		bool finished = replay(*last, models, scene.get(), meshShaders, frameTransforms, lights, shadows, width, height, list == nullptr);
+		streamingBuffer().endFrame();
+		assetManager().collect();
+		{
+			PROFILE_SCOPE("swap");
+			glfwSwapBuffers(window);
+		}
+		if (timed)
+			stats.end();
+		if (finished) {
+			queue.close();
+			break;
+		}
+	}
+	if (benchmark)
+		stats.report();
+
+	// GL objects go while the context is still current
+	loadScheduler().cancel();
+	models.clear();
+	scene.reset();
+	shadows.release();
+	assetManager().release();
+	streamingBuffer().release();
+	glfwMakeContextCurrent(NULL);
+}
+
+// Executes one recorded frame. A repeat (redraw of an already replayed list) skips the one-off commands. True if the
+// list ended a benchmark.
+bool replay(const RenderCommandList& list, std::vector<std::shared_ptr<Model>>& models, Scene* scene, ShaderPermutations& shaders, FrameTransforms& frameTransforms, ClusteredLights& lights, ShadowCascades& shadows, unsigned int width, unsigned int height, bool repeat) {
+	glm::mat4 view = glm::mat4(1.0f);
+	glm::mat4 projection = glm::mat4(1.0f);
+	bool finished = false;
+	for (const RenderCommand& command : list) {
+		switch (command.type) {
+		case RENDER_CLEAR:
+			clearFrame(command.color);
+			break;
+		case RENDER_SET_CAMERA:
+			view = command.view;
+			projection = glm::perspective(glm::radians(command.fovY), (float)width / (float)height, command.zNear, command.zFar);
+			break;
+		case RENDER_DRAW_MODEL:
+			if (command.model < models.size())
+				renderFrame(*models[command.model], shaders, frameTransforms, lights, shadows, view, projection, (float)height);
+			break;
+		case RENDER_DRAW_SCENE:
+			if (scene)
+				renderFrame(*scene, shaders, frameTransforms, lights, shadows, view, projection, (float)height);
+			break;
+		case RENDER_PRINT_STREAMING_STATS:
+			if (!repeat)
+				textureStreamer().printStats();
+			break;
+		case RENDER_TOGGLE_PROFILE_CAPTURE:
+			if (!repeat) {
+				bool capturing = profiler().isEnabled();
+				profiler().setEnabled(!capturing);
+				if (capturing)
+					profiler().exportTrace(profiler().tracePath.empty() ? "profile.json" : profiler().tracePath);
+			}
+			break;
+		case RENDER_END_BENCHMARK:
+			finished = true;
+			break;
+		}
+	}
+	return finished;
+}
+
+void clearFrame(const glm::vec4& color) {
+	PROFILE_GPU_SCOPE("clear");
+	glClearColor(color.r, color.g, color.b, color.a);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+// Drawable: a Model or a Scene. Lights get scattered through it (LEARNOPENGL_LIGHTS of them) once its bounds are known,
+// the sun casts shadows from it.
+template <typename Drawable>
+void renderFrame(Drawable& drawable, ShaderPermutations& shaders, FrameTransforms& frameTransforms, ClusteredLights& lights, ShadowCascades& shadows, const glm::mat4& view, const glm::mat4& projection, float viewportHeight) {
+	{
+		PROFILE_SCOPE("light clusters");
+		glm::vec3 min, max;
+		if (!lights.placed && drawable.Bounds(min, max))
+			lights.scatter(clusteredLightCount(), min, max);
+		lights.bin(view, projection);
+		lights.upload();
+	}
+	// cascades that need redrawing go first, they reuse the drawable's per-frame state
+	shadows.render(drawable, frameTransforms, view, projection, lights.sunDirection);
+
+	// compute every MVP up front, then draw
+	{
+		PROFILE_SCOPE("prepare transforms");
+		frameTransforms.begin(view, projection);
+		drawable.PrepareFrame(frameTransforms);
+	}
+
+	// texture streaming works off this frame's camera
+	{
+		PROFILE_SCOPE("texture streaming");
+		drawable.UpdateStreaming(frameTransforms, viewportHeight);
+		textureStreamer().update();
+	}
+	{
+		PROFILE_SCOPE("upload transforms");
+		frameTransforms.upload();
+	}
+
+	{
+		PROFILE_GPU_SCOPE("main pass");
+		drawable.Draw(shaders, frameTransforms);
+	}
+}
 
-	// Allow perspective matrix to update aspect ratio
+// Batch rendering without a window: the camera does one orbit around the model over options.frames frames (or follows
+// the --replay camera path, and reports frame times like a windowed replay), each frame is rendered into an FBO and
+// read back asynchronously (written out if --out is given)
+int runHeadless(const HeadlessOptions& options) {
+	HeadlessContext context;
+	if (!context.create())
+		return -1;
+	if (!gladLoadGLLoader(HeadlessContext::loader())) {
+		std::cout << "FAILED TO INITIALIZE GLAD\n";
+		return -1;
+	}
+	detectShaderVersion();
+
+	RenderTarget target;
+	if (!target.create(options.width, options.height))
+		return -1;
+	glEnable(GL_DEPTH_TEST);
+
+	auto loadStart = std::chrono::steady_clock::now();
+	enableParallelShaderCompile(HeadlessContext::loader());
+	ShaderPermutations meshShaders("shaders/mesh.vert", "shaders/mesh.frag");
+	ShadowCascades shadows;
+	std::shared_ptr<Model> ourModel;
+	std::unique_ptr<Scene> scene;
+	if (SCENE_PATH) {
+		try {
+			scene = std::make_unique<Scene>(SCENE_PATH);
+		}
+		catch (const std::exception& e) {
+			std::cout << e.what() << std::endl;
+			return -1;
+		}
+		scene->RequestShaders(meshShaders);
+		scene->RequestShaders(shadows.shaders);
+	}
+	else {
+		ourModel = assetManager().acquire(MODEL_PATH);
+		ourModel->RequestShaders(meshShaders);
+		ourModel->RequestShaders(shadows.shaders);
+	}
+	FrameTransforms frameTransforms;
+	ClusteredLights lights;
+	FrameReader reader(options.width, options.height, options.outDir, options.raw);
+
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)options.width / (float)options.height, 0.10f, 10000.0f);
+	float radius = glm::length(camera.Position);
+	bool benchmark = !cameraPath.empty();
+	unsigned int frames = benchmark ? BENCHMARK_WARMUP_FRAMES + options.frames : options.frames;
+	FrameStats stats;
+	auto renderStart = std::chrono::steady_clock::now();
+	for (unsigned int frame = 0; frame < frames; frame++) {
+		stats.begin();
+		profiler().beginFrame();
+		PROFILE_SCOPE("frame");
+		glm::mat4 view;
+		if (benchmark) {
+			view = cameraKeyView(replayKey(cameraPath, frame));
+		}
+		else {
+			float angle = glm::radians(360.0f) * frame / options.frames;
+			glm::vec3 eye = glm::vec3(std::sin(angle), 0.0f, std::cos(angle)) * radius;
+			view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		}
+		streamingBuffer().beginFrame();
+		clearFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+		if (scene)
+			renderFrame(*scene, meshShaders, frameTransforms, lights, shadows, view, projection, (float)options.height);
+		else
+			renderFrame(*ourModel, meshShaders, frameTransforms, lights, shadows, view, projection, (float)options.height);
+		streamingBuffer().endFrame();
+		reader.read(frame);
+		stats.end();
+	}
+	reader.finish();
+	ourModel.reset();
+	scene.reset();
+	shadows.release();
+	assetManager().release();
+	streamingBuffer().release();
+	auto end = std::chrono::steady_clock::now();
+
+	double loadSeconds = std::chrono::duration<double>(renderStart - loadStart).count();
+	double renderSeconds = std::chrono::duration<double>(end - renderStart).count();
+	std::cout << "HEADLESS: " << glGetString(GL_RENDERER) << ", load " << loadSeconds << " s, " << frames << " frames at "
+		<< options.width << "x" << options.height << " in " << renderSeconds << " s (" << frames / renderSeconds << " fps), "
+		<< reader.framesWritten << " written" << std::endl;
+	if (benchmark)
+		stats.report();
+	profiler().shutdown();
+	return 0;
+}
+
+void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
+	// Allow perspective matrix to update aspect ratio, the render thread picks these up (and redraws) on its own
 	SCR_HEIGHT = height;
 	SCR_WIDTH = width;
-
-	// updates frames while resizing window requires multithreading
 }
 
 void processInput(GLFWwindow* window) {
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, true);
 
+	// TODO: is this performant?
+	if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_1) == GLFW_PRESS) {
+		// do stuff
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+		glfwSetCursorPosCallback(window, mouse_callback);
+	}
+	else {
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+		glfwSetCursorPosCallback(window, nullptr);
+		firstMouse = true;
+	}
+}
+
+// One fixed simulation step
+void simulate(GLFWwindow* window, float deltaTime) {
 	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
 		camera.ProcessKeyboard(FORWARD, deltaTime);
 	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
@@ -120,16 +506,9 @@ void processInput(GLFWwindow* window) {
 	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
 		camera.ProcessKeyboard(RIGHT, deltaTime);
 
-	// TODO: is this performant?
-	if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_1) == GLFW_PRESS) {
-		// do stuff
-		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-		glfwSetCursorPosCallback(window, mouse_callback);
-	}
-	else {
-		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
-		glfwSetCursorPosCallback(window, nullptr);
-		firstMouse = true;
+	if (pendingMouseX != 0.0f || pendingMouseY != 0.0f) {
+		camera.ProcessMouseMovement(pendingMouseX, pendingMouseY);
+		pendingMouseX = pendingMouseY = 0.0f;
 	}
 }
 
@@ -143,9 +522,20 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
 	float yOffset = (lastY - ypos);
 	lastX = xpos;
 	lastY = ypos;
-	camera.ProcessMouseMovement(xOffset, yOffset);
+	pendingMouseX += xOffset;
+	pendingMouseY += yOffset;
 }
 
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
 	camera.ProcessMouseScroll(yoffset);
+}
+
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+	// T: print texture residency, for tuning LEARNOPENGL_TEXTURE_BUDGET_MB
+	if (key == GLFW_KEY_T && action == GLFW_PRESS)
+		printStreamingStatsRequested = true;
+
+	// P: start a profile capture, P again: stop it and write profile.json (open in chrome://tracing or Perfetto)
+	if (key == GLFW_KEY_P && action == GLFW_PRESS)
+		toggleProfileRequested = true;
 }
\ No newline at end of file